@@ -6,6 +6,7 @@
 #include "crow/settings.h"
 #include "crow/socket_adaptors.h"
 #include "crow/json.h"
+#include "crow/json_struct.h"
 #include "crow/mustache.h"
 #include "crow/logging.h"
 #include "crow/dumb_timer_queue.h"
@@ -17,6 +18,8 @@
 #include "crow/http_response.h"
 #include "crow/multipart.h"
 #include "crow/routing.h"
+#include "crow/rcu_ptr.h"
+#include "crow/compiled_routing.h"
 #include "crow/middleware_context.h"
 #include "crow/compression.h"
 #include "crow/http_connection.h"
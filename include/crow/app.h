@@ -9,12 +9,16 @@
 #include <type_traits>
 #include <thread>
 #include <condition_variable>
+#include <mutex>
+#include <unordered_map>
 
 #include "crow/version.h"
 #include "crow/settings.h"
 #include "crow/logging.h"
 #include "crow/utility.h"
 #include "crow/routing.h"
+#include "crow/rcu_ptr.h"
+#include "crow/compiled_routing.h"
 #include "crow/middleware_context.h"
 #include "crow/http_request.h"
 #include "crow/http_server.h"
@@ -56,6 +60,7 @@ namespace crow
         using ssl_server_t = Server<Crow, SSLAdaptor, Middlewares...>;
 #endif
         Crow()
+            : routers_(new Router())
         {
         }
 
@@ -66,19 +71,40 @@ namespace crow
         template <typename Adaptor>
         void handle_upgrade(const request& req, response& res, Adaptor&& adaptor)
         {
-            router_.handle_upgrade(req, res, adaptor);
+            routers_.read()->handle_upgrade(req, res, adaptor);
         }
 
         ///Process the request and generate a response for it
         void handle(const request& req, response& res)
         {
-            router_.handle(req, res);
+            uint32_t compiled_methods = 0;
+            if (compiled_handle_ && compiled_handle_(compiled_routes_.get(), req, res, compiled_methods))
+                return;
+            routers_.read()->handle(req, res, compiled_methods);
+        }
+
+        ///Find the route of a request whose headers were just parsed (see \ref Router::resolve)
+        routing_handle_result resolve(HTTPMethod method, const std::string& url)
+        {
+            // compiled routes are matched again when handling, they only need to keep the request from being refused
+            if (compiled_methods_ && compiled_methods_(compiled_routes_.get(), url))
+                return routing_handle_result();
+            return routers_.read()->resolve(method, url);
+        }
+
+        ///Process the request with the route \ref resolve found for it
+        void handle(const request& req, response& res, routing_handle_result& found)
+        {
+            uint32_t compiled_methods = 0;
+            if (compiled_handle_ && compiled_handle_(compiled_routes_.get(), req, res, compiled_methods))
+                return;
+            routers_.read()->handle(req, res, found, compiled_methods);
         }
 
         ///Create a dynamic route using a rule (**Use CROW_ROUTE instead**)
         DynamicRule& route_dynamic(std::string&& rule)
         {
-            return router_.new_rule_dynamic(std::move(rule));
+            return routers_.get()->new_rule_dynamic(std::move(rule));
         }
 
         ///Create a route using a rule (**Use CROW_ROUTE instead**)
@@ -86,13 +112,45 @@ namespace crow
         auto route(std::string&& rule)
             -> typename std::result_of<decltype(&Router::new_rule_tagged<Tag>)(Router, std::string&&)>::type
         {
-            return router_.new_rule_tagged<Tag>(std::move(rule));
+            return routers_.get()->template new_rule_tagged<Tag>(std::move(rule));
         }
 
         ///Create a route for any requests without a proper route (**Use CROW_CATCHALL_ROUTE instead**)
         CatchallRule& catchall_route()
         {
-            return router_.catchall_rule();
+            return routers_.get()->catchall_rule();
+        }
+
+#ifndef CROW_MSVC_WORKAROUND
+        ///Use a fixed set of routes matched by code generated at compile time (see \ref crow::compile_routes)
+
+        ///
+        ///Requests are tried against these routes first, the ones they don't match go to the routes added with `CROW_ROUTE`.<br>
+        ///Has to be called before the app is run.
+        template <typename ... Rules>
+        self_t& compiled_routes(CompiledRouter<Rules...> routes)
+        {
+            compiled_routes_ = std::make_shared<CompiledRouter<Rules...>>(std::move(routes));
+            compiled_handle_ = &handle_compiled<Rules...>;
+            compiled_methods_ = &compiled_methods<Rules...>;
+            return *this;
+        }
+#endif
+
+        ///Change the routes of a running app
+
+        ///
+        ///`f` receives a copy of the current router, where routes can be added (`CROW_ROUTE(router, url)`) or removed (`router.remove_rule(url)`).<br>
+        ///The copy is then validated and atomically replaces the current router. Requests already being handled keep using the old one, which is deleted once they are done.<br>
+        ///If `f` or the validation throws, the current routes are left untouched.
+        template <typename Func>
+        void update_routes(Func&& f)
+        {
+            std::lock_guard<std::mutex> lock(routers_.write_mutex());
+            std::unique_ptr<Router> next = routers_.get()->clone();
+            f(*next);
+            next->validate();
+            routers_.publish(std::move(next));
         }
 
         self_t& signal_clear()
@@ -173,6 +231,63 @@ namespace crow
             return *this;
         }
 
+        ///Move websocket connections from the busiest worker thread to the quietest one, checking every `interval`
+
+        ///
+        ///Connections are moved when the busiest worker handled more than `threshold` times the websocket messages (received and sent) of the quietest one since the last check.
+        ///A connection only moves between two messages, and connections over SSL stay on their worker.
+        template <typename Duration>
+        self_t& websocket_rebalance(Duration interval, double threshold = 2)
+        {
+            rebalance_interval_ = std::chrono::duration_cast<std::chrono::milliseconds>(interval);
+            rebalance_threshold_ = threshold;
+            return *this;
+        }
+
+        ///Cache the routing results of up to `capacity` URLs in every worker thread (0, the default, disables the cache)
+
+        ///
+        ///Requests for a cached method and URL skip the trie lookup. The caches are emptied automatically whenever the rules change.
+        self_t& route_cache(size_t capacity)
+        {
+            routers_.get()->route_cache(capacity);
+            return *this;
+        }
+
+        ///Hit, miss and eviction counters of the route caches, summed over all worker threads
+        detail::route_cache::stats route_cache_stats()
+        {
+            return routers_.read()->route_cache_stats();
+        }
+
+        ///Parse the bodies of JSON requests (`Content-Type: application/json`) while they're received, into `req.json_body` instead of `req.body`
+
+        ///
+        ///The parse is done by the time the last part of the body arrives, and the body isn't kept twice.
+        self_t& parse_json_bodies(bool enabled = true)
+        {
+            parse_json_bodies_ = enabled;
+            return *this;
+        }
+
+        bool parses_json_bodies() const
+        {
+            return parse_json_bodies_;
+        }
+
+        ///Get the websocket channel with this name, created on first use
+
+        ///
+        ///Channels live as long as the app, so a connection can subscribe to one from any handler.
+        websocket::channel& channel(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex_);
+            auto& c = channels_[name];
+            if (!c)
+                c.reset(new websocket::channel);
+            return *c;
+        }
+
 #ifdef CROW_ENABLE_COMPRESSION
         self_t& use_compression(compression::algorithm algorithm)
         {
@@ -192,7 +307,7 @@ namespace crow
         ///Go through the rules, upgrade them if possible, and add them to the list of rules
         void validate()
         {
-            router_.validate();
+            routers_.get()->validate();
         }
 
         ///Notify anything using `wait_for_server_start()` to proceed
@@ -221,6 +336,7 @@ namespace crow
             {
                 ssl_server_ = std::move(std::unique_ptr<ssl_server_t>(new ssl_server_t(this, bindaddr_, port_, server_name_, &middlewares_, concurrency_, &ssl_context_)));
                 ssl_server_->set_tick_function(tick_interval_, tick_function_);
+                ssl_server_->set_websocket_rebalance(rebalance_interval_, rebalance_threshold_);
                 notify_server_start();
                 ssl_server_->run();
             }
@@ -229,6 +345,7 @@ namespace crow
             {
                 server_ = std::move(std::unique_ptr<server_t>(new server_t(this, bindaddr_, port_, server_name_, &middlewares_, concurrency_, nullptr)));
                 server_->set_tick_function(tick_interval_, tick_function_);
+                server_->set_websocket_rebalance(rebalance_interval_, rebalance_threshold_);
                 server_->signal_clear();
                 for (auto snum : signals_)
                 {
@@ -261,7 +378,7 @@ namespace crow
         void debug_print()
         {
             CROW_LOG_DEBUG << "Routing:";
-            router_.debug_print();
+            routers_.read()->debug_print();
         }
 
 
@@ -359,11 +476,29 @@ namespace crow
         }
 
     private:
+#ifndef CROW_MSVC_WORKAROUND
+        template <typename ... Rules>
+        static bool handle_compiled(void* routes, const request& req, response& res, uint32_t& methods)
+        {
+            return static_cast<CompiledRouter<Rules...>*>(routes)->handle(req, res, methods);
+        }
+
+        template <typename ... Rules>
+        static uint32_t compiled_methods(void* routes, const std::string& url)
+        {
+            return static_cast<CompiledRouter<Rules...>*>(routes)->methods_for(url);
+        }
+#endif
+
         uint16_t port_ = 80;
         uint16_t concurrency_ = 1;
         std::string server_name_ = std::string("Crow/") + VERSION;
         std::string bindaddr_ = "0.0.0.0";
-        Router router_;
+        detail::rcu_ptr<Router> routers_;
+        std::shared_ptr<void> compiled_routes_;
+        bool (*compiled_handle_)(void*, const request&, response&, uint32_t&) = nullptr;
+        uint32_t (*compiled_methods_)(void*, const std::string&) = nullptr;
+        bool parse_json_bodies_{false};
 
 #ifdef CROW_ENABLE_COMPRESSION
         compression::algorithm comp_algorithm_;
@@ -371,9 +506,14 @@ namespace crow
 
         std::chrono::milliseconds tick_interval_;
         std::function<void()> tick_function_;
+        std::chrono::milliseconds rebalance_interval_{0};
+        double rebalance_threshold_{2};
 
         std::tuple<Middlewares...> middlewares_;
 
+        std::unordered_map<std::string, std::unique_ptr<websocket::channel>> channels_;
+        std::mutex channels_mutex_;
+
 #ifdef CROW_ENABLE_SSL
         std::unique_ptr<ssl_server_t> ssl_server_;
 #endif
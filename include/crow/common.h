@@ -4,7 +4,14 @@
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <cstdint>
+#include <type_traits>
+#include <boost/utility/string_view.hpp>
+#include "crow/settings.h"
 #include "crow/utility.h"
+#ifdef CROW_CAN_USE_CPP17
+#include <string_view>
+#endif
 
 namespace crow
 {
@@ -80,57 +87,264 @@ namespace crow
         MAX
     };
 
+    namespace detail
+    {
+        /// A string routing parameter, pointing into the url it was matched in.
+
+        ///
+        /// Handlers taking a `std::string` get a copy, handlers taking a string view type get a view of the url without any allocation.
+        struct string_param
+        {
+            const char* data;
+            size_t size;
+
+            operator std::string() const
+            {
+                return std::string(data, size);
+            }
+
+            operator boost::string_view() const
+            {
+                return boost::string_view(data, size);
+            }
+
+#ifdef CROW_CAN_USE_CPP17
+            operator std::string_view() const
+            {
+                return std::string_view(data, size);
+            }
+#endif
+        };
+
+        /// The type a routing parameter of type `T` is handed to handlers as.
+        template <typename T>
+        struct param_type
+        {
+            using type = T;
+        };
+
+        template <>
+        struct param_type<std::string>
+        {
+            using type = string_param;
+        };
+
+        /// Whether `F` is a function object with a template call operator (a lambda taking `auto`), those get string parameters as `std::string`s.
+        template <typename F, typename = void>
+        struct is_generic_handler : std::is_class<F>
+        {
+        };
+
+        template <typename F>
+        struct is_generic_handler<F, decltype(void(&F::operator()))> : std::false_type
+        {
+        };
+
+        /// What a handler is called with for a parameter of type `T`, string parameters are only passed on as views if `Views`.
+        template <typename T, bool Views>
+        struct handler_param
+        {
+            using type = typename param_type<T>::type;
+        };
+
+        template <>
+        struct handler_param<std::string, false>
+        {
+            using type = std::string;
+        };
+    }
+
+    /// The parameters matched in a url, stored inline in the order they appear.
+
+    ///
+    /// String parameters are kept as a range of the url, so matching (and caching the match) never allocates.<br>
+    /// \ref get and \ref get_string count parameters of one type (the 2nd `int64_t` parameter is `get<int64_t>(1)`), \ref at and \ref string_at count all of them.
     struct routing_params
     {
-        std::vector<int64_t> int_params;
-        std::vector<uint64_t> uint_params;
-        std::vector<double> double_params;
-        std::vector<std::string> string_params;
+        /// The most parameters a url can have.
+        static constexpr unsigned max_params = 16;
+
+        struct string_range
+        {
+            uint32_t pos;
+            uint32_t size;
+        };
+
+        union param
+        {
+            int64_t int_value;
+            uint64_t uint_value;
+            double double_value;
+            string_range string_value;
+        };
+
+        param params[max_params];
+        ParamType types[max_params]; ///< The type of every parameter, `<path>` parameters are STRING as well.
+        unsigned size = 0;
+        const std::string* url = nullptr; ///< The url the string parameters are ranges of, set by the router before a rule handles the request.
+
+        void push_int(int64_t value)
+        {
+            types[size] = ParamType::INT;
+            params[size++].int_value = value;
+        }
+
+        void push_uint(uint64_t value)
+        {
+            types[size] = ParamType::UINT;
+            params[size++].uint_value = value;
+        }
+
+        void push_double(double value)
+        {
+            types[size] = ParamType::DOUBLE;
+            params[size++].double_value = value;
+        }
+
+        void push_string(size_t pos, size_t length)
+        {
+            types[size] = ParamType::STRING;
+            params[size++].string_value = string_range{static_cast<uint32_t>(pos), static_cast<uint32_t>(length)};
+        }
+
+        void pop()
+        {
+            size--;
+        }
 
         void debug_print() const
         {
             std::cerr << "routing_params" << std::endl;
-            for(auto i:int_params)
-                std::cerr<<i <<", " ;
-            std::cerr<<std::endl;
-            for(auto i:uint_params)
-                std::cerr<<i <<", " ;
-            std::cerr<<std::endl;
-            for(auto i:double_params)
-                std::cerr<<i <<", " ;
-            std::cerr<<std::endl;
-            for(auto& i:string_params)
-                std::cerr<<i <<", " ;
-            std::cerr<<std::endl;
+            for(unsigned i = 0; i < size; i ++)
+            {
+                switch (types[i])
+                {
+                    case ParamType::INT: std::cerr << params[i].int_value; break;
+                    case ParamType::UINT: std::cerr << params[i].uint_value; break;
+                    case ParamType::DOUBLE: std::cerr << params[i].double_value; break;
+                    default: std::cerr << "url[" << params[i].string_value.pos << ", +" << params[i].string_value.size << "]"; break;
+                }
+                std::cerr << ", ";
+            }
+            std::cerr << std::endl;
         }
 
+        /// The `index`th parameter of type `T` (a `std::string` is copied out of \ref url).
+        template <typename T>
+        T get(unsigned index) const;
+
+        /// The parameter at `position`, which has to be of type `T`.
         template <typename T>
-        T get(unsigned) const;
+        T at(unsigned position) const;
+
+        /// The `index`th string parameter, `url` has to be the url the parameters were matched in.
+        detail::string_param get_string(unsigned index, const std::string& url) const
+        {
+            return string_at(position_of(ParamType::STRING, index), url);
+        }
+
+        /// The string parameter at `position`, `url` has to be the url the parameters were matched in.
+        detail::string_param string_at(unsigned position, const std::string& url) const
+        {
+            return detail::string_param{url.data() + params[position].string_value.pos, params[position].string_value.size};
+        }
 
+    private:
+        unsigned position_of(ParamType type, unsigned index) const
+        {
+            for (unsigned i = 0; i < size; i++)
+            {
+                if (types[i] == type && index-- == 0)
+                    return i;
+            }
+            throw std::out_of_range("no such routing parameter");
+        }
     };
 
+    template<>
+    inline int64_t routing_params::at<int64_t>(unsigned position) const
+    {
+        return params[position].int_value;
+    }
+
+    template<>
+    inline uint64_t routing_params::at<uint64_t>(unsigned position) const
+    {
+        return params[position].uint_value;
+    }
+
+    template<>
+    inline double routing_params::at<double>(unsigned position) const
+    {
+        return params[position].double_value;
+    }
+
     template<>
     inline int64_t routing_params::get<int64_t>(unsigned index) const
     {
-        return int_params[index];
+        return at<int64_t>(position_of(ParamType::INT, index));
     }
 
     template<>
     inline uint64_t routing_params::get<uint64_t>(unsigned index) const
     {
-        return uint_params[index];
+        return at<uint64_t>(position_of(ParamType::UINT, index));
     }
 
     template<>
     inline double routing_params::get<double>(unsigned index) const
     {
-        return double_params[index];
+        return at<double>(position_of(ParamType::DOUBLE, index));
     }
 
     template<>
     inline std::string routing_params::get<std::string>(unsigned index) const
     {
-        return string_params[index];
+        if (!url)
+            throw std::logic_error("routing parameters without a url");
+        return std::string(get_string(index, *url));
+    }
+
+    /// The rule a request was routed to, found as soon as its headers are in.
+
+    ///
+    /// Kept with the request being read, so the body can be refused early and the lookup isn't repeated when it's handled.
+    struct routing_handle_result
+    {
+        uint64_t router_id{0}; ///< The router the result belongs to, 0 if there's no result.
+        unsigned rule_index{0}; ///< The rule to call, 0 if none was found.
+        routing_params params;
+        int reject_code{0}; ///< 404 or 405 if the request is refused whatever its body is.
+    };
+
+    namespace black_magic
+    {
+        // string views are string parameters for dynamic rules as well
+        template <>
+        struct parameter_tag<boost::string_view>
+        {
+            static const int value = 4;
+        };
+
+        template <>
+        struct promote<boost::string_view>
+        {
+            using type = std::string;
+        };
+
+#ifdef CROW_CAN_USE_CPP17
+        template <>
+        struct parameter_tag<std::string_view>
+        {
+            static const int value = 4;
+        };
+
+        template <>
+        struct promote<std::string_view>
+        {
+            using type = std::string;
+        };
+#endif
     }
 }
 
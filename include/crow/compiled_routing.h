@@ -0,0 +1,581 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "crow/settings.h"
+#include "crow/common.h"
+#include "crow/utility.h"
+#include "crow/logging.h"
+#include "crow/http_request.h"
+#include "crow/http_response.h"
+
+#ifndef CROW_MSVC_WORKAROUND
+
+#define CROW_INTERNAL_URL_CHARS_4(url, i) \
+    crow::black_magic::char_at(url, i), crow::black_magic::char_at(url, i + 1), \
+    crow::black_magic::char_at(url, i + 2), crow::black_magic::char_at(url, i + 3)
+#define CROW_INTERNAL_URL_CHARS_16(url, i) \
+    CROW_INTERNAL_URL_CHARS_4(url, i), CROW_INTERNAL_URL_CHARS_4(url, i + 4), \
+    CROW_INTERNAL_URL_CHARS_4(url, i + 8), CROW_INTERNAL_URL_CHARS_4(url, i + 12)
+#define CROW_INTERNAL_URL_CHARS_64(url) \
+    CROW_INTERNAL_URL_CHARS_16(url, 0), CROW_INTERNAL_URL_CHARS_16(url, 16), \
+    CROW_INTERNAL_URL_CHARS_16(url, 32), CROW_INTERNAL_URL_CHARS_16(url, 48)
+
+/// Declare a route of a \ref crow::CompiledRouter, the url is matched by code generated at compile time (up to 63 characters).
+#define CROW_COMPILED_ROUTE(url) \
+    crow::compiled_route<crow::black_magic::url_string<crow::black_magic::const_str(url).size(), CROW_INTERNAL_URL_CHARS_64(url)>>()
+
+namespace crow
+{
+    namespace black_magic
+    {
+        constexpr char char_at(const_str s, unsigned i)
+        {
+            return i < s.size() ? s[i] : 0;
+        }
+
+        /// A url turned into a type, so code can be generated for every one of its characters.
+        template <unsigned N, char ... C>
+        struct url_string
+        {
+            static_assert(N < sizeof...(C), "CROW_COMPILED_ROUTE urls are limited to 63 characters");
+            static constexpr unsigned size = N;
+            static constexpr char value[sizeof...(C) + 1] = {C..., 0};
+        };
+
+        template <unsigned N, char ... C>
+        constexpr char url_string<N, C...>::value[sizeof...(C) + 1];
+    }
+
+    namespace detail
+    {
+        namespace compiled_routing
+        {
+            enum segment_kind
+            {
+                END,
+                LITERAL,
+                INT,
+                UINT,
+                DOUBLE,
+                STRING,
+                PATH,
+                INVALID
+            };
+
+            constexpr int kind_of(black_magic::const_str s, unsigned i, unsigned n)
+            {
+                return
+                    i >= n ? END :
+                    s[i] != '<' ? LITERAL :
+                    black_magic::is_int(s, i) ? INT :
+                    black_magic::is_uint(s, i) ? UINT :
+                    black_magic::is_float(s, i) ? DOUBLE :
+                    black_magic::is_str(s, i) ? STRING :
+                    black_magic::is_path(s, i) ? PATH :
+                    INVALID;
+            }
+
+            constexpr unsigned literal_end(black_magic::const_str s, unsigned i, unsigned n)
+            {
+                return i >= n || s[i] == '<' ? i : literal_end(s, i + 1, n);
+            }
+
+            /// Where the first segment of a url starts (after the leading `/`).
+            constexpr unsigned segment_begin(black_magic::const_str s, unsigned n)
+            {
+                return n > 0 && s[0] == '/' ? 1 : 0;
+            }
+
+            /// Where the literal part of the segment starting at `i` ends, either at a `/`, a parameter or the end of the url.
+            constexpr unsigned segment_end(black_magic::const_str s, unsigned i, unsigned n)
+            {
+                return i >= n || s[i] == '/' || s[i] == '<' ? i : segment_end(s, i + 1, n);
+            }
+
+            /// Matches the part of the url starting at character `I`, storing parameters from the `K`th one on.
+
+            ///
+            /// Every segment kind of every route gets its own specialization, so the url is never read at runtime.<br>
+            /// `e` must point to a null character (the end of \ref crow::request::url), number parsing relies on it.
+            template <typename Url, unsigned I, unsigned K, int Kind = kind_of(Url::value, I, Url::size)>
+            struct matcher
+            {
+                static_assert(Kind != INVALID, "invalid parameter type");
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, END>
+            {
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params&)
+                {
+                    return p == e;
+                }
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, LITERAL>
+            {
+                static constexpr unsigned length = literal_end(Url::value, I, Url::size) - I;
+
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params& params)
+                {
+                    return static_cast<size_t>(e - p) >= length &&
+                        std::memcmp(p, Url::value + I, length) == 0 &&
+                        matcher<Url, I + length, K>::match(p + length, e, params);
+                }
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, INT>
+            {
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params& params)
+                {
+                    if (p == e || !((*p >= '0' && *p <= '9') || *p == '+' || *p == '-'))
+                        return false;
+                    char* eptr;
+                    errno = 0;
+                    long long int value = strtoll(p, &eptr, 10);
+                    if (errno == ERANGE || eptr == p)
+                        return false;
+                    std::get<K>(params) = value;
+                    return matcher<Url, black_magic::find_closing_tag(Url::value, I) + 1, K + 1>::match(eptr, e, params);
+                }
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, UINT>
+            {
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params& params)
+                {
+                    if (p == e || !((*p >= '0' && *p <= '9') || *p == '+'))
+                        return false;
+                    char* eptr;
+                    errno = 0;
+                    unsigned long long int value = strtoull(p, &eptr, 10);
+                    if (errno == ERANGE || eptr == p)
+                        return false;
+                    std::get<K>(params) = value;
+                    return matcher<Url, black_magic::find_closing_tag(Url::value, I) + 1, K + 1>::match(eptr, e, params);
+                }
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, DOUBLE>
+            {
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params& params)
+                {
+                    if (p == e || !((*p >= '0' && *p <= '9') || *p == '+' || *p == '-' || *p == '.'))
+                        return false;
+                    char* eptr;
+                    errno = 0;
+                    double value = strtod(p, &eptr);
+                    if (errno == ERANGE || eptr == p)
+                        return false;
+                    std::get<K>(params) = value;
+                    return matcher<Url, black_magic::find_closing_tag(Url::value, I) + 1, K + 1>::match(eptr, e, params);
+                }
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, STRING>
+            {
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params& params)
+                {
+                    const char* end = static_cast<const char*>(std::memchr(p, '/', e - p));
+                    if (!end)
+                        end = e;
+                    if (end == p)
+                        return false;
+                    std::get<K>(params) = detail::string_param{p, static_cast<size_t>(end - p)};
+                    return matcher<Url, black_magic::find_closing_tag(Url::value, I) + 1, K + 1>::match(end, e, params);
+                }
+            };
+
+            template <typename Url, unsigned I, unsigned K>
+            struct matcher<Url, I, K, PATH>
+            {
+                template <typename Params>
+                static bool match(const char* p, const char* e, Params& params)
+                {
+                    if (p == e)
+                        return false;
+                    std::get<K>(params) = detail::string_param{p, static_cast<size_t>(e - p)};
+                    return matcher<Url, black_magic::find_closing_tag(Url::value, I) + 1, K + 1>::match(e, e, params);
+                }
+            };
+
+            /// Which of the handler signatures accepted by \ref crow::TaggedRule a function has (-1 if none).
+            template <typename Func, typename Args>
+            struct handler_kind;
+
+            template <typename Func, typename ... Args>
+            struct handler_kind<Func, black_magic::S<Args...>>
+            {
+                static constexpr int value =
+                    black_magic::CallHelper<Func, black_magic::S<Args...>>::value ? 0 :
+                    black_magic::CallHelper<Func, black_magic::S<crow::request, Args...>>::value ? 1 :
+                    black_magic::CallHelper<Func, black_magic::S<crow::response&, Args...>>::value ? 2 :
+                    black_magic::CallHelper<Func, black_magic::S<crow::request, crow::response&, Args...>>::value ? 3 :
+                    -1;
+            };
+        }
+    }
+
+    template <typename Url, typename Func>
+    class compiled_rule;
+
+    /// A route of a \ref crow::CompiledRouter that doesn't have a handler yet, created by `CROW_COMPILED_ROUTE`.
+    template <typename Url>
+    class compiled_route
+    {
+    public:
+        compiled_route& methods(HTTPMethod method)
+        {
+            methods_ = 1 << static_cast<int>(method);
+            return *this;
+        }
+
+        template <typename ... MethodArgs>
+        compiled_route& methods(HTTPMethod method, MethodArgs ... args_method)
+        {
+            methods(args_method...);
+            methods_ |= 1 << static_cast<int>(method);
+            return *this;
+        }
+
+        template <typename Func>
+        compiled_rule<Url, typename std::decay<Func>::type> operator()(Func&& f) const
+        {
+            return compiled_rule<Url, typename std::decay<Func>::type>(std::forward<Func>(f), methods_);
+        }
+
+    private:
+        uint32_t methods_{1 << static_cast<int>(HTTPMethod::Get)};
+    };
+
+    /// A url and the handler it is bound to, the handler is stored and called as is.
+    template <typename Url, typename Func>
+    class compiled_rule
+    {
+        // string parameters are views of the request url, only copied if the handler takes a std::string (or takes them as auto)
+        static constexpr bool views = !detail::is_generic_handler<Func>::value;
+
+        template <typename ... T>
+        using param_tuple = std::tuple<typename detail::handler_param<T, views>::type...>;
+        template <typename ... T>
+        using param_set = black_magic::S<typename detail::handler_param<T, views>::type...>;
+
+        using url_args_t = typename black_magic::arguments<black_magic::get_parameter_tag(Url::value)>::type;
+        using args_t = typename url_args_t::template rebind<param_set>;
+        using params_t = typename url_args_t::template rebind<param_tuple>;
+        using seq_t = black_magic::GenSeq<std::tuple_size<params_t>::value>;
+        static constexpr int kind = detail::compiled_routing::handler_kind<Func, args_t>::value;
+
+        static_assert(kind >= 0, "Handler type is mismatched with URL parameters");
+
+    public:
+        compiled_rule(Func f, uint32_t methods)
+            : handler_(std::move(f)), methods_(methods)
+        {
+        }
+
+        uint32_t get_methods() const
+        {
+            return methods_;
+        }
+
+        /// Whether the url matches, leaving the parameters in `params`.
+        bool match(const std::string& url, params_t& params) const
+        {
+            return detail::compiled_routing::matcher<Url, 0, 0>::match(url.data(), url.data() + url.size(), params);
+        }
+
+        bool match(const std::string& url) const
+        {
+            params_t params;
+            return match(url, params);
+        }
+
+        /// Whether the first segment of the url has no parameters, so only urls starting with \ref first_segment can match.
+        static constexpr bool literal_first_segment =
+            detail::compiled_routing::segment_end(Url::value, detail::compiled_routing::segment_begin(Url::value, Url::size), Url::size) >= Url::size ||
+            Url::value[detail::compiled_routing::segment_end(Url::value, detail::compiled_routing::segment_begin(Url::value, Url::size), Url::size)] != '<';
+
+        static std::string first_segment()
+        {
+            unsigned begin = detail::compiled_routing::segment_begin(Url::value, Url::size);
+            return std::string(Url::value + begin, detail::compiled_routing::segment_end(Url::value, begin, Url::size) - begin);
+        }
+
+        /// Handle the request if both the url and the method match.
+
+        ///
+        /// When only the url matches, the methods of the rule are added to `methods` (for the 405).
+        bool try_handle(const request& req, response& res, HTTPMethod method, uint32_t& methods)
+        {
+            params_t params;
+            if (!match(req.url, params))
+                return false;
+            if (!(methods_ & (1 << static_cast<int>(method))))
+            {
+                methods |= methods_;
+                return false;
+            }
+            CROW_LOG_DEBUG << "Matched compiled rule '" << Url::value << "' " << static_cast<uint32_t>(req.method) << " / " << methods_;
+            call(std::integral_constant<int, kind>(), req, res, params, seq_t());
+            return true;
+        }
+
+    private:
+        template <unsigned ... I>
+        void call(std::integral_constant<int, 0>, const request&, response& res, params_t& params, black_magic::seq<I...>)
+        {
+            static_assert(!std::is_same<void, decltype(handler_(std::get<I>(params)...))>::value,
+                "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
+            res = response(handler_(std::get<I>(params)...));
+            res.end();
+        }
+
+        template <unsigned ... I>
+        void call(std::integral_constant<int, 1>, const request& req, response& res, params_t& params, black_magic::seq<I...>)
+        {
+            static_assert(!std::is_same<void, decltype(handler_(req, std::get<I>(params)...))>::value,
+                "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
+            res = response(handler_(req, std::get<I>(params)...));
+            res.end();
+        }
+
+        template <unsigned ... I>
+        void call(std::integral_constant<int, 2>, const request&, response& res, params_t& params, black_magic::seq<I...>)
+        {
+            static_assert(std::is_same<void, decltype(handler_(res, std::get<I>(params)...))>::value,
+                "Handler function with response argument should have void return type");
+            handler_(res, std::get<I>(params)...);
+        }
+
+        template <unsigned ... I>
+        void call(std::integral_constant<int, 3>, const request& req, response& res, params_t& params, black_magic::seq<I...>)
+        {
+            static_assert(std::is_same<void, decltype(handler_(req, res, std::get<I>(params)...))>::value,
+                "Handler function with response argument should have void return type");
+            handler_(req, res, std::get<I>(params)...);
+        }
+
+        Func handler_;
+        uint32_t methods_;
+    };
+
+    /// A fixed set of routes, matched by code generated at compile time.
+
+    ///
+    /// Made with \ref crow::compile_routes from `CROW_COMPILED_ROUTE(url)(handler)` rules.<br>
+    /// Handlers are called directly, without going through a trie, a virtual call or a `std::function`.<br>
+    /// Rules are grouped by the first segment of their url, a request only tries the rules of its own first segment and the rules with a parameter there.
+    /// The segment is looked up in a hash table made when the router is built, whose entries point to the function generated for each rule.<br>
+    /// Within those, rules are tried in the order they are given, the first one matching both the url and the method handles the request.
+    /// Requests no rule takes are left to the runtime router, with the methods of the rules matching their url.
+    template <typename ... Rules>
+    class CompiledRouter
+    {
+        using rule_tuple = std::tuple<Rules...>;
+        using handle_fn = bool (*)(CompiledRouter&, const request&, response&, HTTPMethod, uint32_t&);
+        using methods_fn = uint32_t (*)(CompiledRouter&, const std::string&);
+
+        struct segment
+        {
+            std::string name;
+            std::vector<unsigned> rules;
+        };
+
+    public:
+        CompiledRouter(Rules ... rules)
+            : rules_(std::move(rules)...)
+        {
+            index(black_magic::GenSeq<sizeof...(Rules)>());
+        }
+
+        /// Handle a request, returning false if no rule matches both its url and its method.
+
+        ///
+        /// `HEAD` requests are handled by `GET` rules. `OPTIONS` requests aren't handled, and neither are urls whose rules don't take the method:
+        /// the methods of the rules matching the url are left in `methods`, for whatever handles the request instead to list them or answer with a 405.
+        bool handle(const request& req, response& res, uint32_t& methods)
+        {
+            methods = 0;
+            HTTPMethod method_actual = req.method;
+            if (req.method >= HTTPMethod::InternalMethodCount)
+                return false;
+            else if (req.method == HTTPMethod::Head)
+                method_actual = HTTPMethod::Get;
+
+            const std::vector<unsigned>& candidates = candidates_for(req.url);
+            if (req.method == HTTPMethod::Options)
+            {
+                methods = matching_methods(req.url, candidates);
+                return false;
+            }
+
+            // any uncaught exceptions become 500s
+            try
+            {
+                if (req.method == HTTPMethod::Head)
+                    res.is_head_response = true;
+                for (unsigned rule : candidates)
+                {
+                    if (handlers_[rule](*this, req, res, method_actual, methods))
+                        return true;
+                }
+                if (req.method == HTTPMethod::Head)
+                    res.is_head_response = false;
+            }
+            catch(std::exception& e)
+            {
+                CROW_LOG_ERROR << "An uncaught exception occurred: " << e.what();
+                res = response(500);
+                res.end();
+                return true;
+            }
+            catch(...)
+            {
+                CROW_LOG_ERROR << "An uncaught exception occurred. The type was unknown so no information was available.";
+                res = response(500);
+                res.end();
+                return true;
+            }
+            return false;
+        }
+
+        bool handle(const request& req, response& res)
+        {
+            uint32_t methods;
+            return handle(req, res, methods);
+        }
+
+        /// The methods of the rules matching a url.
+        uint32_t methods_for(const std::string& url)
+        {
+            return matching_methods(url, candidates_for(url));
+        }
+
+    private:
+        template <unsigned ... I>
+        void index(black_magic::seq<I...>)
+        {
+            // the leading entries keep the arrays from being empty when there are no rules
+            handle_fn handlers[] = {nullptr, &CompiledRouter::try_handle<I>...};
+            methods_fn methods[] = {nullptr, &CompiledRouter::rule_methods<I>...};
+            bool literal[] = {false, std::tuple_element<I, rule_tuple>::type::literal_first_segment...};
+            std::string names[] = {std::string(), std::tuple_element<I, rule_tuple>::type::first_segment()...};
+
+            handlers_.assign(handlers + 1, handlers + 1 + sizeof...(Rules));
+            methods_.assign(methods + 1, methods + 1 + sizeof...(Rules));
+
+            size_t size = 1;
+            while (size < 2 * sizeof...(Rules))
+                size *= 2;
+            segments_.resize(size);
+
+            // rules with a parameter in their first segment are tried for every url, in order with the others
+            for (unsigned i = 1; i <= sizeof...(Rules); i++)
+            {
+                if (literal[i])
+                {
+                    segment& s = slot(names[i].data(), names[i].size());
+                    if (s.rules.empty())
+                    {
+                        s.name = names[i];
+                        s.rules = any_segment_;
+                    }
+                    s.rules.push_back(i - 1);
+                    continue;
+                }
+                any_segment_.push_back(i - 1);
+                for (auto& s : segments_)
+                {
+                    if (!s.rules.empty())
+                        s.rules.push_back(i - 1);
+                }
+            }
+        }
+
+        /// The slot of the hash table holding a first segment, or the empty slot it would go in.
+        segment& slot(const char* name, size_t length)
+        {
+            // FNV-1a
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < length; i++)
+                hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+
+            size_t mask = segments_.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask)
+            {
+                segment& s = segments_[i];
+                if (s.rules.empty() || (s.name.size() == length && std::memcmp(s.name.data(), name, length) == 0))
+                    return s;
+            }
+        }
+
+        /// The rules that can match a url, found from its first segment.
+        const std::vector<unsigned>& candidates_for(const std::string& url)
+        {
+            const char* begin = url.data();
+            const char* end = begin + url.size();
+            if (begin != end && *begin == '/')
+                begin++;
+            const char* slash = static_cast<const char*>(std::memchr(begin, '/', end - begin));
+            segment& s = slot(begin, (slash ? slash : end) - begin);
+            return s.rules.empty() ? any_segment_ : s.rules;
+        }
+
+        uint32_t matching_methods(const std::string& url, const std::vector<unsigned>& candidates)
+        {
+            uint32_t methods = 0;
+            for (unsigned rule : candidates)
+                methods |= methods_[rule](*this, url);
+            return methods;
+        }
+
+        template <unsigned N>
+        static bool try_handle(CompiledRouter& self, const request& req, response& res, HTTPMethod method, uint32_t& methods)
+        {
+            return std::get<N>(self.rules_).try_handle(req, res, method, methods);
+        }
+
+        template <unsigned N>
+        static uint32_t rule_methods(CompiledRouter& self, const std::string& url)
+        {
+            return std::get<N>(self.rules_).match(url) ? std::get<N>(self.rules_).get_methods() : 0;
+        }
+
+        rule_tuple rules_;
+        std::vector<handle_fn> handlers_;
+        std::vector<methods_fn> methods_;
+        std::vector<segment> segments_; ///< An open addressing hash table of the literal first segments, at least half empty.
+        std::vector<unsigned> any_segment_;
+    };
+
+    /// Make a \ref crow::CompiledRouter out of `CROW_COMPILED_ROUTE(url)(handler)` rules.
+    template <typename ... Rules>
+    CompiledRouter<Rules...> compile_routes(Rules ... rules)
+    {
+        return CompiledRouter<Rules...>(std::move(rules)...);
+    }
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifdef CROW_ENABLE_COMPRESSION
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <zlib.h>
 
@@ -93,6 +94,123 @@ namespace crow
 
             return inflated_string;
         }
+
+        /// Compresses the messages of one WebSocket connection for permessage-deflate (RFC 7692), keeping its stream between messages.
+        class message_deflater
+        {
+        public:
+            /// Start a raw deflate stream with a window of 2^`window_bits` bytes (9 to 15).
+
+            ///
+            /// Without context takeover every message is compressed on its own, so the same output can be sent on any connection.
+            message_deflater(int window_bits, bool context_takeover):
+              context_takeover_(context_takeover)
+            {
+                ok_ = ::deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            }
+
+            ~message_deflater()
+            {
+                if (ok_)
+                    ::deflateEnd(&stream_);
+            }
+
+            message_deflater(const message_deflater&) = delete;
+            message_deflater& operator=(const message_deflater&) = delete;
+
+            /// Compress a whole message, appending it to `out`. Returns false if zlib fails.
+            bool compress(const char* data, size_t size, std::string& out)
+            {
+                if (!ok_)
+                    return false;
+                size_t start = out.size();
+                stream_.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+                stream_.avail_in = static_cast<uInt>(size);
+                do
+                {
+                    size_t at = out.size();
+                    out.resize(at + std::max<size_t>(size / 2, 256));
+                    stream_.next_out = reinterpret_cast<Bytef*>(&out[at]);
+                    stream_.avail_out = static_cast<uInt>(out.size() - at);
+                    if (::deflate(&stream_, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+                        return false;
+                    out.resize(out.size() - stream_.avail_out);
+                } while (stream_.avail_out == 0 || stream_.avail_in != 0);
+                // the empty stored block a sync flush ends with is implied (RFC 7692 7.2.1)
+                if (out.size() - start >= 4)
+                    out.resize(out.size() - 4);
+                if (!context_takeover_)
+                    ::deflateReset(&stream_);
+                return true;
+            }
+
+        private:
+            z_stream stream_{};
+            bool context_takeover_;
+            bool ok_;
+        };
+
+        /// Decompresses the permessage-deflate messages of one WebSocket connection, keeping its stream between messages.
+        class message_inflater
+        {
+        public:
+            message_inflater()
+            {
+                // a 15 bit window reads what any smaller window wrote
+                ok_ = ::inflateInit2(&stream_, -15) == Z_OK;
+            }
+
+            ~message_inflater()
+            {
+                if (ok_)
+                    ::inflateEnd(&stream_);
+            }
+
+            message_inflater(const message_inflater&) = delete;
+            message_inflater& operator=(const message_inflater&) = delete;
+
+            /// Decompress a whole message into `out`. Returns false if the data is invalid or would decompress to more than `limit` bytes.
+            bool decompress(const std::string& in, std::string& out, size_t limit = std::string::npos)
+            {
+                out.clear();
+                if (!ok_)
+                    return false;
+                static const unsigned char tail[4] = {0x00, 0x00, 0xff, 0xff};
+                for (int part = 0; part < 2; part++)
+                {
+                    stream_.next_in = part ? const_cast<Bytef*>(tail) : const_cast<Bytef*>(reinterpret_cast<const Bytef*>(in.data()));
+                    stream_.avail_in = part ? 4 : static_cast<uInt>(in.size());
+                    do
+                    {
+                        size_t at = out.size();
+                        out.resize(at + std::max<size_t>(in.size() * 2, 1024));
+                        stream_.next_out = reinterpret_cast<Bytef*>(&out[at]);
+                        stream_.avail_out = static_cast<uInt>(out.size() - at);
+                        int code = ::inflate(&stream_, Z_SYNC_FLUSH);
+                        out.resize(out.size() - stream_.avail_out);
+                        // a message may end with a final block, the next one starts a new stream then
+                        if (code == Z_STREAM_END)
+                            code = ::inflateReset(&stream_);
+                        if ((code != Z_OK && code != Z_BUF_ERROR) || out.size() > limit)
+                        {
+                            ::inflateReset(&stream_);
+                            return false;
+                        }
+                    } while (stream_.avail_out == 0 || stream_.avail_in != 0);
+                }
+                return true;
+            }
+
+            /// Forget the previous messages, for peers that don't use context takeover.
+            void reset()
+            {
+                ::inflateReset(&stream_);
+            }
+
+        private:
+            z_stream stream_{};
+            bool ok_;
+        };
     }
 }
 
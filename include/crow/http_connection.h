@@ -3,6 +3,7 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/array.hpp>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <vector>
@@ -243,6 +244,24 @@ namespace crow
 
         void handle_header()
         {
+            parser_.route = handler_->resolve(static_cast<HTTPMethod>(parser_.method), parser_.url);
+
+            // a refused request is answered before its body is read, the unread body makes the connection unusable
+            // (only without middlewares, one could rewrite the url or the method to a route that exists)
+            if (sizeof...(Middlewares) == 0 && parser_.route.reject_code && parser_.has_body() && !parser_.is_upgrade())
+            {
+                CROW_LOG_DEBUG << this << " refusing " << parser_.url << " before its body: " << parser_.route.reject_code;
+                close_connection_ = true;
+                handle();
+                parser_.stop();
+                return;
+            }
+
+            json::encoding body_encoding;
+            if (handler_->parses_json_bodies() && parser_.has_body() &&
+                json::encoding_of(get_header_value(parser_.headers, "content-type"), body_encoding))
+                parser_.parse_json_body(body_encoding);
+
             // HTTP 1.1 Expect: 100-continue
             if (parser_.check_version(1, 1) && parser_.headers.count("expect") && get_header_value(parser_.headers, "expect") == "100-continue")
             {
@@ -264,6 +283,7 @@ namespace crow
 
             req.remoteIpAddress = adaptor_.remote_endpoint().address().to_string();
 
+            http_1_1_ = parser_.check_version(1, 1);
             if (parser_.check_version(1, 0))
             {
                 // HTTP/1.0
@@ -316,17 +336,33 @@ namespace crow
                 res.complete_request_handler_ = []{};
                 res.is_alive_helper_ = [this]()->bool{ return adaptor_.is_open(); };
 
+                // JSON values returned while the request is handled on this thread are written straight in the encoding it prefers
+                struct encoding_scope
+                {
+                    ~encoding_scope()
+                    {
+                        detail::response_encoding() = json::encoding::Json;
+                    }
+                } encoding_scope;
+                const std::string& accept = req.get_header_value("Accept");
+                if (accept.find("msgpack") != std::string::npos || accept.find("cbor") != std::string::npos)
+                    detail::response_encoding() = json::negotiate(accept);
+
                 ctx_ = detail::context<Middlewares...>();
                 req.middleware_context = static_cast<void*>(&ctx_);
                 req.io_service = &adaptor_.get_io_service();
                 detail::middleware_call_helper<0, decltype(ctx_), decltype(*middlewares_), Middlewares...>(*middlewares_, req, res, ctx_);
 
+                // the route was found from the headers, a middleware may have rewritten the url or the method since
+                if (req.url != parser_.url || req.method != static_cast<HTTPMethod>(parser_.method))
+                    parser_.route = routing_handle_result();
+
                 if (!res.completed_)
                 {
                     res.complete_request_handler_ = [this]{ this->complete_request(); };
                     need_to_call_after_handlers_ = true;
-                    handler_->handle(req, res);
-                    if (add_keep_alive_)
+                    handler_->handle(req, res, parser_.route);
+                    if (add_keep_alive_ && !close_connection_)
                         res.set_header("connection", "Keep-Alive");
                 }
                 else
@@ -356,9 +392,10 @@ namespace crow
                     decltype(*middlewares_)>
                 (*middlewares_, ctx_, req_, res);
             }
+            res.vary_on_accept();
 #ifdef CROW_ENABLE_COMPRESSION
             std::string accept_encoding = req_.get_header_value("Accept-Encoding");
-            if (!accept_encoding.empty() && res.compressed)
+            if (!accept_encoding.empty() && res.compressed && !res.is_produced_type())
             {
                 switch (handler_->compression_algorithm())
                 {
@@ -398,7 +435,12 @@ namespace crow
             if (res.is_static_type())
             {
                 do_write_static();
-            }else {
+            }
+            else if (res.is_produced_type())
+            {
+                do_write_produced();
+            }
+            else {
                 do_write_general();
             }
 
@@ -460,9 +502,17 @@ namespace crow
                 buffers_.emplace_back(status.data(), status.size());
             }
 
-            if (res.code >= 400 && res.body.empty())
+            if (res.code >= 400 && res.body.empty() && !res.is_produced_type())
                 res.body = statusCodes[res.code].substr(9);
 
+            // without chunks (HTTP/1.0), the end of a produced body is where the connection closes
+            chunked_response_ = res.is_produced_type() && http_1_1_;
+            if (res.is_produced_type() && !http_1_1_)
+            {
+                close_connection_ = true;
+                add_keep_alive_ = false;
+            }
+
             for(auto& kv : res.headers)
             {
                 buffers_.emplace_back(kv.first.data(), kv.first.size());
@@ -472,7 +522,13 @@ namespace crow
 
             }
 
-            if (!res.manual_length_header && !res.headers.count("content-length"))
+            if (chunked_response_)
+            {
+                static std::string transfer_encoding_tag = "Transfer-Encoding: chunked";
+                buffers_.emplace_back(transfer_encoding_tag.data(), transfer_encoding_tag.size());
+                buffers_.emplace_back(crlf.data(), crlf.size());
+            }
+            else if (!res.manual_length_header && !res.headers.count("content-length") && !res.is_produced_type())
             {
                 content_length_ = std::to_string(res.body.size());
                 static std::string content_length_tag = "Content-Length: ";
@@ -517,6 +573,83 @@ namespace crow
             buffers_.clear();
         }
 
+        /// Send the headers, then the body as the response's producer writes it.
+        void do_write_produced()
+        {
+            is_writing = true;
+            boost::system::error_code ec;
+            boost::asio::write(adaptor_.socket(), buffers_, ec);
+
+            auto sink = [this, &ec](const char* data, size_t size)
+            {
+                if (ec || size == 0)
+                    return;
+                if (chunked_response_)
+                {
+                    static const char hex[] = "0123456789abcdef";
+                    char chunk_size[2 * sizeof(size_t) + 2];
+                    char* begin = chunk_size + sizeof(chunk_size) - 2;
+                    begin[0] = '\r';
+                    begin[1] = '\n';
+                    for (size_t n = size; n; n >>= 4)
+                        *--begin = hex[n & 0xf];
+                    std::array<boost::asio::const_buffer, 3> chunk{{
+                        boost::asio::buffer(begin, chunk_size + sizeof(chunk_size) - begin),
+                        boost::asio::buffer(data, size),
+                        boost::asio::buffer("\r\n", 2)}};
+                    boost::asio::write(adaptor_.socket(), chunk, ec);
+                }
+                else
+                    boost::asio::write(adaptor_.socket(), boost::asio::buffer(data, size), ec);
+                if (ec)
+                    CROW_LOG_ERROR << ec << " - happened while sending a produced body";
+            };
+
+            bool complete = !ec;
+            if (complete)
+            {
+                try
+                {
+                    res.body_producer_(sink);
+                }
+                catch (std::exception& e)
+                {
+                    // the headers are gone already, all that's left is to cut the response short
+                    CROW_LOG_ERROR << "An uncaught exception occurred while producing a body: " << e.what();
+                    complete = false;
+                }
+                catch (...)
+                {
+                    CROW_LOG_ERROR << "An uncaught exception occurred while producing a body. The type was unknown so no information was available.";
+                    complete = false;
+                }
+            }
+            // a chunked body is ended even when it was cut short, the connection is closed after it anyway
+            if (!ec && chunked_response_)
+                boost::asio::write(adaptor_.socket(), boost::asio::buffer("0\r\n\r\n", 5), ec);
+            complete = complete && !ec;
+
+            res.end();
+            res.clear();
+            buffers_.clear();
+            is_writing = false;
+
+            if (!complete || ec || close_connection_)
+            {
+                close_connection_ = true;
+                adaptor_.shutdown_write();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from write(3)";
+                check_destroy();
+            }
+            else if (need_to_start_read_after_complete_)
+            {
+                need_to_start_read_after_complete_ = false;
+                start_deadline();
+                do_read();
+            }
+        }
+
         void do_write_general()
         {
             if (res.body.length() < res_stream_threshold_)
@@ -666,6 +799,8 @@ namespace crow
         response res;
 
         bool close_connection_ = false;
+        bool http_1_1_ = false;
+        bool chunked_response_ = false;
 
         const std::string& server_name_;
         std::vector<boost::asio::const_buffer> buffers_;
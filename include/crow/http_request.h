@@ -5,6 +5,7 @@
 #include "crow/common.h"
 #include "crow/ci_map.h"
 #include "crow/query_string.h"
+#include "crow/json.h"
 
 namespace crow
 {
@@ -31,6 +32,7 @@ namespace crow
         query_string url_params; ///< The parameters associated with the request. (everything after the `?`)
         ci_map headers;
         std::string body;
+        mutable json::rvalue json_body; ///< The body parsed while it was received, if the app parses JSON bodies (\ref body is empty then), or by \ref json().
         std::string remoteIpAddress; ///< The IP address from which the request was sent.
 
         void* middleware_context{};
@@ -58,6 +60,27 @@ namespace crow
             return crow::get_header_value(headers, key);
         }
 
+        /// The body as a JSON value, parsed on the first call and shared by every later caller (middleware and handler alike).
+
+        ///
+        /// A MessagePack or CBOR body (going by the `Content-Type`) is decoded instead. The value is kept in \ref json_body for as long as the request lives,
+        /// and when the app already parsed the body while it was received that value is returned as it is.<br>
+        /// The parse works on one copy of the body so \ref body stays readable. An invalid body gives an error value (`!req.json()`).
+        const json::rvalue& json() const
+        {
+            if (!json_parsed_)
+            {
+                json_parsed_ = true;
+                if (!json_body && !body.empty())
+                {
+                    json::encoding e = json::encoding::Json;
+                    json::encoding_of(get_header_value("Content-Type"), e);
+                    json_body = json::load(body, e);
+                }
+            }
+            return json_body;
+        }
+
         /// Send the request with a completion handler and return immediately.
         template<typename CompletionHandler>
         void post(CompletionHandler handler)
@@ -72,5 +95,7 @@ namespace crow
             io_service->dispatch(handler);
         }
 
+    private:
+        mutable bool json_parsed_{};
     };
 }
@@ -12,6 +12,7 @@
 #include "crow/logging.h"
 #include "crow/mime_types.h"
 #include "crow/returnable.h"
+#include "crow/json_struct.h"
 
 
 namespace crow
@@ -19,6 +20,19 @@ namespace crow
     template <typename Adaptor, typename Handler, typename ... Middlewares>
     class Connection;
 
+    namespace detail
+    {
+        /// The encoding JSON values are written in by the responses made on this thread, the one the request being handled prefers.
+
+        ///
+        /// Set by the connection while it calls the middlewares and the handler, JSON otherwise.
+        inline json::encoding& response_encoding()
+        {
+            static thread_local json::encoding e = json::encoding::Json;
+            return e;
+        }
+    }
+
     /// HTTP response
     struct response
     {
@@ -73,6 +87,26 @@ namespace crow
             body = value.dump();
             set_header("Content-Type",value.content_type);
         }
+        /// A JSON value, written as MessagePack or CBOR instead if the request being handled prefers it (see \ref detail::response_encoding()).
+        response (json::wvalue&& value) : response(200, std::move(value))
+        {}
+        response (int code, json::wvalue&& value) : code(code)
+        {
+            json::encoding e = detail::response_encoding();
+            body = value.dump(e);
+            set_header("Content-Type", e == json::encoding::Json ? value.content_type : json::content_type(e));
+            from_json_value_ = true;
+        }
+        /// A type declared with \ref CROW_JSON_STRUCT, written to the body as JSON.
+        template <typename T, typename std::enable_if<json::is_reflected<T>::value, int>::type = 0>
+        response (const T& value) : response(200, value)
+        {}
+        template <typename T, typename std::enable_if<json::is_reflected<T>::value, int>::type = 0>
+        response (int code, const T& value) : code(code)
+        {
+            body = json::serialize(value);
+            set_header("Content-Type","application/json");
+        }
 
         response(response&& r)
         {
@@ -88,6 +122,8 @@ namespace crow
             headers = std::move(r.headers);
             completed_ = r.completed_;
             file_info = std::move(r.file_info);
+            body_producer_ = std::move(r.body_producer_);
+            from_json_value_ = r.from_json_value_;
             return *this;
         }
 
@@ -104,6 +140,17 @@ namespace crow
             headers.clear();
             completed_ = false;
             file_info = static_file_info{};
+            body_producer_ = nullptr;
+            from_json_value_ = false;
+        }
+
+        /// Note that a response written from a JSON value depends on the `Accept` header, before it's sent.
+        void vary_on_accept()
+        {
+            if (!from_json_value_)
+                return;
+            from_json_value_ = false;
+            add_header("Vary", "Accept");
         }
 
         /// Return a "Temporary Redirect" response.
@@ -155,7 +202,11 @@ namespace crow
                 completed_ = true;
                 if (is_head_response)
                 {
-                    set_header("Content-Length", std::to_string(body.size()));
+                    from_json_value_ = false;
+                    if (body_producer_)
+                        body_producer_ = nullptr;
+                    else
+                        set_header("Content-Length", std::to_string(body.size()));
                     body = "";
                     manual_length_header = true;
                 }
@@ -179,6 +230,29 @@ namespace crow
             return is_alive_helper_ && is_alive_helper_();
         }
 
+        /// Receives the parts of a produced body, see \ref set_body_producer().
+        using body_sink = std::function<void(const char* data, size_t size)>;
+
+        /// Send a body that's produced while it's being sent, instead of \ref body.
+
+        ///
+        /// `producer` is called once the response is ended, after the headers are sent, with a sink that writes every part it's given to the client right away
+        /// (as a chunk of a chunked response, or until the connection is closed for HTTP/1.0 clients). A \ref json::writer can write to the sink directly.<br>
+        /// The body isn't compressed and no Content-Length header is added.
+        void set_body_producer(std::function<void(const body_sink&)> producer)
+        {
+            body_producer_ = std::move(producer);
+#ifdef CROW_ENABLE_COMPRESSION
+            compressed = false;
+#endif
+        }
+
+        /// Check whether the body is sent by a producer.
+        bool is_produced_type() const
+        {
+            return static_cast<bool>(body_producer_);
+        }
+
         /// Check whether the response has a static file defined.
         bool is_static_type()
         {
@@ -251,6 +325,8 @@ namespace crow
             std::function<void()> complete_request_handler_;
             std::function<bool()> is_alive_helper_;
             static_file_info file_info;
+            std::function<void(const body_sink&)> body_producer_;
+            bool from_json_value_{}; ///< Whether the body was written from a JSON value, the response varies with `Accept` then.
 
             template<typename Stream, typename Adaptor>
             void write_streamed(Stream& is, Adaptor& adaptor)
@@ -17,6 +17,7 @@
 #include "crow/http_connection.h"
 #include "crow/logging.h"
 #include "crow/dumb_timer_queue.h"
+#include "crow/websocket.h"
 
 namespace crow
 {
@@ -36,6 +37,7 @@ namespace crow
             server_name_(server_name),
             port_(port),
             bindaddr_(bindaddr),
+            rebalance_timer_(io_service_),
             middlewares_(middlewares),
             adaptor_ctx_(adaptor_ctx)
         {
@@ -59,10 +61,36 @@ namespace crow
                     });
         }
 
+        /// Compare the websocket traffic of the workers every `d`, moving connections off the busiest one if it's more than `threshold` times the quietest one's.
+        void set_websocket_rebalance(std::chrono::milliseconds d, double threshold)
+        {
+            rebalance_interval_ = d;
+            rebalance_threshold_ = threshold;
+        }
+
+        void on_rebalance()
+        {
+            balancer_->round();
+            rebalance_timer_.expires_from_now(boost::posix_time::milliseconds(rebalance_interval_.count()));
+            rebalance_timer_.async_wait([this](const boost::system::error_code& ec)
+                    {
+                        if (ec)
+                            return;
+                        on_rebalance();
+                    });
+        }
+
         void run()
         {
             for(int i = 0; i < concurrency_;  i++)
                 io_service_pool_.emplace_back(new boost::asio::io_service());
+            std::vector<websocket::detail::worker_load*> worker_loads(concurrency_, nullptr);
+            if (rebalance_interval_.count() > 0)
+            {
+                balancer_.reset(new websocket::detail::balancer(rebalance_threshold_));
+                for(int i = 0; i < concurrency_;  i++)
+                    worker_loads[i] = &balancer_->add(*io_service_pool_[i]);
+            }
             get_cached_date_str_pool_.resize(concurrency_);
             timer_queue_pool_.resize(concurrency_);
 
@@ -70,7 +98,7 @@ namespace crow
             std::atomic<int> init_count(0);
             for(uint16_t i = 0; i < concurrency_; i ++)
                 v.push_back(
-                        std::async(std::launch::async, [this, i, &init_count]{
+                        std::async(std::launch::async, [this, i, &init_count, &worker_loads]{
 
                             // thread local date string get function
                             auto last = std::chrono::steady_clock::now();
@@ -119,6 +147,9 @@ namespace crow
                             };
                             timer.async_wait(handler);
 
+                            // the websocket connections of this worker count their messages there
+                            websocket::detail::worker_load::current() = worker_loads[i];
+
                             init_count ++;
                             while(1)
                             {
@@ -147,6 +178,17 @@ namespace crow
                         });
             }
 
+            if (balancer_)
+            {
+                rebalance_timer_.expires_from_now(boost::posix_time::milliseconds(rebalance_interval_.count()));
+                rebalance_timer_.async_wait([this](const boost::system::error_code& ec)
+                        {
+                            if (ec)
+                                return;
+                            on_rebalance();
+                        });
+            }
+
             CROW_LOG_INFO << server_name_ << " server is running at " << bindaddr_ <<":" << acceptor_.local_endpoint().port()
                           << " using " << concurrency_ << " threads";
             CROW_LOG_INFO << "Call `app.loglevel(crow::LogLevel::Warning)` to hide Info level logs.";
@@ -238,6 +280,11 @@ namespace crow
         std::chrono::milliseconds tick_interval_;
         std::function<void()> tick_function_;
 
+        boost::asio::deadline_timer rebalance_timer_;
+        std::chrono::milliseconds rebalance_interval_{0};
+        double rebalance_threshold_{2};
+        std::unique_ptr<websocket::detail::balancer> balancer_;
+
         std::tuple<Middlewares...>* middlewares_;
 
 #ifdef CROW_ENABLE_SSL
@@ -11,14 +11,44 @@
 #endif
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 #include <memory>
+#include <functional>
+#include <type_traits>
+#include <limits>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/operators.hpp>
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
 
 #include "crow/settings.h"
 #include "crow/returnable.h"
+#include "crow/json_number.h"
+
+#if !defined(CROW_JSON_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define CROW_JSON_AVX2
+#elif !defined(CROW_JSON_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define CROW_JSON_SSE2
+#endif
+#if !defined(CROW_JSON_NO_SIMD) && defined(__PCLMUL__)
+#include <wmmintrin.h>
+#define CROW_JSON_PCLMUL
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/// Objects with at least this many members are searched through a hash index instead of one by one.
+#ifndef CROW_JSON_KEY_INDEX_THRESHOLD
+#define CROW_JSON_KEY_INDEX_THRESHOLD 16
+#endif
 
 #if defined(__GNUG__) || defined(__clang__)
 #define crow_json_likely(x) __builtin_expect(x, 1)
@@ -38,11 +68,117 @@ namespace crow
 
     namespace json
     {
-        inline void escape(const std::string& str, std::string& ret)
+        namespace detail
+        {
+            inline int trailing_zeros(uint32_t x)
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                return __builtin_ctz(x);
+#elif defined(_MSC_VER)
+                unsigned long i;
+                _BitScanForward(&i, x);
+                return static_cast<int>(i);
+#else
+                int i = 0;
+                while (!(x & 1))
+                {
+                    x >>= 1;
+                    i++;
+                }
+                return i;
+#endif
+            }
+
+            /// The offset of the first byte in `p[0..n)` that has to be escaped in a JSON string (a quote, a backslash or a control character), or `n`.
+            inline size_t find_json_escape(const char* p, size_t n)
+            {
+                size_t i = 0;
+#if defined(CROW_JSON_AVX2)
+                for (; i + 32 <= n; i += 32)
+                {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+                    // v <= 0x1f as unsigned bytes
+                    __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+                    __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+                    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(control, special)));
+                    if (mask)
+                        return i + trailing_zeros(mask);
+                }
+#endif
+#if defined(CROW_JSON_AVX2) || defined(CROW_JSON_SSE2)
+                for (; i + 16 <= n; i += 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                    __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+                    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+                    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(control, special)));
+                    if (mask)
+                        return i + trailing_zeros(mask);
+                }
+#endif
+                for (; i < n; i++)
+                {
+                    unsigned char c = p[i];
+                    if (c < 0x20 || c == '"' || c == '\\')
+                        break;
+                }
+                return i;
+            }
+
+            /// The offset of the first byte in `p[0..n)` that has to be escaped in HTML (`& < > " ' /`), or `n`.
+            inline size_t find_html_escape(const char* p, size_t n)
+            {
+                size_t i = 0;
+#if defined(CROW_JSON_AVX2)
+                for (; i + 32 <= n; i += 32)
+                {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+                    auto eq = [&v](char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); };
+                    __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(eq('&'), eq('<')), _mm256_or_si256(eq('>'), eq('"'))), _mm256_or_si256(eq('\''), eq('/')));
+                    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+                    if (mask)
+                        return i + trailing_zeros(mask);
+                }
+#endif
+#if defined(CROW_JSON_AVX2) || defined(CROW_JSON_SSE2)
+                for (; i + 16 <= n; i += 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                    auto eq = [&v](char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); };
+                    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_or_si128(eq('&'), eq('<')), _mm_or_si128(eq('>'), eq('"'))), _mm_or_si128(eq('\''), eq('/')));
+                    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+                    if (mask)
+                        return i + trailing_zeros(mask);
+                }
+#endif
+                for (; i < n; i++)
+                {
+                    switch (p[i])
+                    {
+                        case '&': case '<': case '>': case '"': case '\'': case '/':
+                            return i;
+                    }
+                }
+                return i;
+            }
+        }
+
+        /// Append the JSON string escaped form of `n` bytes at `str` to `ret` (without the surrounding quotes).
+
+        ///
+        /// Runs of bytes that need no escaping are found a vector at a time and appended in one go.
+        inline void escape(const char* str, size_t n, std::string& ret)
         {
-            ret.reserve(ret.size() + str.size()+str.size()/4);
-            for(unsigned char c:str)
+            ret.reserve(ret.size() + n + n/4);
+            const char* end = str + n;
+            for (;;)
             {
+                size_t clean = detail::find_json_escape(str, end - str);
+                ret.append(str, clean);
+                str += clean;
+                if (str == end)
+                    break;
+                unsigned char c = *str++;
                 switch(c)
                 {
                     case '"': ret += "\\\""; break;
@@ -53,25 +189,19 @@ namespace crow
                     case '\r': ret += "\\r"; break;
                     case '\t': ret += "\\t"; break;
                     default:
-                        if (c < 0x20)
                         {
-                            ret += "\\u00";
-                            auto to_hex = [](char c)
-                            {
-                                c = c&0xf;
-                                if (c < 10)
-                                    return '0' + c;
-                                return 'a'+c-10;
-                            };
-                            ret += to_hex(c/16);
-                            ret += to_hex(c%16);
+                            static const char hex[] = "0123456789abcdef";
+                            const char unicode[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                            ret.append(unicode, 6);
                         }
-                        else
-                            ret += c;
                         break;
                 }
             }
         }
+        inline void escape(const std::string& str, std::string& ret)
+        {
+            escape(str.data(), str.size(), ret);
+        }
         inline std::string escape(const std::string& str)
         {
             std::string ret;
@@ -109,11 +239,22 @@ namespace crow
             Null
         };
 
+        /// The formats values can be written in and read from.
+        enum class encoding : char
+        {
+            Json,
+            MessagePack,
+            Cbor
+        };
+
         class rvalue;
+        class incremental_parser;
         rvalue load(const char* data, size_t size);
 
         namespace detail 
         {
+            class binary_reader;
+
             /// A read string implementation with comparison functionality.
             struct r_string 
                 : boost::less_than_comparable<r_string>,
@@ -172,8 +313,8 @@ namespace crow
                 using iterator = const char*;
                 using const_iterator = const char*;
 
-                char* s_; ///< Start.
-                mutable char* e_; ///< End.
+                char* s_{nullptr}; ///< Start.
+                mutable char* e_{nullptr}; ///< End.
                 uint8_t owned_{0};
                 friend std::ostream& operator << (std::ostream& os, const r_string& s)
                 {
@@ -188,6 +329,8 @@ namespace crow
                     owned_ = 1;
                 }
                 friend rvalue crow::json::load(const char* data, size_t size);
+                friend class crow::json::incremental_parser;
+                friend class binary_reader;
             };
 
             inline bool operator < (const r_string& l, const r_string& r)
@@ -218,22 +361,116 @@ namespace crow
 
         /// JSON read value.
 
+        namespace detail
+        {
+            /// Decode the escape sequences of the (valid) string text between `head` and `end` to `tail`, returning the end of what was written.
+
+            ///
+            /// The output is never longer than the input, so `tail` can be `head` to decode in place.
+            /// The text between escapes is copied a run at a time.
+            inline char* unescape(const char* head, const char* end, char* tail)
+            {
+                while(head != end)
+                {
+                    const char* escape = static_cast<const char*>(std::memchr(head, '\\', end - head));
+                    if (!escape)
+                        escape = end;
+                    if (tail != head)
+                        std::memmove(tail, head, escape - head);
+                    tail += escape - head;
+                    head = escape;
+                    if (head == end)
+                        break;
+                    switch(*++head)
+                    {
+                        case '"':  *tail++ = '"'; break;
+                        case '\\': *tail++ = '\\'; break;
+                        case '/':  *tail++ = '/'; break;
+                        case 'b':  *tail++ = '\b'; break;
+                        case 'f':  *tail++ = '\f'; break;
+                        case 'n':  *tail++ = '\n'; break;
+                        case 'r':  *tail++ = '\r'; break;
+                        case 't':  *tail++ = '\t'; break;
+                        case 'u':
+                            {
+                                auto from_hex = [](char c)
+                                {
+                                    if (c >= 'a')
+                                        return c - 'a' + 10;
+                                    if (c >= 'A')
+                                        return c - 'A' + 10;
+                                    return c - '0';
+                                };
+                                unsigned int code = 
+                                    (from_hex(head[1])<<12) + 
+                                    (from_hex(head[2])<< 8) + 
+                                    (from_hex(head[3])<< 4) + 
+                                    from_hex(head[4]);
+                                if (code >= 0x800)
+                                {
+                                    *tail++ = 0xE0 | (code >> 12);
+                                    *tail++ = 0x80 | ((code >> 6) & 0x3F);
+                                    *tail++ = 0x80 | (code & 0x3F);
+                                }
+                                else if (code >= 0x80)
+                                {
+                                    *tail++ = 0xC0 | (code >> 6);
+                                    *tail++ = 0x80 | (code & 0x3F);
+                                }
+                                else
+                                {
+                                    *tail++ = code;
+                                }
+                                head += 4;
+                            }
+                            break;
+                    }
+                    head++;
+                }
+                return tail;
+            }
+
+            /// Hash an object key, with a seed chosen at startup so the colliding keys can't be known in advance.
+            inline uint32_t hash_key(const char* s, size_t n)
+            {
+                static const uint64_t seed = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^ reinterpret_cast<uintptr_t>(&seed);
+                const uint64_t m = 0xff51afd7ed558ccdull;
+                uint64_t h = seed ^ (n * 0x9E3779B97F4A7C15ull);
+                for (; n >= 8; s += 8, n -= 8)
+                {
+                    uint64_t w;
+                    std::memcpy(&w, s, 8);
+                    h = (h ^ w) * m;
+                    h ^= h >> 32;
+                }
+                uint64_t w = 0;
+                std::memcpy(&w, s, n);
+                h = (h ^ w) * m;
+                h ^= h >> 29;
+                h *= 0xc4ceb9fe1a85ec53ull;
+                h ^= h >> 32;
+                return static_cast<uint32_t>(h);
+            }
+        }
+
         ///
         /// Value can mean any json value, including a JSON object.
         /// Read means this class is used to primarily read strings into a JSON value.
         class rvalue
         {
-            static const int cached_bit = 2;
             static const int error_bit = 4;
         public:
-            rvalue() noexcept : option_{error_bit} 
+            rvalue() noexcept
+                : start_{}, end_{}, lsize_{}, lremain_{}, t_{type::Null}, option_{error_bit}
             {}
             rvalue(type t) noexcept
-                : lsize_{}, lremain_{}, t_{t}
+                : start_{}, end_{}, lsize_{}, lremain_{}, t_{t}
             {}
             rvalue(type t, char* s, char* e)  noexcept
                 : start_{s},
                 end_{e},
+                lsize_{},
+                lremain_{},
                 t_{t}
             {
                 determine_num_type();
@@ -272,6 +509,7 @@ namespace crow
                 end_ = r.end_;
                 key_ = std::move(r.key_);
                 l_ = std::move(r.l_);
+                index_ = std::move(r.index_);
                 lsize_ = r.lsize_;
                 lremain_ = r.lremain_;
                 t_ = r.t_;
@@ -353,14 +591,14 @@ namespace crow
                 switch (t()) {
                     case type::Number:
                     case type::String:
-                        return boost::lexical_cast<int64_t>(start_, end_-start_);
+                        return parse_integer<int64_t>();
                     default:
                         const std::string msg = "expected number, got: "
                             + std::string(get_type_str(t()));
                         throw std::runtime_error(msg);
                 }
 #endif
-                return boost::lexical_cast<int64_t>(start_, end_-start_);
+                return parse_integer<int64_t>();
             }
 
             /// The unsigned integer value.
@@ -370,12 +608,12 @@ namespace crow
                 switch (t()) {
                     case type::Number:
                     case type::String:
-                        return boost::lexical_cast<uint64_t>(start_, end_-start_);
+                        return parse_integer<uint64_t>();
                     default:
                         throw std::runtime_error(std::string("expected number, got: ") + get_type_str(t()));
                 }
 #endif
-                return boost::lexical_cast<uint64_t>(start_, end_-start_);
+                return parse_integer<uint64_t>();
             }
 
             /// The double precision floating-point number value.
@@ -385,6 +623,9 @@ namespace crow
                 if (t() != type::Number)
                     throw std::runtime_error("value is not number");
 #endif
+                double value;
+                if (crow_json_likely(detail::number::parse_double(start_, end_, value)))
+                    return value;
                 return boost::lexical_cast<double>(start_, end_-start_);
             }
 
@@ -430,62 +671,7 @@ namespace crow
             {
                 if (*(start_-1))
                 {
-                    char* head = start_;
-                    char* tail = start_;
-                    while(head != end_)
-                    {
-                        if (*head == '\\')
-                        {
-                            switch(*++head)
-                            {
-                                case '"':  *tail++ = '"'; break;
-                                case '\\': *tail++ = '\\'; break;
-                                case '/':  *tail++ = '/'; break;
-                                case 'b':  *tail++ = '\b'; break;
-                                case 'f':  *tail++ = '\f'; break;
-                                case 'n':  *tail++ = '\n'; break;
-                                case 'r':  *tail++ = '\r'; break;
-                                case 't':  *tail++ = '\t'; break;
-                                case 'u':
-                                    {
-                                        auto from_hex = [](char c)
-                                        {
-                                            if (c >= 'a')
-                                                return c - 'a' + 10;
-                                            if (c >= 'A')
-                                                return c - 'A' + 10;
-                                            return c - '0';
-                                        };
-                                        unsigned int code = 
-                                            (from_hex(head[1])<<12) + 
-                                            (from_hex(head[2])<< 8) + 
-                                            (from_hex(head[3])<< 4) + 
-                                            from_hex(head[4]);
-                                        if (code >= 0x800)
-                                        {
-                                            *tail++ = 0xE0 | (code >> 12);
-                                            *tail++ = 0x80 | ((code >> 6) & 0x3F);
-                                            *tail++ = 0x80 | (code & 0x3F);
-                                        }
-                                        else if (code >= 0x80)
-                                        {
-                                            *tail++ = 0xC0 | (code >> 6);
-                                            *tail++ = 0x80 | (code & 0x3F);
-                                        }
-                                        else
-                                        {
-                                            *tail++ = code;
-                                        }
-                                        head += 4;
-                                    }
-                                    break;
-                            }
-                        }
-                        else
-                            *tail++ = *head;
-                        head++;
-                    }
-                    end_ = tail;
+                    end_ = detail::unescape(start_, end_, start_);
                     *end_ = 0;
                     *(start_-1) = 0;
                 }
@@ -494,33 +680,12 @@ namespace crow
             ///Check if the json object has the passed string as a key.
             bool has(const char* str) const
             {
-                return has(std::string(str));
+                return find(str, std::strlen(str)) != nullptr;
             }
 
             bool has(const std::string& str) const
             {
-                struct Pred 
-                {
-                    bool operator()(const rvalue& l, const rvalue& r) const
-                    {
-                        return l.key_ < r.key_;
-                    };
-                    bool operator()(const rvalue& l, const std::string& r) const
-                    {
-                        return l.key_ < r;
-                    };
-                    bool operator()(const std::string& l, const rvalue& r) const
-                    {
-                        return l < r.key_;
-                    };
-                };
-                if (!is_cached())
-                {
-                    std::sort(begin(), end(), Pred());
-                    set_cached();
-                }
-                auto it = lower_bound(begin(), end(), str, Pred());
-                return it != end() && it->key_ == str;
+                return find(str.data(), str.size()) != nullptr;
             }
 
             int count(const std::string& str)
@@ -585,44 +750,12 @@ namespace crow
 
             const rvalue& operator[](const char* str) const
             {
-                return this->operator[](std::string(str));
+                return lookup(str, std::strlen(str));
             }
 
             const rvalue& operator[](const std::string& str) const
             {
-#ifndef CROW_JSON_NO_ERROR_CHECK
-                if (t() != type::Object)
-                    throw std::runtime_error("value is not an object");
-#endif
-                struct Pred 
-                {
-                    bool operator()(const rvalue& l, const rvalue& r) const
-                    {
-                        return l.key_ < r.key_;
-                    };
-                    bool operator()(const rvalue& l, const std::string& r) const
-                    {
-                        return l.key_ < r;
-                    };
-                    bool operator()(const std::string& l, const rvalue& r) const
-                    {
-                        return l < r.key_;
-                    };
-                };
-                if (!is_cached())
-                {
-                    std::sort(begin(), end(), Pred());
-                    set_cached();
-                }
-                auto it = lower_bound(begin(), end(), str, Pred());
-                if (it != end() && it->key_ == str)
-                    return *it;
-#ifndef CROW_JSON_NO_ERROR_CHECK
-                throw std::runtime_error("cannot find key");
-#else
-                static rvalue nullValue;
-                return nullValue;
-#endif
+                return lookup(str.data(), str.size());
             }
 
             void set_error()
@@ -650,22 +783,102 @@ namespace crow
                 return ret;
             }
         private:
-            bool is_cached() const
+            struct key_slot
+            {
+                uint32_t hash;
+                uint32_t position; ///< The index of the member plus one, 0 for an empty slot.
+            };
+
+            /// The number of slots of the index, a power of two at least twice the number of members.
+            size_t index_capacity() const
+            {
+                size_t capacity = 16;
+                while (capacity < 2 * static_cast<size_t>(lsize_))
+                    capacity *= 2;
+                return capacity;
+            }
+
+            /// Build the open addressing (linear probing) index of the members' keys.
+            void build_index() const
+            {
+                size_t mask = index_capacity() - 1;
+                index_.reset(new key_slot[mask + 1]());
+                for (uint32_t i = 0; i < lsize_; i++)
+                {
+                    const auto& key = l_[i].key_;
+                    uint32_t hash = detail::hash_key(key.begin(), key.size());
+                    size_t slot = hash & mask;
+                    while (index_[slot].position)
+                        slot = (slot + 1) & mask;
+                    index_[slot] = key_slot{hash, i + 1};
+                }
+            }
+
+            /// The member with the key, the first one if there are several, nullptr if there's none.
+
+            ///
+            /// Small objects are searched in order, larger ones through an index of the keys built on the first lookup.
+            const rvalue* find(const char* str, size_t length) const
             {
-                return (option_&cached_bit)!=0;
+                if (t() != type::Object)
+                    return nullptr;
+                auto matches = [str, length](const rvalue& v) {
+                    return v.key_.size() == length && std::memcmp(v.key_.begin(), str, length) == 0;
+                };
+                if (lsize_ < CROW_JSON_KEY_INDEX_THRESHOLD)
+                {
+                    for (uint32_t i = 0; i < lsize_; i++)
+                        if (matches(l_[i]))
+                            return &l_[i];
+                    return nullptr;
+                }
+
+                if (!index_)
+                    build_index();
+                uint32_t hash = detail::hash_key(str, length);
+                size_t mask = index_capacity() - 1;
+                for (size_t slot = hash & mask; index_[slot].position; slot = (slot + 1) & mask)
+                {
+                    if (index_[slot].hash == hash && matches(l_[index_[slot].position - 1]))
+                        return &l_[index_[slot].position - 1];
+                }
+                return nullptr;
             }
-            void set_cached() const
+
+            const rvalue& lookup(const char* str, size_t length) const
             {
-                option_ |= cached_bit;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Object)
+                    throw std::runtime_error("value is not an object");
+#endif
+                if (auto v = find(str, length))
+                    return *v;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                throw std::runtime_error("cannot find key");
+#else
+                static rvalue nullValue;
+                return nullValue;
+#endif
             }
+
             void copy_l(const rvalue& r)
             {
-                if (r.t() != type::Object && r.t() != type::List)
+                // t_ and l_ rather than t() and begin(), an error value is copied as it is instead of throwing
+                if (r.t_ != type::Object && r.t_ != type::List)
                     return;
                 lsize_ = r.lsize_;
                 lremain_ = 0;
                 l_.reset(new rvalue[lsize_]);
-                std::copy(r.begin(), r.end(), begin());
+                std::copy(r.l_.get(), r.l_.get() + lsize_, l_.get());
+                // the members keep their positions, so does the index
+                if (r.index_)
+                {
+                    size_t capacity = index_capacity();
+                    index_.reset(new key_slot[capacity]);
+                    std::memcpy(index_.get(), r.index_.get(), capacity * sizeof(key_slot));
+                }
+                else
+                    index_.reset();
             }
 
             void emplace_back(rvalue&& v)
@@ -688,6 +901,16 @@ namespace crow
                 lremain_ --;
             }
 
+            /// Convert the text, leaving what the fast conversion rejects to `boost::lexical_cast` (and its exceptions).
+            template <typename T>
+            T parse_integer() const
+            {
+                T value;
+                if (crow_json_likely(detail::number::parse_integer(start_, end_, value)))
+                    return value;
+                return boost::lexical_cast<T>(start_, end_-start_);
+            }
+
             /// determines num_type from the string.
             void determine_num_type()
             {
@@ -714,6 +937,7 @@ namespace crow
             mutable char* end_;
             detail::r_string key_;
             std::unique_ptr<rvalue[]> l_;
+            mutable std::unique_ptr<key_slot[]> index_;
             uint32_t lsize_;
             uint16_t lremain_;
             type t_;
@@ -722,6 +946,8 @@ namespace crow
 
             friend rvalue load_nocopy_internal(char* data, size_t size);
             friend rvalue load(const char* data, size_t size);
+            friend class incremental_parser;
+            friend class detail::binary_reader;
             friend std::ostream& operator <<(std::ostream& os, const rvalue& r)
             {
                 switch(r.t_)
@@ -819,6 +1045,126 @@ namespace crow
         }
 
 
+        namespace detail
+        {
+            /// Find the end of the number starting at `data`, nullptr if it isn't a valid number.
+            inline char* scan_number(char* data)
+            {
+                enum NumberParsingState
+                {
+                    Minus,
+                    AfterMinus,
+                    ZeroFirst,
+                    Digits,
+                    DigitsAfterPoints,
+                    E,
+                    DigitsAfterE,
+                    Invalid,
+                } state{Minus};
+                while(crow_json_likely(state != Invalid))
+                {
+                    switch(*data)
+                    {
+                        case '0':
+                            state = static_cast<NumberParsingState>("\2\2\7\3\4\6\6"[state]);
+                            /*if (state == NumberParsingState::Minus || state == NumberParsingState::AfterMinus)
+                            {
+                                state = NumberParsingState::ZeroFirst;
+                            }
+                            else if (state == NumberParsingState::Digits || 
+                                state == NumberParsingState::DigitsAfterE || 
+                                state == NumberParsingState::DigitsAfterPoints)
+                            {
+                                // ok; pass
+                            }
+                            else if (state == NumberParsingState::E)
+                            {
+                                state = NumberParsingState::DigitsAfterE;
+                            }
+                            else
+                                return nullptr;*/
+                            break;
+                        case '1': case '2': case '3': 
+                        case '4': case '5': case '6': 
+                        case '7': case '8': case '9':
+                            state = static_cast<NumberParsingState>("\3\3\7\3\4\6\6"[state]);
+                            while(*(data+1) >= '0' && *(data+1) <= '9') data++;
+                            /*if (state == NumberParsingState::Minus || state == NumberParsingState::AfterMinus)
+                            {
+                                state = NumberParsingState::Digits;
+                            }
+                            else if (state == NumberParsingState::Digits || 
+                                state == NumberParsingState::DigitsAfterE || 
+                                state == NumberParsingState::DigitsAfterPoints)
+                            {
+                                // ok; pass
+                            }
+                            else if (state == NumberParsingState::E)
+                            {
+                                state = NumberParsingState::DigitsAfterE;
+                            }
+                            else
+                                return nullptr;*/
+                            break;
+                        case '.':
+                            state = static_cast<NumberParsingState>("\7\7\4\4\7\7\7"[state]);
+                            /*
+                            if (state == NumberParsingState::Digits || state == NumberParsingState::ZeroFirst)
+                            {
+                                state = NumberParsingState::DigitsAfterPoints;
+                            }
+                            else
+                                return nullptr;
+                            */
+                            break;
+                        case '-':
+                            state = static_cast<NumberParsingState>("\1\7\7\7\7\6\7"[state]);
+                            /*if (state == NumberParsingState::Minus)
+                            {
+                                state = NumberParsingState::AfterMinus;
+                            }
+                            else if (state == NumberParsingState::E)
+                            {
+                                state = NumberParsingState::DigitsAfterE;
+                            }
+                            else
+                                return nullptr;*/
+                            break;
+                        case '+':
+                            state = static_cast<NumberParsingState>("\7\7\7\7\7\6\7"[state]);
+                            /*if (state == NumberParsingState::E)
+                            {
+                                state = NumberParsingState::DigitsAfterE;
+                            }
+                            else
+                                return nullptr;*/
+                            break;
+                        case 'e': case 'E':
+                            state = static_cast<NumberParsingState>("\7\7\7\5\5\7\7"[state]);
+                            /*if (state == NumberParsingState::Digits || 
+                                state == NumberParsingState::DigitsAfterPoints)
+                            {
+                                state = NumberParsingState::E;
+                            }
+                            else 
+                                return nullptr;*/
+                            break;
+                        default:
+                            if (crow_json_likely(state == NumberParsingState::ZeroFirst || 
+                                    state == NumberParsingState::Digits || 
+                                    state == NumberParsingState::DigitsAfterPoints || 
+                                    state == NumberParsingState::DigitsAfterE))
+                                return data;
+                            else
+                                return nullptr;
+                    }
+                    data++;
+                }
+
+                return nullptr;
+            }
+        }
+
         inline rvalue load_nocopy_internal(char* data, size_t size)
         {
             //static const char* escaped = "\"\\/\b\f\n\r\t";
@@ -947,119 +1293,11 @@ namespace crow
                 rvalue decode_number()
                 {
                     char* start = data;
-
-                    enum NumberParsingState
-                    {
-                        Minus,
-                        AfterMinus,
-                        ZeroFirst,
-                        Digits,
-                        DigitsAfterPoints,
-                        E,
-                        DigitsAfterE,
-                        Invalid,
-                    } state{Minus};
-                    while(crow_json_likely(state != Invalid))
-                    {
-                        switch(*data)
-                        {
-                            case '0':
-                                state = static_cast<NumberParsingState>("\2\2\7\3\4\6\6"[state]);
-                                /*if (state == NumberParsingState::Minus || state == NumberParsingState::AfterMinus)
-                                {
-                                    state = NumberParsingState::ZeroFirst;
-                                }
-                                else if (state == NumberParsingState::Digits || 
-                                    state == NumberParsingState::DigitsAfterE || 
-                                    state == NumberParsingState::DigitsAfterPoints)
-                                {
-                                    // ok; pass
-                                }
-                                else if (state == NumberParsingState::E)
-                                {
-                                    state = NumberParsingState::DigitsAfterE;
-                                }
-                                else
-                                    return {};*/
-                                break;
-                            case '1': case '2': case '3': 
-                            case '4': case '5': case '6': 
-                            case '7': case '8': case '9':
-                                state = static_cast<NumberParsingState>("\3\3\7\3\4\6\6"[state]);
-                                while(*(data+1) >= '0' && *(data+1) <= '9') data++;
-                                /*if (state == NumberParsingState::Minus || state == NumberParsingState::AfterMinus)
-                                {
-                                    state = NumberParsingState::Digits;
-                                }
-                                else if (state == NumberParsingState::Digits || 
-                                    state == NumberParsingState::DigitsAfterE || 
-                                    state == NumberParsingState::DigitsAfterPoints)
-                                {
-                                    // ok; pass
-                                }
-                                else if (state == NumberParsingState::E)
-                                {
-                                    state = NumberParsingState::DigitsAfterE;
-                                }
-                                else
-                                    return {};*/
-                                break;
-                            case '.':
-                                state = static_cast<NumberParsingState>("\7\7\4\4\7\7\7"[state]);
-                                /*
-                                if (state == NumberParsingState::Digits || state == NumberParsingState::ZeroFirst)
-                                {
-                                    state = NumberParsingState::DigitsAfterPoints;
-                                }
-                                else
-                                    return {};
-                                */
-                                break;
-                            case '-':
-                                state = static_cast<NumberParsingState>("\1\7\7\7\7\6\7"[state]);
-                                /*if (state == NumberParsingState::Minus)
-                                {
-                                    state = NumberParsingState::AfterMinus;
-                                }
-                                else if (state == NumberParsingState::E)
-                                {
-                                    state = NumberParsingState::DigitsAfterE;
-                                }
-                                else
-                                    return {};*/
-                                break;
-                            case '+':
-                                state = static_cast<NumberParsingState>("\7\7\7\7\7\6\7"[state]);
-                                /*if (state == NumberParsingState::E)
-                                {
-                                    state = NumberParsingState::DigitsAfterE;
-                                }
-                                else
-                                    return {};*/
-                                break;
-                            case 'e': case 'E':
-                                state = static_cast<NumberParsingState>("\7\7\7\5\5\7\7"[state]);
-                                /*if (state == NumberParsingState::Digits || 
-                                    state == NumberParsingState::DigitsAfterPoints)
-                                {
-                                    state = NumberParsingState::E;
-                                }
-                                else 
-                                    return {};*/
-                                break;
-                            default:
-                                if (crow_json_likely(state == NumberParsingState::ZeroFirst || 
-                                        state == NumberParsingState::Digits || 
-                                        state == NumberParsingState::DigitsAfterPoints || 
-                                        state == NumberParsingState::DigitsAfterE))
-                                    return {type::Number, start, data};
-                                else
-                                    return {};
-                        }
-                        data++;
-                    }
-
-                    return {};
+                    char* end = detail::scan_number(data);
+                    if (crow_json_unlikely(!end))
+                        return {};
+                    data = end;
+                    return {type::Number, start, data};
                 }
 
                 rvalue decode_value()
@@ -1193,12 +1431,245 @@ namespace crow
             };
             return Parser(data, size).parse();
         }
-        inline rvalue load(const char* data, size_t size)
+        namespace detail
         {
-            char* s = new char[size+1];
-            memcpy(s, data, size);
-            s[size] = 0;
-            auto ret = load_nocopy_internal(s, size);
+            /// Finds where every token of a JSON text starts, for \ref lazy_document.
+
+            ///
+            /// The input is classified 64 bytes at a time (with AVX2 or SSE2 when available) into bit masks of quotes, backslashes, operators and whitespace.<br>
+            /// Escaped quotes are removed, a prefix XOR of the remaining quotes marks what's inside strings, and the positions of
+            /// operators, quotes and the first character of every other value outside strings end up in the index.
+            class structural_index
+            {
+                struct block
+                {
+                    uint64_t quote;
+                    uint64_t backslash;
+                    uint64_t op;
+                    uint64_t ws;
+                    uint64_t nul;
+                };
+
+            public:
+                /// Index `size` bytes, false if the input has an unterminated string or a null byte.
+                bool build(const char* data, size_t size)
+                {
+                    if (size >= UINT32_MAX)
+                        return false;
+
+                    count_ = 0;
+                    reserve(size / 4 + 128);
+
+                    uint64_t prev_escaped = 0;   // the first character of the next block is escaped
+                    uint64_t prev_in_string = 0; // all ones if the previous block ended inside a string
+                    uint64_t prev_follows = 1;   // the first character of the next block can start a value
+
+                    char padded[64];
+                    for (size_t pos = 0; pos < size; pos += 64)
+                    {
+                        const char* p = data + pos;
+                        if (size - pos < 64)
+                        {
+                            std::memset(padded, ' ', 64);
+                            std::memcpy(padded, p, size - pos);
+                            p = padded;
+                        }
+
+                        block b;
+                        classify(p, b);
+                        if (crow_json_unlikely(b.nul != 0))
+                            return false;
+
+                        uint64_t escaped = 0;
+                        if (crow_json_unlikely((b.backslash | prev_escaped) != 0))
+                            escaped = find_escaped(b.backslash, prev_escaped);
+
+                        uint64_t quote = b.quote & ~escaped;
+                        uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+                        prev_in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+                        uint64_t op = b.op & ~in_string;
+                        uint64_t separator = op | (b.ws & ~in_string) | quote;
+                        uint64_t follows = (separator << 1) | prev_follows;
+                        prev_follows = separator >> 63;
+                        uint64_t value_start = ~(b.op | b.ws | quote) & ~in_string & follows;
+
+                        flatten(static_cast<uint32_t>(pos), op | quote | value_start);
+                    }
+
+                    if (prev_in_string)
+                        return false;
+
+                    // the terminating null is the last token
+                    reserve(count_ + 1);
+                    positions_[count_] = static_cast<uint32_t>(size);
+                    return true;
+                }
+
+                const uint32_t* positions() const
+                {
+                    return positions_.get();
+                }
+
+                /// The number of tokens, not counting the end of the input.
+                size_t size() const
+                {
+                    return count_;
+                }
+
+            private:
+                static void classify(const char* p, block& b)
+                {
+#if defined(CROW_JSON_AVX2)
+                    uint64_t m[5] = {};
+                    for (int half = 0; half < 2; half++)
+                    {
+                        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + half * 32));
+                        auto eq = [&v](char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); };
+                        // '[' and ']' are '{' and '}' without the 0x20 bit
+                        __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+                        __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))), _mm256_or_si256(eq(':'), eq(',')));
+                        __m256i ws = _mm256_or_si256(_mm256_or_si256(eq(' '), eq('\t')), _mm256_or_si256(eq('\n'), eq('\r')));
+                        int shift = half * 32;
+                        m[0] |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq('"')))) << shift;
+                        m[1] |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq('\\')))) << shift;
+                        m[2] |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << shift;
+                        m[3] |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ws))) << shift;
+                        m[4] |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq('\0')))) << shift;
+                    }
+                    b = block{m[0], m[1], m[2], m[3], m[4]};
+#elif defined(CROW_JSON_SSE2)
+                    uint64_t m[5] = {};
+                    for (int quarter = 0; quarter < 4; quarter++)
+                    {
+                        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + quarter * 16));
+                        auto eq = [&v](char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); };
+                        // '[' and ']' are '{' and '}' without the 0x20 bit
+                        __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+                        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))), _mm_or_si128(eq(':'), eq(',')));
+                        __m128i ws = _mm_or_si128(_mm_or_si128(eq(' '), eq('\t')), _mm_or_si128(eq('\n'), eq('\r')));
+                        int shift = quarter * 16;
+                        m[0] |= static_cast<uint64_t>(_mm_movemask_epi8(eq('"'))) << shift;
+                        m[1] |= static_cast<uint64_t>(_mm_movemask_epi8(eq('\\'))) << shift;
+                        m[2] |= static_cast<uint64_t>(_mm_movemask_epi8(op)) << shift;
+                        m[3] |= static_cast<uint64_t>(_mm_movemask_epi8(ws)) << shift;
+                        m[4] |= static_cast<uint64_t>(_mm_movemask_epi8(eq('\0'))) << shift;
+                    }
+                    b = block{m[0], m[1], m[2], m[3], m[4]};
+#else
+                    // 1: quote, 2: backslash, 4: operator, 8: whitespace, 16: null
+                    static const struct classes
+                    {
+                        uint8_t c[256];
+                        classes() : c()
+                        {
+                            c[static_cast<uint8_t>('"')] = 1;
+                            c[static_cast<uint8_t>('\\')] = 2;
+                            for (char op : {'{', '}', '[', ']', ':', ','})
+                                c[static_cast<uint8_t>(op)] = 4;
+                            for (char ws : {' ', '\t', '\n', '\r'})
+                                c[static_cast<uint8_t>(ws)] = 8;
+                            c[0] = 16;
+                        }
+                    } table;
+                    b = block{0, 0, 0, 0, 0};
+                    for (int i = 0; i < 64; i++)
+                    {
+                        uint64_t c = table.c[static_cast<uint8_t>(p[i])];
+                        b.quote |= (c & 1) << i;
+                        b.backslash |= ((c >> 1) & 1) << i;
+                        b.op |= ((c >> 2) & 1) << i;
+                        b.ws |= ((c >> 3) & 1) << i;
+                        b.nul |= (c >> 4) << i;
+                    }
+#endif
+                }
+
+                /// The characters following an odd number of backslashes.
+                static uint64_t find_escaped(uint64_t backslash, uint64_t& prev_escaped)
+                {
+                    // an escaped backslash doesn't escape anything
+                    uint64_t potential_escape = backslash & ~prev_escaped;
+                    // subtracting every run of backslashes from alternating bits leaves the bit after the run
+                    // set only when the run has an odd length
+                    const uint64_t odd_bits = 0xAAAAAAAAAAAAAAAAull;
+                    uint64_t escape_and_terminal = (((potential_escape << 1) | odd_bits) - potential_escape) ^ odd_bits;
+                    uint64_t escaped = escape_and_terminal ^ (backslash | prev_escaped);
+                    prev_escaped = (escape_and_terminal & backslash) >> 63;
+                    return escaped;
+                }
+
+                /// Every bit becomes the XOR of itself and all the bits below it, so the bits between two quotes are set.
+                static uint64_t prefix_xor(uint64_t x)
+                {
+#if defined(CROW_JSON_PCLMUL)
+                    return static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_set_epi64x(0, static_cast<int64_t>(x)), _mm_set1_epi8(-1), 0)));
+#else
+                    x ^= x << 1;
+                    x ^= x << 2;
+                    x ^= x << 4;
+                    x ^= x << 8;
+                    x ^= x << 16;
+                    x ^= x << 32;
+                    return x;
+#endif
+                }
+
+                static int trailing_zeros(uint64_t x)
+                {
+#if defined(__GNUC__) || defined(__clang__)
+                    return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+                    unsigned long i;
+                    _BitScanForward64(&i, x);
+                    return static_cast<int>(i);
+#else
+                    int i = 0;
+                    while (!(x & 1))
+                    {
+                        x >>= 1;
+                        i++;
+                    }
+                    return i;
+#endif
+                }
+
+                void flatten(uint32_t base, uint64_t bits)
+                {
+                    reserve(count_ + 64);
+                    uint32_t* out = positions_.get() + count_;
+                    while (bits)
+                    {
+                        *out++ = base + trailing_zeros(bits);
+                        bits &= bits - 1;
+                    }
+                    count_ = out - positions_.get();
+                }
+
+                void reserve(size_t n)
+                {
+                    if (n <= capacity_)
+                        return;
+                    size_t capacity = capacity_ * 2 > n ? capacity_ * 2 : n;
+                    std::unique_ptr<uint32_t[]> p(new uint32_t[capacity]);
+                    if (count_)
+                        std::memcpy(p.get(), positions_.get(), count_ * sizeof(uint32_t));
+                    positions_ = std::move(p);
+                    capacity_ = capacity;
+                }
+
+                std::unique_ptr<uint32_t[]> positions_;
+                size_t capacity_{0};
+                size_t count_{0};
+            };
+        }
+
+        inline rvalue load(const char* data, size_t size)
+        {
+            char* s = new char[size+1];
+            memcpy(s, data, size);
+            s[size] = 0;
+            auto ret = load_nocopy_internal(s, size);
             if (ret)
                 ret.key_.force(s, size);
             else
@@ -1216,438 +1687,1749 @@ namespace crow
             return load(str.data(), str.size());
         }
 
-        /// JSON write value.
+        /// Parses a JSON document that arrives in parts, building the \ref rvalue as the parts are fed.
 
         ///
-        /// Value can mean any json value, including a JSON object.
-        /// Write means this class is used to primarily assemble JSON objects using keys and values and export those into a string.
-        class wvalue : public returnable
+        /// The parts are collected in a single buffer (allocated once when the size of the whole document is known up front),
+        /// which the tree returned by \ref finish() refers to and owns, just like a tree returned by \ref load().<br>
+        /// Only the value (or key) that was cut at the end of a part is looked at again when the next one arrives.
+        class incremental_parser
         {
-            friend class crow::mustache::template_t;
-        public:
-            type t() const { return t_; }
-        private:
-            type t_{type::Null}; ///< The type of the value.
-            num_type nt{num_type::Null}; ///< The specific type of the number if \ref t_ is a number.
-            union {
-              double d;
-              int64_t si;
-              uint64_t ui {};
-            } num; ///< Value if type is a number.
-            std::string s; ///< Value if type is a string.
-            std::unique_ptr<std::vector<wvalue>> l; ///< Value if type is a list.
-#ifdef CROW_JSON_USE_MAP
-            std::unique_ptr<std::map<std::string, wvalue>> o;
-#else
-            std::unique_ptr<std::unordered_map<std::string, wvalue>> o; ///< Value if type is a JSON object.
-#endif
-
         public:
-
-            wvalue() : returnable("application/json") {}
-
-            wvalue(std::vector<wvalue>& r) : returnable("application/json")
+            /// `expected_size` is the size of the whole document if it's known, e.g. from a `Content-Length` header.
+            explicit incremental_parser(size_t expected_size = 0)
             {
-                t_ = type::List;
-                l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
-                l->reserve(r.size());
-                for(auto it = r.begin(); it != r.end(); ++it)
-                    l->emplace_back(*it);
+                reserve(std::max<size_t>(expected_size, 64));
             }
 
-            /// Create a write value from a read value (useful for editing JSON strings).
-            wvalue(const rvalue& r) : returnable("application/json")
+            /// Parse the next part of the document, false once the document can't be valid anymore.
+            bool feed(const char* data, size_t size)
             {
-                t_ = r.t();
-                switch(r.t())
-                {
-                    case type::Null:
-                    case type::False:
-                    case type::True:
-                        return;
-                    case type::Number:
-                        nt = r.nt();
-                        if (nt == num_type::Floating_point)
-                          num.d = r.d();
-                        else if (nt == num_type::Signed_integer)
-                          num.si = r.i();
-                        else
-                          num.ui = r.u();
-                        return;
-                    case type::String:
-                        s = r.s();
-                        return;
-                    case type::List:
-                        l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
-                        l->reserve(r.size());
-                        for(auto it = r.begin(); it != r.end(); ++it)
-                            l->emplace_back(*it);
-                        return;
-                    case type::Object:
-#ifdef CROW_JSON_USE_MAP
-                        o = std::unique_ptr<std::map<std::string, wvalue>>(new std::map<std::string, wvalue>{});
-#else
-                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
-#endif
-                        for(auto it = r.begin(); it != r.end(); ++it)
-                            o->emplace(it->key(), *it);
-                        return;
-                }
+                if (failed_)
+                    return false;
+                if (size_ + size > capacity_)
+                    reserve(std::max(size_ + size, 2 * capacity_));
+                std::memcpy(buffer_.get() + size_, data, size);
+                size_ += size;
+                buffer_[size_] = 0;
+                parse(false);
+                return !failed_;
             }
 
-            wvalue(const wvalue& r) : returnable("application/json")
+            /// Signal that the whole document was fed and get it (an error value if it's invalid or incomplete).
+            rvalue finish()
             {
-                t_ = r.t();
-                switch(r.t())
+                if (!failed_)
+                    parse(true);
+                if (failed_ || in_string_ || !stack_.empty() || expect_ != expect::end)
                 {
-                    case type::Null:
-                    case type::False:
-                    case type::True:
-                        return;
-                    case type::Number:
-                        nt = r.nt;
-                        if (nt == num_type::Floating_point)
-                          num.d = r.num.d;
-                        else if (nt == num_type::Signed_integer)
-                          num.si = r.num.si;
-                        else
-                          num.ui = r.num.ui;
-                        return;
-                    case type::String:
-                        s = r.s;
-                        return;
-                    case type::List:
-                        l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
-                        l->reserve(r.size());
-                        for(auto it = r.l->begin(); it != r.l->end(); ++it)
-                            l->emplace_back(*it);
-                        return;
-                    case type::Object:
-#ifdef CROW_JSON_USE_MAP
-                        o = std::unique_ptr<std::map<std::string, wvalue>>(new std::map<std::string, wvalue>{});
-#else
-                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
-#endif
-                        o->insert(r.o->begin(), r.o->end());
-                        return;
+                    failed_ = true;
+                    return {};
                 }
+                rvalue ret = std::move(root_);
+                ret.key_.force(buffer_.release(), static_cast<uint32_t>(size_));
+                return ret;
             }
 
-            wvalue(wvalue&& r) : returnable("application/json")
+            bool failed() const
             {
-                *this = std::move(r);
+                return failed_;
             }
 
-            wvalue& operator = (wvalue&& r)
+        private:
+            enum class expect : char
             {
-                t_ = r.t_;
-                num = r.num;
-                s = std::move(r.s);
-                l = std::move(r.l);
-                o = std::move(r.o);
-                return *this;
-            }
+                value,
+                value_or_close,
+                key,
+                key_or_close,
+                colon,
+                comma_or_close,
+                end,
+            };
 
-            /// Used for compatibility, same as \ref reset()
-            void clear()
+            /// A list or an object that's still open.
+            struct frame
             {
-                reset();
-            }
+                explicit frame(type t) : value(t) {}
 
-            void reset()
-            {
-                t_ = type::Null;
-                l.reset();
-                o.reset();
-            }
+                frame(frame&& f) noexcept
+                    : value(std::move(f.value)), key(f.key), has_key(f.has_key)
+                {
+                }
 
-            wvalue& operator = (std::nullptr_t)
-            {
-                reset();
-                return *this;
-            }
-            wvalue& operator = (bool value)
-            {
-                reset();
-                if (value)
-                    t_ = type::True;
-                else
-                    t_ = type::False;
-                return *this;
-            }
+                rvalue value;
+                detail::r_string key; ///< The key of the value being parsed in an object.
+                bool has_key{false};
+            };
 
-            wvalue& operator = (double value)
+            void reserve(size_t capacity)
             {
-                reset();
-                t_ = type::Number;
-                num.d = value;
-                nt = num_type::Floating_point;
-                return *this;
+                std::unique_ptr<char[]> buffer(new char[capacity + 1]);
+                if (buffer_)
+                {
+                    std::memcpy(buffer.get(), buffer_.get(), size_ + 1);
+                    // what was built so far points into the old buffer
+                    for (auto& f : stack_)
+                    {
+                        rebase(f.value, buffer_.get(), buffer.get(), false);
+                        if (f.has_key)
+                            rebase(f.key, buffer_.get(), buffer.get());
+                    }
+                    if (expect_ == expect::end)
+                        rebase(root_, buffer_.get(), buffer.get(), false);
+                }
+                else
+                    buffer[0] = 0;
+                buffer_ = std::move(buffer);
+                capacity_ = capacity;
             }
 
-            wvalue& operator = (unsigned short value)
+            static void rebase(detail::r_string& str, char* from, char* to)
             {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+                str.s_ = to + (str.s_ - from);
+                str.e_ = to + (str.e_ - from);
             }
 
-            wvalue& operator = (short value)
+            static void rebase(rvalue& v, char* from, char* to, bool keyed)
             {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
+                if (keyed)
+                    rebase(v.key_, from, to);
+                if (v.t_ == type::String || v.t_ == type::Number)
+                {
+                    v.start_ = to + (v.start_ - from);
+                    v.end_ = to + (v.end_ - from);
+                }
+                else if (v.t_ == type::List || v.t_ == type::Object)
+                {
+                    for (uint32_t i = 0; i < v.lsize_; i++)
+                        rebase(v.l_[i], from, to, v.t_ == type::Object);
+                }
             }
 
-            wvalue& operator = (long long value)
+            void parse(bool final)
             {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
-            }
-
-            wvalue& operator = (long value)
-            {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
-            }
-
-            wvalue& operator = (int value)
-            {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
-            }
-
-            wvalue& operator = (unsigned long long value)
-            {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+                char* data = buffer_.get();
+                while (pos_ < size_ && !failed_)
+                {
+                    if (in_string_)
+                    {
+                        if (!continue_string())
+                            return;
+                        continue;
+                    }
+                    char c = data[pos_];
+                    if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+                    {
+                        pos_++;
+                        continue;
+                    }
+                    switch (expect_)
+                    {
+                        case expect::end:
+                            failed_ = true;
+                            break;
+                        case expect::colon:
+                            if (c != ':')
+                                failed_ = true;
+                            pos_++;
+                            expect_ = expect::value;
+                            break;
+                        case expect::comma_or_close:
+                            if (c == ',')
+                            {
+                                pos_++;
+                                expect_ = stack_.back().value.t_ == type::Object ? expect::key : expect::value;
+                            }
+                            else if (c == (stack_.back().value.t_ == type::Object ? '}' : ']'))
+                            {
+                                pos_++;
+                                close();
+                            }
+                            else
+                                failed_ = true;
+                            break;
+                        case expect::key_or_close:
+                            if (c == '}')
+                            {
+                                pos_++;
+                                close();
+                                break;
+                            }
+                            /* fall through */
+                        case expect::key:
+                            if (c != '"')
+                                failed_ = true;
+                            else
+                                begin_string();
+                            break;
+                        case expect::value_or_close:
+                            if (c == ']')
+                            {
+                                pos_++;
+                                close();
+                                break;
+                            }
+                            /* fall through */
+                        case expect::value:
+                            if (!parse_value(final))
+                                return;
+                            break;
+                    }
+                }
             }
 
-            wvalue& operator = (unsigned long value)
+            /// Start the value at the current position, false if the rest of it didn't arrive yet.
+            bool parse_value(bool final)
             {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+                char* data = buffer_.get() + pos_;
+                switch (*data)
+                {
+                    case '{':
+                    case '[':
+                        pos_++;
+                        stack_.emplace_back(*data == '{' ? type::Object : type::List);
+                        expect_ = *data == '{' ? expect::key_or_close : expect::value_or_close;
+                        return true;
+                    case '"':
+                        begin_string();
+                        return true;
+                    case 't':
+                        return parse_literal("true", type::True, final);
+                    case 'f':
+                        return parse_literal("false", type::False, final);
+                    case 'n':
+                        return parse_literal("null", type::Null, final);
+                    default:
+                        {
+                            char* last = buffer_.get() + size_;
+                            char* p = data;
+                            while (p < last && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+                                p++;
+                            // the number may go on in the next part
+                            if (p == last && !final)
+                                return false;
+                            char* end = detail::scan_number(data);
+                            if (!end)
+                            {
+                                failed_ = true;
+                                return false;
+                            }
+                            pos_ = end - buffer_.get();
+                            add(rvalue(type::Number, data, end));
+                            return true;
+                        }
+                }
             }
 
-            wvalue& operator = (unsigned int value)
+            bool parse_literal(const char* literal, type t, bool final)
             {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+                size_t length = std::strlen(literal);
+                size_t available = std::min(length, size_ - pos_);
+                if (std::memcmp(buffer_.get() + pos_, literal, available) != 0 || (available < length && final))
+                {
+                    failed_ = true;
+                    return false;
+                }
+                if (available < length)
+                    return false;
+                pos_ += length;
+                add(rvalue(t));
+                return true;
             }
 
-            wvalue& operator=(const char* str)
+            void begin_string()
             {
-                reset();
-                t_ = type::String;
-                s = str;
-                return *this;
+                pos_++;
+                in_string_ = true;
+                string_start_ = pos_;
+                has_escaping_ = 0;
             }
 
-            wvalue& operator=(const std::string& str)
+            /// Scan the string being parsed, false if its end didn't arrive yet.
+            bool continue_string()
             {
-                reset();
-                t_ = type::String;
-                s = str;
-                return *this;
+                char* data = buffer_.get();
+                while (pos_ < size_)
+                {
+                    // the buffer is terminated, this stops at its end at the latest
+                    pos_ += std::strcspn(data + pos_, "\"\\");
+                    if (pos_ == size_)
+                        break;
+                    char c = data[pos_];
+                    if (c == '"')
+                        break;
+                    if (c == '\0')
+                    {
+                        failed_ = true;
+                        return false;
+                    }
+                    has_escaping_ = 1;
+                    if (pos_ + 1 >= size_)
+                        return false;
+                    switch (data[pos_ + 1])
+                    {
+                        case 'u':
+                            if (pos_ + 6 > size_)
+                                return false;
+                            for (size_t i = pos_ + 2; i < pos_ + 6; i++)
+                            {
+                                char h = data[i];
+                                if (!(('0' <= h && h <= '9') || ('a' <= h && h <= 'f') || ('A' <= h && h <= 'F')))
+                                {
+                                    failed_ = true;
+                                    return false;
+                                }
+                            }
+                            pos_ += 6;
+                            break;
+                        case '"':
+                        case '\\':
+                        case '/':
+                        case 'b':
+                        case 'f':
+                        case 'n':
+                        case 'r':
+                        case 't':
+                            pos_ += 2;
+                            break;
+                        default:
+                            failed_ = true;
+                            return false;
+                    }
+                }
+                if (pos_ == size_)
+                    return false;
+
+                // the same in place layout as load(): the escaping flag over the opening quote, a terminator over the closing one
+                char* start = data + string_start_;
+                data[pos_] = 0;
+                *(start - 1) = has_escaping_;
+                rvalue str(type::String, start, data + pos_);
+                pos_++;
+                in_string_ = false;
+                if (expect_ == expect::key || expect_ == expect::key_or_close)
+                {
+                    stack_.back().key = str.s();
+                    stack_.back().has_key = true;
+                    expect_ = expect::colon;
+                }
+                else
+                    add(std::move(str));
+                return true;
             }
 
-            wvalue& operator=(std::vector<wvalue>&& v)
+            void add(rvalue&& v)
             {
-                if (t_ != type::List)
-                    reset();
-                t_ = type::List;
-                if (!l)
-                    l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
-                l->clear();
-                l->resize(v.size());
-                size_t idx = 0;
-                for(auto& x:v)
+                if (stack_.empty())
                 {
-                    (*l)[idx++] = std::move(x);
+                    root_ = std::move(v);
+                    expect_ = expect::end;
+                    return;
                 }
-                return *this;
+                frame& top = stack_.back();
+                if (top.value.t_ == type::Object)
+                {
+                    v.key_ = std::move(top.key);
+                    top.has_key = false;
+                }
+                top.value.emplace_back(std::move(v));
+                expect_ = expect::comma_or_close;
             }
 
-            template <typename T>
-            wvalue& operator=(const std::vector<T>& v)
+            void close()
             {
-                if (t_ != type::List)
-                    reset();
-                t_ = type::List;
-                if (!l)
-                    l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
-                l->clear();
-                l->resize(v.size());
-                size_t idx = 0;
-                for(auto& x:v)
-                {
-                    (*l)[idx++] = x;
-                }
-                return *this;
+                rvalue v = std::move(stack_.back().value);
+                stack_.pop_back();
+                add(std::move(v));
             }
 
-            wvalue& operator[](unsigned index)
+            std::unique_ptr<char[]> buffer_;
+            size_t size_{0};
+            size_t capacity_{0};
+            size_t pos_{0}; ///< Where parsing goes on when more arrives.
+            std::vector<frame> stack_;
+            rvalue root_;
+            expect expect_{expect::value};
+            bool in_string_{false};
+            uint8_t has_escaping_{0};
+            size_t string_start_{0};
+            bool failed_{false};
+        };
+
+        class lazy_value;
+
+        /// A JSON document that's validated up front, but whose values are only read when they're accessed.
+
+        ///
+        /// No \ref rvalue is built: the tokens are indexed first (see \ref detail::structural_index), then checked,
+        /// noting where every list and object ends so the ones that aren't accessed are skipped in a single step.<br>
+        /// Looking up a key walks the members of the object, which suits reading a few values out of a large document.
+        /// The document has to outlive the values taken from it.
+        class lazy_document
+        {
+        public:
+            explicit lazy_document(std::string text)
+                : text_(std::move(text))
             {
-                if (t_ != type::List)
-                    reset();
-                t_ = type::List;
-                if (!l)
-                    l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
-                if (l->size() < index+1)
-                    l->resize(index+1);
-                return (*l)[index];
+                valid_ = index_.build(text_.data(), text_.size()) && validate();
             }
 
-            int count(const std::string& str)
+            lazy_document(const lazy_document&) = delete;
+            lazy_document& operator = (const lazy_document&) = delete;
+
+            /// Whether the document is valid JSON.
+            explicit operator bool() const
             {
-                if (t_ != type::Object)
-                    return 0;
-                if (!o)
-                    return 0;
-                return o->count(str);
+                return valid_;
             }
 
-            wvalue& operator[](const std::string& str)
+            lazy_value root() const;
+            lazy_value operator[](const std::string& key) const;
+            lazy_value operator[](size_t index) const;
+
+        private:
+            friend class lazy_value;
+
+            const char* at(uint32_t token) const
             {
-                if (t_ != type::Object)
-                    reset();
-                t_ = type::Object;
-                if (!o)
-#ifdef CROW_JSON_USE_MAP
-                        o = std::unique_ptr<std::map<std::string, wvalue>>(new std::map<std::string, wvalue>{});
-#else
-                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
-#endif
-                return (*o)[str];
+                return text_.data() + index_.positions()[token];
             }
 
-            std::vector<std::string> keys() const 
+            /// The token right after the value starting at `token`.
+            uint32_t next(uint32_t token) const
             {
-                if (t_ != type::Object) 
-                    return {};
-                std::vector<std::string> result;
-                for (auto& kv:*o) 
+                switch (*at(token))
                 {
-                    result.push_back(kv.first);
+                    case '[':
+                    case '{':
+                        return ends_[token] + 1;
+                    case '"':
+                        return token + 2;
+                    default:
+                        return token + 1;
                 }
-                return result;
             }
 
-            /// If the wvalue is a list, it returns the length of the list, otherwise it returns 1.
-            std::size_t size() const
+            bool validate()
             {
-                if (t_ != type::List)
-                    return 1;
-                return l->size();
+                enum class expect : char
+                {
+                    value,
+                    value_or_close,
+                    key,
+                    key_or_close,
+                    colon,
+                    comma_or_close,
+                    end,
+                } e = expect::value;
+
+                const uint32_t* positions = index_.positions();
+                const uint32_t n = static_cast<uint32_t>(index_.size());
+                const char* data = text_.data();
+                ends_.reset(new uint32_t[n + 1]);
+                std::vector<uint32_t> open;
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    char c = data[positions[i]];
+                    switch (c)
+                    {
+                        case '[':
+                        case '{':
+                            if (e != expect::value && e != expect::value_or_close)
+                                return false;
+                            open.push_back(i);
+                            e = c == '{' ? expect::key_or_close : expect::value_or_close;
+                            break;
+                        case ']':
+                        case '}':
+                            // the brackets are 2 apart in ASCII
+                            if (open.empty() || data[positions[open.back()]] != c - 2 ||
+                                (e != expect::comma_or_close && e != (c == '}' ? expect::key_or_close : expect::value_or_close)))
+                                return false;
+                            ends_[open.back()] = i;
+                            open.pop_back();
+                            e = open.empty() ? expect::end : expect::comma_or_close;
+                            break;
+                        case ':':
+                            if (e != expect::colon)
+                                return false;
+                            e = expect::value;
+                            break;
+                        case ',':
+                            if (e != expect::comma_or_close)
+                                return false;
+                            e = data[positions[open.back()]] == '{' ? expect::key : expect::value;
+                            break;
+                        case '"':
+                            // the closing quote is the next token
+                            if (i + 1 >= n || !valid_string(data + positions[i] + 1, data + positions[i + 1]))
+                                return false;
+                            if (e == expect::key || e == expect::key_or_close)
+                                e = expect::colon;
+                            else if (e == expect::value || e == expect::value_or_close)
+                                e = open.empty() ? expect::end : expect::comma_or_close;
+                            else
+                                return false;
+                            i++;
+                            break;
+                        default:
+                            if ((e != expect::value && e != expect::value_or_close) || !valid_scalar(data + positions[i], data + positions[i + 1]))
+                                return false;
+                            e = open.empty() ? expect::end : expect::comma_or_close;
+                            break;
+                    }
+                }
+                return e == expect::end;
             }
 
-            /// Returns an estimated size of the value in bytes.
-            size_t estimate_length() const
+            static bool valid_string(const char* s, const char* end)
             {
-                switch(t_)
+                while ((s = static_cast<const char*>(std::memchr(s, '\\', end - s))))
                 {
-                    case type::Null: return 4;
-                    case type::False: return 5;
-                    case type::True: return 4;
-                    case type::Number: return 30;
-                    case type::String: return 2+s.size()+s.size()/2;
-                    case type::List: 
-                        {
-                            size_t sum{};
-                            if (l)
-                            {
-                                for(auto& x:*l)
-                                {
-                                    sum += 1;
-                                    sum += x.estimate_length();
-                                }
-                            }
-                            return sum+2;
-                        }
-                    case type::Object:
-                        {
-                            size_t sum{};
-                            if (o)
+                    switch (s[1])
+                    {
+                        case 'u':
+                            for (int i = 2; i < 6; i++)
                             {
-                                for(auto& kv:*o)
-                                {
-                                    sum += 2;
-                                    sum += 2+kv.first.size()+kv.first.size()/2;
-                                    sum += kv.second.estimate_length();
-                                }
+                                char h = s[i];
+                                if (!(('0' <= h && h <= '9') || ('a' <= h && h <= 'f') || ('A' <= h && h <= 'F')))
+                                    return false;
                             }
-                            return sum+2;
-                        }
+                            s += 6;
+                            break;
+                        case '"':
+                        case '\\':
+                        case '/':
+                        case 'b':
+                        case 'f':
+                        case 'n':
+                        case 'r':
+                        case 't':
+                            s += 2;
+                            break;
+                        default:
+                            return false;
+                    }
                 }
-                return 1;
+                return true;
             }
 
-        private:
-
-            inline void dump_string(const std::string& str, std::string& out) const
+            /// Check the number or literal at `s`, followed by nothing but whitespace up to the next token.
+            static bool valid_scalar(const char* s, const char* next)
             {
-                out.push_back('"');
-                escape(str, out);
-                out.push_back('"');
+                const char* end;
+                if (*s == 't' || *s == 'n')
+                    end = std::strncmp(s, *s == 't' ? "true" : "null", 4) == 0 ? s + 4 : nullptr;
+                else if (*s == 'f')
+                    end = std::strncmp(s, "false", 5) == 0 ? s + 5 : nullptr;
+                else
+                    end = detail::scan_number(const_cast<char*>(s));
+                if (!end || end > next)
+                    return false;
+                for (; end != next; end++)
+                    if (*end != ' ' && *end != '\t' && *end != '\r' && *end != '\n')
+                        return false;
+                return true;
             }
 
-            inline void dump_internal(const wvalue& v, std::string& out) const
+            std::string text_;
+            detail::structural_index index_;
+            std::unique_ptr<uint32_t[]> ends_; ///< For the first token of every list and object, the token closing it.
+            bool valid_{false};
+        };
+
+        /// A value of a \ref lazy_document, read from the text when it's asked for.
+        class lazy_value
+        {
+            static const uint32_t none = UINT32_MAX;
+
+        public:
+            class iterator
             {
-                switch(v.t_)
+            public:
+                lazy_value operator*() const
+                {
+                    return object_ ? lazy_value(doc_, element_ + 3, element_) : lazy_value(doc_, element_);
+                }
+
+                iterator& operator++()
+                {
+                    uint32_t after = doc_->next(object_ ? element_ + 3 : element_);
+                    element_ = *doc_->at(after) == ',' ? after + 1 : none;
+                    return *this;
+                }
+
+                bool operator==(const iterator& other) const
+                {
+                    return element_ == other.element_;
+                }
+
+                bool operator!=(const iterator& other) const
+                {
+                    return element_ != other.element_;
+                }
+
+            private:
+                friend class lazy_value;
+                iterator(const lazy_document* doc, uint32_t element, bool object)
+                    : doc_(doc), element_(element), object_(object)
+                {
+                }
+
+                const lazy_document* doc_;
+                uint32_t element_; ///< The first token of the element, or of the key of the member.
+                bool object_;
+            };
+
+            lazy_value() = default;
+
+            type t() const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (!doc_)
+                    throw std::runtime_error("invalid json object");
+#endif
+                switch (*doc_->at(token_))
+                {
+                    case '{': return type::Object;
+                    case '[': return type::List;
+                    case '"': return type::String;
+                    case 't': return type::True;
+                    case 'f': return type::False;
+                    case 'n': return type::Null;
+                    default: return type::Number;
+                }
+            }
+
+            explicit operator bool() const
+            {
+                return doc_ != nullptr;
+            }
+
+            /// The elements of a list, or the values of the members of an object.
+            iterator begin() const
+            {
+                type kind = t();
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (kind != type::Object && kind != type::List)
+                    throw std::runtime_error("value is not a container");
+#endif
+                uint32_t first = token_ + 1;
+                char c = *doc_->at(first);
+                return iterator(doc_, c == ']' || c == '}' ? none : first, kind == type::Object);
+            }
+
+            iterator end() const
+            {
+                return iterator(doc_, none, false);
+            }
+
+            /// The number of elements (or members), counted by skipping over them.
+            size_t size() const
+            {
+                if (t() == type::String)
+                    return s().size();
+                size_t n = 0;
+                for (auto it = begin(); it != end(); ++it)
+                    n++;
+                return n;
+            }
+
+            bool has(const std::string& key) const
+            {
+                return find(key) != none;
+            }
+
+            /// The value of the first member with the key.
+            lazy_value operator[](const std::string& key) const
+            {
+                uint32_t member = find(key);
+                if (member == none)
+                    throw std::runtime_error("cannot find key");
+                return lazy_value(doc_, member + 3, member);
+            }
+
+            lazy_value operator[](const char* key) const
+            {
+                return (*this)[std::string(key)];
+            }
+
+            lazy_value operator[](size_t index) const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::List)
+                    throw std::runtime_error("value is not a list");
+#endif
+                auto it = begin();
+                for (; index && it != end(); index--)
+                    ++it;
+                if (it == end())
+                    throw std::runtime_error("list out of bound");
+                return *it;
+            }
+
+            lazy_value operator[](int index) const
+            {
+                return (*this)[static_cast<size_t>(index)];
+            }
+
+            /// The key of a value found in an object.
+            std::string key() const
+            {
+                if (key_ == none)
+                    throw std::runtime_error("value is not an object member");
+                return string_at(key_);
+            }
+
+            std::vector<std::string> keys() const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Object)
+                    throw std::runtime_error("value is not an object");
+#endif
+                std::vector<std::string> ret;
+                for (auto it = begin(); it != end(); ++it)
+                    ret.push_back((*it).key());
+                return ret;
+            }
+
+            std::string s() const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::String)
+                    throw std::runtime_error("value is not string");
+#endif
+                return string_at(token_);
+            }
+
+            bool b() const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::True && t() != type::False)
+                    throw std::runtime_error("value is not boolean");
+#endif
+                return t() == type::True;
+            }
+
+            int64_t i() const
+            {
+                return number<int64_t>();
+            }
+
+            uint64_t u() const
+            {
+                return number<uint64_t>();
+            }
+
+            double d() const
+            {
+                const char* start = number_start();
+                double value;
+                if (crow_json_likely(detail::number::parse_double(start, number_end(start), value)))
+                    return value;
+                return boost::lexical_cast<double>(start, number_end(start) - start);
+            }
+
+            /// The JSON text of the value.
+            std::string raw() const
+            {
+                const char* start = doc_->at(token_);
+                const char* end = doc_->at(doc_->next(token_));
+                switch (*start)
+                {
+                    case '[':
+                    case '{':
+                    case '"':
+                        end = doc_->at(doc_->next(token_) - 1) + 1;
+                        break;
+                    default:
+                        while (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')
+                            end--;
+                        break;
+                }
+                return std::string(start, end);
+            }
+
+            /// Build the whole \ref rvalue of this value.
+            rvalue materialize() const
+            {
+                return load(raw());
+            }
+
+        private:
+            friend class lazy_document;
+
+            lazy_value(const lazy_document* doc, uint32_t token, uint32_t key = none)
+                : doc_(doc), token_(token), key_(key)
+            {
+            }
+
+            /// The first token of the key of the first member with the key, `none` if there's none.
+            uint32_t find(const std::string& key) const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Object)
+                    throw std::runtime_error("value is not an object");
+#endif
+                for (auto it = begin(); it != end(); ++it)
+                {
+                    const char* s = doc_->at(it.element_) + 1;
+                    const char* e = doc_->at(it.element_ + 1);
+                    if (std::memchr(s, '\\', e - s) ? string_at(it.element_) == key
+                                                    : key.size() == static_cast<size_t>(e - s) && std::memcmp(s, key.data(), key.size()) == 0)
+                        return it.element_;
+                }
+                return none;
+            }
+
+            std::string string_at(uint32_t token) const
+            {
+                const char* s = doc_->at(token) + 1;
+                const char* e = doc_->at(token + 1);
+                std::string ret(e - s, '\0');
+                ret.resize(detail::unescape(s, e, &ret[0]) - &ret[0]);
+                return ret;
+            }
+
+            const char* number_start() const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Number)
+                    throw std::runtime_error("value is not number");
+#endif
+                return doc_->at(token_);
+            }
+
+            static const char* number_end(const char* start)
+            {
+                return detail::scan_number(const_cast<char*>(start));
+            }
+
+            template <typename T>
+            T number() const
+            {
+                const char* start = number_start();
+                T value;
+                if (crow_json_likely(detail::number::parse_integer(start, number_end(start), value)))
+                    return value;
+                return boost::lexical_cast<T>(start, number_end(start) - start);
+            }
+
+            const lazy_document* doc_{nullptr};
+            uint32_t token_{0};
+            uint32_t key_{none};
+        };
+
+        inline lazy_value lazy_document::root() const
+        {
+            if (!valid_)
+                throw std::runtime_error("invalid json object");
+            return lazy_value(this, 0);
+        }
+
+        inline lazy_value lazy_document::operator[](const std::string& key) const
+        {
+            return root()[key];
+        }
+
+        inline lazy_value lazy_document::operator[](size_t index) const
+        {
+            return root()[index];
+        }
+
+        /// Memory the containers of arena backed \ref wvalue "wvalues" are allocated from, and freed with all at once.
+
+        ///
+        /// Allocating only moves a pointer forward in the current block, a new block is added when it's full.
+        class arena
+        {
+        public:
+            explicit arena(size_t block_size = 16384)
+                : block_size_(block_size)
+            {
+            }
+
+            arena(const arena&) = delete;
+            arena& operator = (const arena&) = delete;
+
+            void* allocate(size_t size, size_t align)
+            {
+                uintptr_t p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+                if (!cur_ || p + size > reinterpret_cast<uintptr_t>(end_))
+                {
+                    // blocks get larger as the arena is used, up to 1 MiB
+                    size_t block = std::max(block_size_, size + align);
+                    blocks_.emplace_back(new char[block]);
+                    allocated_ += block;
+                    cur_ = blocks_.back().get();
+                    end_ = cur_ + block;
+                    if (block_size_ < (1 << 20))
+                        block_size_ *= 2;
+                    p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+                }
+                cur_ = reinterpret_cast<char*>(p + size);
+                return reinterpret_cast<void*>(p);
+            }
+
+            /// The number of bytes taken from the system.
+            size_t allocated() const
+            {
+                return allocated_;
+            }
+
+        private:
+            std::vector<std::unique_ptr<char[]>> blocks_;
+            char* cur_{nullptr};
+            char* end_{nullptr};
+            size_t block_size_;
+            size_t allocated_{0};
+        };
+
+        /// JSON write value.
+
+        ///
+        /// Value can mean any json value, including a JSON object.
+        /// Write means this class is used to primarily assemble JSON objects using keys and values and export those into a string.
+        class wvalue : public returnable
+        {
+            friend class crow::mustache::template_t;
+            friend class writer;
+        public:
+            type t() const { return t_; }
+        private:
+            struct arena_key
+            {
+                const char* data;
+                uint32_t size;
+            };
+
+            /// The elements of an arena backed list or the members of an arena backed object, allocated in the arena.
+            struct arena_storage
+            {
+                arena* owner;
+                wvalue* values;
+                arena_key* keys; ///< The keys of an object.
+                uint32_t* index; ///< A hash index of \ref keys, built for large objects.
+                uint32_t size;
+                uint32_t capacity;
+            };
+
+            /// What \ref num holds for a value that isn't a number.
+            enum class arena_ref : char
+            {
+                None,    ///< Nothing, the value isn't arena backed.
+                Arena,   ///< The arena the lists and objects the value becomes are stored in.
+                Storage, ///< The value is a list or an object stored in an arena.
+            };
+
+            type t_{type::Null}; ///< The type of the value.
+            num_type nt{num_type::Null}; ///< The specific type of the number if \ref t_ is a number.
+            arena_ref ref_{arena_ref::None};
+            bool owns_arena_{false}; ///< Whether the arena is deleted with the value, set on the value that created it.
+            union {
+              double d;
+              int64_t si;
+              uint64_t ui {};
+              arena* a;
+              arena_storage* storage;
+            } num; ///< Value if type is a number, otherwise what \ref ref_ says.
+            std::string s; ///< Value if type is a string.
+            std::unique_ptr<std::vector<wvalue>> l; ///< Value if type is a list.
+#ifdef CROW_JSON_USE_MAP
+            std::unique_ptr<std::map<std::string, wvalue>> o;
+#else
+            std::unique_ptr<std::unordered_map<std::string, wvalue>> o; ///< Value if type is a JSON object.
+#endif
+
+            /// Constructs the values stored in an arena, which don't need a content type.
+            struct child_tag {};
+
+            wvalue(child_tag, arena* a) : returnable("")
+            {
+                num.a = a;
+                ref_ = arena_ref::Arena;
+            }
+
+            wvalue(child_tag, arena* a, wvalue&& r) : wvalue(child_tag{}, a)
+            {
+                *this = std::move(r);
+            }
+
+            wvalue(child_tag, arena* a, const wvalue& r) : wvalue(child_tag{}, a)
+            {
+                copy_from(r);
+            }
+
+        public:
+
+            wvalue() : returnable("application/json") {}
+
+            /// A null value whose lists and objects (and theirs) will keep their elements in insertion order in `a`, which has to outlive it.
+            explicit wvalue(arena& a) : returnable("application/json")
+            {
+                num.a = &a;
+                ref_ = arena_ref::Arena;
+            }
+
+            /// An empty object backed by a new arena, with room for `n` members.
+            static wvalue arena_object(size_t n = 0)
+            {
+                wvalue ret;
+                ret.own_arena();
+                ret.become(type::Object);
+                ret.reserve(n);
+                return ret;
+            }
+
+            /// An empty list backed by a new arena, with room for `n` elements.
+            static wvalue arena_list(size_t n = 0)
+            {
+                wvalue ret;
+                ret.own_arena();
+                ret.become(type::List);
+                ret.reserve(n);
+                return ret;
+            }
+
+            ~wvalue()
+            {
+                destroy_arena_storage();
+                drop_arena();
+            }
+
+            wvalue(std::vector<wvalue>& r) : returnable("application/json")
+            {
+                t_ = type::List;
+                l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                l->reserve(r.size());
+                for(auto it = r.begin(); it != r.end(); ++it)
+                    l->emplace_back(*it);
+            }
+
+            /// Create a write value from a read value (useful for editing JSON strings).
+            wvalue(const rvalue& r) : returnable("application/json")
+            {
+                t_ = r.t();
+                switch(r.t())
+                {
+                    case type::Null:
+                    case type::False:
+                    case type::True:
+                        return;
+                    case type::Number:
+                        nt = r.nt();
+                        if (nt == num_type::Floating_point)
+                          num.d = r.d();
+                        else if (nt == num_type::Signed_integer)
+                          num.si = r.i();
+                        else
+                          num.ui = r.u();
+                        return;
+                    case type::String:
+                        s = r.s();
+                        return;
+                    case type::List:
+                        l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                        l->reserve(r.size());
+                        for(auto it = r.begin(); it != r.end(); ++it)
+                            l->emplace_back(*it);
+                        return;
+                    case type::Object:
+#ifdef CROW_JSON_USE_MAP
+                        o = std::unique_ptr<std::map<std::string, wvalue>>(new std::map<std::string, wvalue>{});
+#else
+                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
+#endif
+                        for(auto it = r.begin(); it != r.end(); ++it)
+                            o->emplace(it->key(), *it);
+                        return;
+                }
+            }
+
+            wvalue(const wvalue& r) : returnable("application/json")
+            {
+                copy_from(r);
+            }
+
+            wvalue(wvalue&& r) : returnable("application/json")
+            {
+                *this = std::move(r);
+            }
+
+            wvalue& operator = (wvalue&& r)
+            {
+                if (this == &r)
+                    return *this;
+                reset();
+                arena* mine = get_arena();
+                if (r.ref_ == arena_ref::Storage && !r.owns_arena_ && r.num.storage->owner != mine)
+                {
+                    // the lists and objects of another arena, which may be gone before this value, are copied
+                    copy_from(r);
+                    return *this;
+                }
+                t_ = r.t_;
+                nt = r.nt;
+                s = std::move(r.s);
+                l = std::move(r.l);
+                o = std::move(r.o);
+                if (r.ref_ == arena_ref::Storage || r.owns_arena_)
+                {
+                    arena* theirs = r.get_arena();
+                    if (theirs != mine)
+                        drop_arena();
+                    num = r.num;
+                    ref_ = r.ref_;
+                    owns_arena_ = owns_arena_ || r.owns_arena_;
+                    r.t_ = type::Null;
+                    r.num.a = theirs;
+                    r.ref_ = r.owns_arena_ ? arena_ref::None : arena_ref::Arena;
+                    r.owns_arena_ = false;
+                }
+                else if (t_ == type::Number)
+                {
+                    drop_arena();
+                    num = r.num;
+                }
+                // other values keep the arena for the lists and objects they may become
+                return *this;
+            }
+
+            /// Used for compatibility, same as \ref reset()
+            void clear()
+            {
+                reset();
+            }
+
+            void reset()
+            {
+                t_ = type::Null;
+                l.reset();
+                o.reset();
+                destroy_arena_storage();
+            }
+
+            wvalue& operator = (std::nullptr_t)
+            {
+                reset();
+                return *this;
+            }
+            wvalue& operator = (bool value)
+            {
+                reset();
+                if (value)
+                    t_ = type::True;
+                else
+                    t_ = type::False;
+                return *this;
+            }
+
+            wvalue& operator = (double value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.d = value;
+                nt = num_type::Floating_point;
+                return *this;
+            }
+
+            wvalue& operator = (unsigned short value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator = (short value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator = (long long value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator = (long value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator = (int value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator = (unsigned long long value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator = (unsigned long value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator = (unsigned int value)
+            {
+                reset();
+                drop_arena();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator=(const char* str)
+            {
+                reset();
+                t_ = type::String;
+                s = str;
+                return *this;
+            }
+
+            wvalue& operator=(const std::string& str)
+            {
+                reset();
+                t_ = type::String;
+                s = str;
+                return *this;
+            }
+
+            wvalue& operator=(std::vector<wvalue>&& v)
+            {
+                if (get_arena())
+                {
+                    reset();
+                    become(type::List);
+                    reserve(v.size());
+                    for (auto& x : v)
+                        append() = std::move(x);
+                    return *this;
+                }
+                if (t_ != type::List)
+                    reset();
+                t_ = type::List;
+                if (!l)
+                    l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                l->clear();
+                l->resize(v.size());
+                size_t idx = 0;
+                for(auto& x:v)
+                {
+                    (*l)[idx++] = std::move(x);
+                }
+                return *this;
+            }
+
+            template <typename T>
+            wvalue& operator=(const std::vector<T>& v)
+            {
+                if (get_arena())
+                {
+                    reset();
+                    become(type::List);
+                    reserve(v.size());
+                    for (auto& x : v)
+                        append() = x;
+                    return *this;
+                }
+                if (t_ != type::List)
+                    reset();
+                t_ = type::List;
+                if (!l)
+                    l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                l->clear();
+                l->resize(v.size());
+                size_t idx = 0;
+                for(auto& x:v)
+                {
+                    (*l)[idx++] = x;
+                }
+                return *this;
+            }
+
+            wvalue& operator[](unsigned index)
+            {
+                become(type::List);
+                if (ref_ == arena_ref::Storage)
+                {
+                    while (num.storage->size <= index)
+                        append();
+                    return num.storage->values[index];
+                }
+                if (!l)
+                    l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                if (l->size() < index+1)
+                    l->resize(index+1);
+                return (*l)[index];
+            }
+
+            int count(const std::string& str)
+            {
+                if (t_ != type::Object)
+                    return 0;
+                if (ref_ == arena_ref::Storage)
+                    return find(str) ? 1 : 0;
+                if (!o)
+                    return 0;
+                return o->count(str);
+            }
+
+            wvalue& operator[](const std::string& str)
+            {
+                become(type::Object);
+                if (ref_ == arena_ref::Storage)
+                {
+                    if (auto v = find(str))
+                        return *v;
+                    return append(str);
+                }
+                if (!o)
+#ifdef CROW_JSON_USE_MAP
+                        o = std::unique_ptr<std::map<std::string, wvalue>>(new std::map<std::string, wvalue>{});
+#else
+                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
+#endif
+                return (*o)[str];
+            }
+
+            /// Add an element at the end of the list (turning the value into a list), without going through the indices.
+            wvalue& append()
+            {
+                become(type::List);
+                if (ref_ != arena_ref::Storage)
+                {
+                    if (!l)
+                        l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                    l->emplace_back();
+                    return l->back();
+                }
+                arena_storage& st = *num.storage;
+                if (st.size == st.capacity)
+                    grow(st.capacity ? 2 * st.capacity : 4);
+                new (&st.values[st.size]) wvalue(child_tag{}, st.owner);
+                return st.values[st.size++];
+            }
+
+            /// Add a member at the end of the object (turning the value into an object).
+
+            ///
+            /// An arena backed object doesn't check whether the key already exists, making this O(1).
+            wvalue& append(const std::string& key)
+            {
+                become(type::Object);
+                if (ref_ != arena_ref::Storage)
+                    return (*this)[key];
+                arena_storage& st = *num.storage;
+                if (st.size == st.capacity)
+                    grow(st.capacity ? 2 * st.capacity : 4);
+                char* data = static_cast<char*>(st.owner->allocate(key.size(), 1));
+                std::memcpy(data, key.data(), key.size());
+                st.keys[st.size] = arena_key{data, static_cast<uint32_t>(key.size())};
+                new (&st.values[st.size]) wvalue(child_tag{}, st.owner);
+                if (st.index)
+                    index_insert(st.size);
+                return st.values[st.size++];
+            }
+
+            /// Make room for `n` elements or members in a list or an object.
+            void reserve(size_t n)
+            {
+                if (t_ != type::List && t_ != type::Object)
+                    return;
+                if (ref_ == arena_ref::Storage)
+                {
+                    if (n > num.storage->capacity)
+                        grow(static_cast<uint32_t>(n));
+                }
+                else if (t_ == type::List)
+                {
+                    if (!l)
+                        l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                    l->reserve(n);
+                }
+#ifndef CROW_JSON_USE_MAP
+                else
+                {
+                    if (!o)
+                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
+                    o->reserve(n);
+                }
+#endif
+            }
+
+            std::vector<std::string> keys() const 
+            {
+                if (t_ != type::Object) 
+                    return {};
+                std::vector<std::string> result;
+                if (ref_ == arena_ref::Storage)
+                {
+                    const arena_storage& st = *num.storage;
+                    result.reserve(st.size);
+                    for (uint32_t i = 0; i < st.size; i++)
+                        result.emplace_back(st.keys[i].data, st.keys[i].size);
+                    return result;
+                }
+                if (!o)
+                    return result;
+                for (auto& kv:*o) 
+                {
+                    result.push_back(kv.first);
+                }
+                return result;
+            }
+
+            /// If the wvalue is a list, it returns the length of the list, otherwise it returns 1.
+            std::size_t size() const
+            {
+                if (t_ != type::List)
+                    return 1;
+                if (ref_ == arena_ref::Storage)
+                    return num.storage->size;
+                return l ? l->size() : 0;
+            }
+
+            /// Returns an estimated size of the value in bytes.
+            size_t estimate_length() const
+            {
+                switch(t_)
+                {
+                    case type::Null: return 4;
+                    case type::False: return 5;
+                    case type::True: return 4;
+                    case type::Number: return 30;
+                    case type::String: return 2+s.size()+s.size()/2;
+                    case type::List: 
+                        {
+                            size_t sum{};
+                            for (uint32_t i = 0; i < arena_size(); i++)
+                                sum += 1 + num.storage->values[i].estimate_length();
+                            if (l)
+                            {
+                                for(auto& x:*l)
+                                {
+                                    sum += 1;
+                                    sum += x.estimate_length();
+                                }
+                            }
+                            return sum+2;
+                        }
+                    case type::Object:
+                        {
+                            size_t sum{};
+                            for (uint32_t i = 0; i < arena_size(); i++)
+                                sum += 4 + num.storage->keys[i].size + num.storage->keys[i].size/2 + num.storage->values[i].estimate_length();
+                            if (o)
+                            {
+                                for(auto& kv:*o)
+                                {
+                                    sum += 2;
+                                    sum += 2+kv.first.size()+kv.first.size()/2;
+                                    sum += kv.second.estimate_length();
+                                }
+                            }
+                            return sum+2;
+                        }
+                }
+                return 1;
+            }
+
+        private:
+
+            void copy_from(const wvalue& r)
+            {
+                t_ = r.t();
+                switch(r.t())
+                {
+                    case type::Null:
+                    case type::False:
+                    case type::True:
+                        return;
+                    case type::Number:
+                        drop_arena();
+                        nt = r.nt;
+                        if (nt == num_type::Floating_point)
+                          num.d = r.num.d;
+                        else if (nt == num_type::Signed_integer)
+                          num.si = r.num.si;
+                        else
+                          num.ui = r.num.ui;
+                        return;
+                    case type::String:
+                        s = r.s;
+                        return;
+                    case type::List:
+                        if (r.ref_ == arena_ref::Storage)
+                        {
+                            copy_arena_storage(r);
+                            return;
+                        }
+                        l = std::unique_ptr<std::vector<wvalue>>(new std::vector<wvalue>{});
+                        l->reserve(r.size());
+                        for(auto it = r.l->begin(); it != r.l->end(); ++it)
+                            l->emplace_back(*it);
+                        return;
+                    case type::Object:
+                        if (r.ref_ == arena_ref::Storage)
+                        {
+                            copy_arena_storage(r);
+                            return;
+                        }
+#ifdef CROW_JSON_USE_MAP
+                        o = std::unique_ptr<std::map<std::string, wvalue>>(new std::map<std::string, wvalue>{});
+#else
+                        o = std::unique_ptr<std::unordered_map<std::string, wvalue>>(new std::unordered_map<std::string, wvalue>{});
+#endif
+                        o->insert(r.o->begin(), r.o->end());
+                        return;
+                }
+            }
+
+            /// Copy an arena backed list or object into the arena of this value, or a new one it owns.
+            void copy_arena_storage(const wvalue& r)
+            {
+                const arena_storage& from = *r.num.storage;
+                t_ = type::Null;
+                if (!get_arena())
+                    own_arena();
+                become(r.t_);
+                if (from.size)
+                    grow(from.size);
+                arena_storage& st = *num.storage;
+                for (uint32_t i = 0; i < from.size; i++)
+                {
+                    if (t_ == type::Object)
+                    {
+                        // the keys are never modified, a copy in the same arena can share them
+                        st.keys[i] = from.keys[i];
+                        if (st.owner != from.owner)
+                        {
+                            char* data = static_cast<char*>(st.owner->allocate(from.keys[i].size, 1));
+                            std::memcpy(data, from.keys[i].data, from.keys[i].size);
+                            st.keys[i].data = data;
+                        }
+                    }
+                    new (&st.values[i]) wvalue(child_tag{}, st.owner, from.values[i]);
+                }
+                st.size = from.size;
+            }
+
+            /// The arena the lists and objects of the value are stored in, nullptr if it isn't arena backed.
+            arena* get_arena() const
+            {
+                if (ref_ == arena_ref::Storage)
+                    return num.storage->owner;
+                return ref_ == arena_ref::Arena ? num.a : nullptr;
+            }
+
+            /// The number of elements or members stored in the arena.
+            uint32_t arena_size() const
+            {
+                return ref_ == arena_ref::Storage ? num.storage->size : 0;
+            }
+
+            /// Back the value with a new arena that's deleted with it.
+            void own_arena()
+            {
+                num.a = new arena();
+                ref_ = arena_ref::Arena;
+                owns_arena_ = true;
+            }
+
+            /// Stop using the arena (deleting it if the value owns it), for a value that needs \ref num for a number.
+            void drop_arena()
+            {
+                if (owns_arena_)
+                    delete get_arena();
+                ref_ = arena_ref::None;
+                owns_arena_ = false;
+            }
+
+            /// Turn the value into an empty list or object unless it's one already, stored in the arena if it has one.
+            void become(type t)
+            {
+                if (t_ == t)
+                    return;
+                reset();
+                t_ = t;
+                if (ref_ == arena_ref::Arena)
+                {
+                    arena* a = num.a;
+                    num.storage = static_cast<arena_storage*>(a->allocate(sizeof(arena_storage), alignof(arena_storage)));
+                    *num.storage = arena_storage{a, nullptr, nullptr, nullptr, 0, 0};
+                    ref_ = arena_ref::Storage;
+                }
+            }
+
+            void destroy_arena_storage()
+            {
+                if (ref_ != arena_ref::Storage)
+                    return;
+                arena_storage& st = *num.storage;
+                for (uint32_t i = 0; i < st.size; i++)
+                    st.values[i].~wvalue();
+                // the memory goes back with the arena
+                num.a = st.owner;
+                ref_ = arena_ref::Arena;
+            }
+
+            /// Move the arena storage to a larger allocation.
+            void grow(uint32_t capacity)
+            {
+                arena_storage& st = *num.storage;
+                wvalue* values = static_cast<wvalue*>(st.owner->allocate(capacity * sizeof(wvalue), alignof(wvalue)));
+                for (uint32_t i = 0; i < st.size; i++)
+                {
+                    new (&values[i]) wvalue(child_tag{}, st.owner, std::move(st.values[i]));
+                    st.values[i].~wvalue();
+                }
+                st.values = values;
+                if (t_ == type::Object)
+                {
+                    arena_key* keys = static_cast<arena_key*>(st.owner->allocate(capacity * sizeof(arena_key), alignof(arena_key)));
+                    if (st.size)
+                        std::memcpy(keys, st.keys, st.size * sizeof(arena_key));
+                    st.keys = keys;
+                }
+                st.capacity = capacity;
+                if (st.index)
+                    build_index();
+            }
+
+            /// The number of slots of the index, a power of two at least twice the capacity.
+            size_t index_capacity() const
+            {
+                size_t n = 16;
+                while (n < 2 * static_cast<size_t>(num.storage->capacity))
+                    n *= 2;
+                return n;
+            }
+
+            void index_insert(uint32_t position)
+            {
+                arena_storage& st = *num.storage;
+                size_t mask = index_capacity() - 1;
+                size_t slot = detail::hash_key(st.keys[position].data, st.keys[position].size) & mask;
+                while (st.index[slot])
+                    slot = (slot + 1) & mask;
+                st.index[slot] = position + 1;
+            }
+
+            void build_index()
+            {
+                arena_storage& st = *num.storage;
+                size_t capacity = index_capacity();
+                st.index = static_cast<uint32_t*>(st.owner->allocate(capacity * sizeof(uint32_t), alignof(uint32_t)));
+                std::memset(st.index, 0, capacity * sizeof(uint32_t));
+                for (uint32_t i = 0; i < st.size; i++)
+                    index_insert(i);
+            }
+
+            /// The value of the first member with the key in an arena backed object, nullptr if there's none.
+            wvalue* find(const std::string& key)
+            {
+                arena_storage& st = *num.storage;
+                auto matches = [&st, &key](uint32_t i) {
+                    return st.keys[i].size == key.size() && std::memcmp(st.keys[i].data, key.data(), key.size()) == 0;
+                };
+                if (st.size < CROW_JSON_KEY_INDEX_THRESHOLD)
+                {
+                    for (uint32_t i = 0; i < st.size; i++)
+                        if (matches(i))
+                            return &st.values[i];
+                    return nullptr;
+                }
+                if (!st.index)
+                    build_index();
+                size_t mask = index_capacity() - 1;
+                for (size_t slot = detail::hash_key(key.data(), key.size()) & mask; st.index[slot]; slot = (slot + 1) & mask)
+                {
+                    if (matches(st.index[slot] - 1))
+                        return &st.values[st.index[slot] - 1];
+                }
+                return nullptr;
+            }
+
+            inline void dump_string(const std::string& str, std::string& out) const
+            {
+                out.push_back('"');
+                escape(str, out);
+                out.push_back('"');
+            }
+
+            inline void dump_internal(const wvalue& v, std::string& out) const
+            {
+                switch(v.t_)
                 {
                     case type::Null: out += "null"; break;
                     case type::False: out += "false"; break;
                     case type::True: out += "true"; break;
                     case type::Number:
                         {
+                            char outbuf[detail::number::max_length];
+                            char* end;
                             if (v.nt == num_type::Floating_point)
                             {
-    #ifdef _MSC_VER
-    #define MSC_COMPATIBLE_SPRINTF(BUFFER_PTR, FORMAT_PTR, VALUE) sprintf_s((BUFFER_PTR), 128, (FORMAT_PTR), (VALUE))
-    #else
-    #define MSC_COMPATIBLE_SPRINTF(BUFFER_PTR, FORMAT_PTR, VALUE) sprintf((BUFFER_PTR), (FORMAT_PTR), (VALUE))
-    #endif
-                                char outbuf[128];
-                                MSC_COMPATIBLE_SPRINTF(outbuf, "%g", v.num.d);
-                                out += outbuf;
-    #undef MSC_COMPATIBLE_SPRINTF
+                                end = detail::number::write_double(outbuf, v.num.d);
                             }
                             else if (v.nt == num_type::Signed_integer)
                             {
-                                out += std::to_string(v.num.si);
+                                end = detail::number::write_integer(outbuf, v.num.si);
                             }
                             else
                             {
-                                out += std::to_string(v.num.ui);
+                                end = detail::number::write_integer(outbuf, v.num.ui);
                             }
+                            out.append(outbuf, end);
                         }
                         break;
                     case type::String: dump_string(v.s, out); break;
                     case type::List:
                          {
                              out.push_back('[');
+                             for (uint32_t i = 0; i < v.arena_size(); i++)
+                             {
+                                 if (i)
+                                     out.push_back(',');
+                                 dump_internal(v.num.storage->values[i], out);
+                             }
                              if (v.l)
                              {
                                  bool first = true;
@@ -1667,6 +3449,16 @@ namespace crow
                     case type::Object:
                          {
                              out.push_back('{');
+                             for (uint32_t i = 0; i < v.arena_size(); i++)
+                             {
+                                 if (i)
+                                     out.push_back(',');
+                                 out.push_back('"');
+                                 escape(v.num.storage->keys[i].data, v.num.storage->keys[i].size, out);
+                                 out.push_back('"');
+                                 out.push_back(':');
+                                 dump_internal(v.num.storage->values[i], out);
+                             }
                              if (v.o)
                              {
                                  bool first = true;
@@ -1688,6 +3480,180 @@ namespace crow
                 }
             }
 
+            static void put_big_endian(uint64_t n, int bytes, std::string& out)
+            {
+                for (int shift = 8 * (bytes - 1); shift >= 0; shift -= 8)
+                    out.push_back(static_cast<char>(n >> shift));
+            }
+
+            static void put_marked(char marker, uint64_t n, int bytes, std::string& out)
+            {
+                out.push_back(marker);
+                put_big_endian(n, bytes, out);
+            }
+
+            /// Write a float when it holds the same value, otherwise a double, after the marker of each.
+            static void put_float(double d, char float_marker, char double_marker, std::string& out)
+            {
+                float f = static_cast<float>(d);
+                if (f == d || d != d)
+                {
+                    uint32_t bits;
+                    std::memcpy(&bits, &f, sizeof(bits));
+                    put_marked(float_marker, bits, 4, out);
+                }
+                else
+                {
+                    uint64_t bits;
+                    std::memcpy(&bits, &d, sizeof(bits));
+                    put_marked(double_marker, bits, 8, out);
+                }
+            }
+
+            static void put_msgpack_unsigned(uint64_t n, std::string& out)
+            {
+                if (n < 0x80)
+                    out.push_back(static_cast<char>(n));
+                else if (n <= 0xff)
+                    put_marked('\xcc', n, 1, out);
+                else if (n <= 0xffff)
+                    put_marked('\xcd', n, 2, out);
+                else if (n <= 0xffffffff)
+                    put_marked('\xce', n, 4, out);
+                else
+                    put_marked('\xcf', n, 8, out);
+            }
+
+            /// The header of a MessagePack string, list or object: the short form's marker and the markers with 8, 16 and 32 bit sizes.
+            static void put_msgpack_size(size_t n, uint8_t fixed, size_t fixed_limit, const char* markers, std::string& out)
+            {
+                if (n < fixed_limit)
+                    out.push_back(static_cast<char>(fixed | n));
+                else if (n <= 0xff && markers[0])
+                    put_marked(markers[0], n, 1, out);
+                else if (n <= 0xffff)
+                    put_marked(markers[1], n, 2, out);
+                else
+                    put_marked(markers[2], n, 4, out);
+            }
+
+            static void put_msgpack_string(const char* data, size_t size, std::string& out)
+            {
+                put_msgpack_size(size, 0xa0, 32, "\xd9\xda\xdb", out);
+                out.append(data, size);
+            }
+
+            static void encode_msgpack(const wvalue& v, std::string& out)
+            {
+                switch (v.t_)
+                {
+                    case type::Null: out.push_back('\xc0'); break;
+                    case type::False: out.push_back('\xc2'); break;
+                    case type::True: out.push_back('\xc3'); break;
+                    case type::Number:
+                        if (v.nt == num_type::Floating_point)
+                            put_float(v.num.d, '\xca', '\xcb', out);
+                        else if (v.nt == num_type::Unsigned_integer || v.num.si >= 0)
+                            put_msgpack_unsigned(v.num.ui, out);
+                        else if (v.num.si >= -32)
+                            out.push_back(static_cast<char>(v.num.si));
+                        else if (v.num.si >= INT8_MIN)
+                            put_marked('\xd0', static_cast<uint64_t>(v.num.si), 1, out);
+                        else if (v.num.si >= INT16_MIN)
+                            put_marked('\xd1', static_cast<uint64_t>(v.num.si), 2, out);
+                        else if (v.num.si >= INT32_MIN)
+                            put_marked('\xd2', static_cast<uint64_t>(v.num.si), 4, out);
+                        else
+                            put_marked('\xd3', static_cast<uint64_t>(v.num.si), 8, out);
+                        break;
+                    case type::String: put_msgpack_string(v.s.data(), v.s.size(), out); break;
+                    case type::List:
+                        put_msgpack_size(v.arena_size() + (v.l ? v.l->size() : 0), 0x90, 16, "\0\xdc\xdd", out);
+                        for (uint32_t i = 0; i < v.arena_size(); i++)
+                            encode_msgpack(v.num.storage->values[i], out);
+                        if (v.l)
+                            for (auto& x : *v.l)
+                                encode_msgpack(x, out);
+                        break;
+                    case type::Object:
+                        put_msgpack_size(v.arena_size() + (v.o ? v.o->size() : 0), 0x80, 16, "\0\xde\xdf", out);
+                        for (uint32_t i = 0; i < v.arena_size(); i++)
+                        {
+                            put_msgpack_string(v.num.storage->keys[i].data, v.num.storage->keys[i].size, out);
+                            encode_msgpack(v.num.storage->values[i], out);
+                        }
+                        if (v.o)
+                            for (auto& kv : *v.o)
+                            {
+                                put_msgpack_string(kv.first.data(), kv.first.size(), out);
+                                encode_msgpack(kv.second, out);
+                            }
+                        break;
+                }
+            }
+
+            /// The head of a CBOR item: its major type and a count or value.
+            static void put_cbor_head(uint8_t major, uint64_t n, std::string& out)
+            {
+                major <<= 5;
+                if (n < 24)
+                    out.push_back(static_cast<char>(major | n));
+                else if (n <= 0xff)
+                    put_marked(static_cast<char>(major | 24), n, 1, out);
+                else if (n <= 0xffff)
+                    put_marked(static_cast<char>(major | 25), n, 2, out);
+                else if (n <= 0xffffffff)
+                    put_marked(static_cast<char>(major | 26), n, 4, out);
+                else
+                    put_marked(static_cast<char>(major | 27), n, 8, out);
+            }
+
+            static void encode_cbor(const wvalue& v, std::string& out)
+            {
+                switch (v.t_)
+                {
+                    case type::Null: out.push_back('\xf6'); break;
+                    case type::False: out.push_back('\xf4'); break;
+                    case type::True: out.push_back('\xf5'); break;
+                    case type::Number:
+                        if (v.nt == num_type::Floating_point)
+                            put_float(v.num.d, '\xfa', '\xfb', out);
+                        else if (v.nt == num_type::Unsigned_integer || v.num.si >= 0)
+                            put_cbor_head(0, v.num.ui, out);
+                        else
+                            put_cbor_head(1, static_cast<uint64_t>(-(v.num.si + 1)), out);
+                        break;
+                    case type::String:
+                        put_cbor_head(3, v.s.size(), out);
+                        out += v.s;
+                        break;
+                    case type::List:
+                        put_cbor_head(4, v.arena_size() + (v.l ? v.l->size() : 0), out);
+                        for (uint32_t i = 0; i < v.arena_size(); i++)
+                            encode_cbor(v.num.storage->values[i], out);
+                        if (v.l)
+                            for (auto& x : *v.l)
+                                encode_cbor(x, out);
+                        break;
+                    case type::Object:
+                        put_cbor_head(5, v.arena_size() + (v.o ? v.o->size() : 0), out);
+                        for (uint32_t i = 0; i < v.arena_size(); i++)
+                        {
+                            put_cbor_head(3, v.num.storage->keys[i].size, out);
+                            out.append(v.num.storage->keys[i].data, v.num.storage->keys[i].size);
+                            encode_cbor(v.num.storage->values[i], out);
+                        }
+                        if (v.o)
+                            for (auto& kv : *v.o)
+                            {
+                                put_cbor_head(3, kv.first.size(), out);
+                                out += kv.first;
+                                encode_cbor(kv.second, out);
+                            }
+                        break;
+                }
+            }
+
         public:
             std::string dump() const
             {
@@ -1697,13 +3663,665 @@ namespace crow
                 return ret;
             }
 
+            /// Write the value as JSON text, MessagePack or CBOR.
+            std::string dump(encoding e) const
+            {
+                if (e == encoding::Json)
+                    return dump();
+                std::string ret;
+                ret.reserve(estimate_length());
+                if (e == encoding::MessagePack)
+                    encode_msgpack(*this, ret);
+                else
+                    encode_cbor(*this, ret);
+                return ret;
+            }
+
+        };
+
+
+
+        /// Writes a JSON document piece by piece, without assembling a \ref wvalue first.
+
+        ///
+        /// The text is collected in a buffer that's handed to the sink whenever it gets larger than the chunk size (and on \ref flush()),
+        /// so documents of any size can be written with bounded memory, for example into a streamed \ref crow::response body.<br>
+        /// Calls that would make the document invalid throw a `std::runtime_error`.
+        class writer
+        {
+        public:
+            using sink_type = std::function<void(const char* data, size_t size)>;
+
+            explicit writer(sink_type sink, size_t chunk_size = 16384)
+                : sink_(std::move(sink)), chunk_size_(chunk_size)
+            {
+                buffer_.reserve(chunk_size_ + detail::number::max_length);
+            }
+
+            /// Keep the whole document in the buffer, to be taken with \ref release().
+            writer()
+                : chunk_size_(std::numeric_limits<size_t>::max())
+            {
+            }
+
+            writer(const writer&) = delete;
+            writer& operator = (const writer&) = delete;
+
+            ~writer()
+            {
+                try
+                {
+                    flush();
+                }
+                catch (...)
+                {
+                }
+            }
+
+            writer& begin_object()
+            {
+                before_value();
+                buffer_.push_back('{');
+                open('{');
+                return *this;
+            }
+
+            writer& end_object()
+            {
+                if (open_.empty() || open_.back() != '{' || after_key_)
+                    throw std::runtime_error("json::writer: no object to end");
+                close('}');
+                return *this;
+            }
+
+            writer& begin_array()
+            {
+                before_value();
+                buffer_.push_back('[');
+                open('[');
+                return *this;
+            }
+
+            writer& end_array()
+            {
+                if (open_.empty() || open_.back() != '[')
+                    throw std::runtime_error("json::writer: no array to end");
+                close(']');
+                return *this;
+            }
+
+            /// The key of the next value, in an object.
+            writer& key(const std::string& name)
+            {
+                if (open_.empty() || open_.back() != '{' || after_key_)
+                    throw std::runtime_error("json::writer: a key needs to be followed by a value in an object");
+                if (need_comma_)
+                    buffer_.push_back(',');
+                buffer_.push_back('"');
+                escape(name, buffer_);
+                buffer_ += "\":";
+                after_key_ = true;
+                return *this;
+            }
+
+            writer& value(std::nullptr_t)
+            {
+                before_value();
+                buffer_ += "null";
+                after_value();
+                return *this;
+            }
+
+            writer& value(bool b)
+            {
+                before_value();
+                buffer_ += b ? "true" : "false";
+                after_value();
+                return *this;
+            }
+
+            template <typename T>
+            typename std::enable_if<std::is_integral<T>::value, writer&>::type value(T n)
+            {
+                before_value();
+                char outbuf[detail::number::max_length];
+                char* end;
+                if (std::is_signed<T>::value)
+                    end = detail::number::write_integer(outbuf, static_cast<int64_t>(n));
+                else
+                    end = detail::number::write_integer(outbuf, static_cast<uint64_t>(n));
+                buffer_.append(outbuf, end);
+                after_value();
+                return *this;
+            }
+
+            writer& value(double d)
+            {
+                before_value();
+                char outbuf[detail::number::max_length];
+                buffer_.append(outbuf, detail::number::write_double(outbuf, d));
+                after_value();
+                return *this;
+            }
+
+            writer& value(const std::string& str)
+            {
+                before_value();
+                buffer_.push_back('"');
+                escape(str, buffer_);
+                buffer_.push_back('"');
+                after_value();
+                return *this;
+            }
+
+            writer& value(const char* str)
+            {
+                return value(std::string(str));
+            }
+
+            /// Write a whole \ref wvalue as the next value.
+            writer& value(const wvalue& v)
+            {
+                before_value();
+                v.dump_internal(v, buffer_);
+                after_value();
+                return *this;
+            }
+
+            /// Hand everything written so far to the sink.
+            void flush()
+            {
+                if (!buffer_.empty() && sink_)
+                {
+                    sink_(buffer_.data(), buffer_.size());
+                    buffer_.clear();
+                }
+            }
+
+            /// Whether a whole top level value has been written.
+            bool done() const
+            {
+                return done_;
+            }
+
+            /// Take the text that hasn't been handed to a sink.
+            std::string release()
+            {
+                std::string ret;
+                ret.swap(buffer_);
+                return ret;
+            }
+
+        private:
+            void before_value()
+            {
+                if (open_.empty())
+                {
+                    if (done_)
+                        throw std::runtime_error("json::writer: a document has a single top level value");
+                }
+                else if (open_.back() == '{')
+                {
+                    if (!after_key_)
+                        throw std::runtime_error("json::writer: a value in an object needs a key");
+                    after_key_ = false;
+                }
+                else if (need_comma_)
+                    buffer_.push_back(',');
+            }
+
+            void after_value()
+            {
+                need_comma_ = true;
+                if (open_.empty())
+                    done_ = true;
+                if (buffer_.size() >= chunk_size_)
+                    flush();
+            }
+
+            void open(char c)
+            {
+                open_.push_back(c);
+                need_comma_ = false;
+            }
+
+            void close(char c)
+            {
+                open_.pop_back();
+                buffer_.push_back(c);
+                after_value();
+            }
+
+            sink_type sink_;
+            size_t chunk_size_;
+            std::string buffer_;
+            std::string open_; ///< The brackets of the containers that are still open.
+            bool need_comma_{false};
+            bool after_key_{false};
+            bool done_{false};
         };
 
+        namespace detail
+        {
+            /// Reads MessagePack or CBOR into an \ref rvalue.
+
+            ///
+            /// An \ref rvalue points into text, so the input is read twice: once to check it and measure the text its strings and numbers take,
+            /// then again to write that text (laid out like \ref load lays out a parsed document) into a buffer owned by the root value and build the values over it.
+            class binary_reader
+            {
+                static const int max_depth = 1024;
+
+            public:
+                binary_reader(const char* data, size_t size, encoding e)
+                    : data_(reinterpret_cast<const uint8_t*>(data)), size_(size), encoding_(e)
+                {
+                }
+
+                rvalue read()
+                {
+                    rvalue root;
+                    if (!value(root, 0) || pos_ != size_)
+                        return {};
+                    std::unique_ptr<char[]> buffer(new char[text_size_ + 1]);
+                    text_ = buffer.get();
+                    text_size_ = 0;
+                    pos_ = 0;
+                    building_ = true;
+                    value(root, 0);
+                    root.key_.force(buffer.release(), static_cast<uint32_t>(text_ - buffer.get()));
+                    return root;
+                }
+
+            private:
+                bool has(uint64_t n) const
+                {
+                    return n <= size_ - pos_;
+                }
+
+                uint64_t big_endian(int bytes)
+                {
+                    uint64_t n = 0;
+                    for (int i = 0; i < bytes; i++)
+                        n = (n << 8) | data_[pos_++];
+                    return n;
+                }
+
+                bool value(rvalue& out, int depth)
+                {
+                    if (depth > max_depth || !has(1))
+                        return false;
+                    return encoding_ == encoding::MessagePack ? msgpack_value(out, depth) : cbor_value(out, depth);
+                }
+
+                bool msgpack_value(rvalue& out, int depth)
+                {
+                    uint8_t c = data_[pos_++];
+                    if (c <= 0x7f)
+                        return number(out, static_cast<uint64_t>(c));
+                    if (c >= 0xe0)
+                        return number(out, static_cast<int64_t>(static_cast<int8_t>(c)));
+                    if (c <= 0x8f)
+                        return container(out, type::Object, c & 0xf, depth);
+                    if (c <= 0x9f)
+                        return container(out, type::List, c & 0xf, depth);
+                    if (c <= 0xbf)
+                        return string(out, c & 0x1f);
+                    switch (c)
+                    {
+                        case 0xc0: return literal(out, type::Null);
+                        case 0xc2: return literal(out, type::False);
+                        case 0xc3: return literal(out, type::True);
+                        case 0xc4: case 0xd9: return has(1) && string(out, big_endian(1));
+                        case 0xc5: case 0xda: return has(2) && string(out, big_endian(2));
+                        case 0xc6: case 0xdb: return has(4) && string(out, big_endian(4));
+                        case 0xca: return has(4) && floating(out, big_endian(4), 4);
+                        case 0xcb: return has(8) && floating(out, big_endian(8), 8);
+                        case 0xcc: return has(1) && number(out, big_endian(1));
+                        case 0xcd: return has(2) && number(out, big_endian(2));
+                        case 0xce: return has(4) && number(out, big_endian(4));
+                        case 0xcf: return has(8) && number(out, big_endian(8));
+                        case 0xd0: return has(1) && number(out, static_cast<int64_t>(static_cast<int8_t>(big_endian(1))));
+                        case 0xd1: return has(2) && number(out, static_cast<int64_t>(static_cast<int16_t>(big_endian(2))));
+                        case 0xd2: return has(4) && number(out, static_cast<int64_t>(static_cast<int32_t>(big_endian(4))));
+                        case 0xd3: return has(8) && number(out, static_cast<int64_t>(big_endian(8)));
+                        case 0xdc: return has(2) && container(out, type::List, big_endian(2), depth);
+                        case 0xdd: return has(4) && container(out, type::List, big_endian(4), depth);
+                        case 0xde: return has(2) && container(out, type::Object, big_endian(2), depth);
+                        case 0xdf: return has(4) && container(out, type::Object, big_endian(4), depth);
+                        default: return false; // extension types and the unused marker
+                    }
+                }
+
+                /// The argument of a CBOR item head, false for the indefinite length or a reserved value.
+                bool cbor_argument(uint8_t info, uint64_t& n)
+                {
+                    if (info < 24)
+                        n = info;
+                    else if (info <= 27 && has(1 << (info - 24)))
+                        n = big_endian(1 << (info - 24));
+                    else
+                        return false;
+                    return true;
+                }
+
+                bool cbor_value(rvalue& out, int depth)
+                {
+                    uint8_t c = data_[pos_++];
+                    uint8_t major = c >> 5, info = c & 0x1f;
+                    uint64_t n = 0;
+                    if (info == 31)
+                    {
+                        if (major == 2 || major == 3)
+                            return cbor_chunked_string(out, major);
+                        if (major == 4 || major == 5)
+                            return container(out, major == 4 ? type::List : type::Object, UINT64_MAX, depth);
+                        return false;
+                    }
+                    if (major == 7)
+                    {
+                        switch (info)
+                        {
+                            case 20: return literal(out, type::False);
+                            case 21: return literal(out, type::True);
+                            case 22: case 23: return literal(out, type::Null); // null and undefined
+                            case 25: return has(2) && floating(out, big_endian(2), 2);
+                            case 26: return has(4) && floating(out, big_endian(4), 4);
+                            case 27: return has(8) && floating(out, big_endian(8), 8);
+                            default: return false;
+                        }
+                    }
+                    if (!cbor_argument(info, n))
+                        return false;
+                    switch (major)
+                    {
+                        case 0: return number(out, n);
+                        case 1: return n <= INT64_MAX && number(out, -1 - static_cast<int64_t>(n));
+                        case 2: case 3: return string(out, n);
+                        case 4: return container(out, type::List, n, depth);
+                        case 5: return container(out, type::Object, n, depth);
+                        default: return value(out, depth + 1); // a tag, the value it tags is read as is
+                    }
+                }
+
+                /// A string sent in chunks, put together.
+                bool cbor_chunked_string(rvalue& out, uint8_t major)
+                {
+                    size_t start = text_size_;
+                    if (building_)
+                        *text_++ = 0;
+                    text_size_++;
+                    while (has(1) && data_[pos_] != 0xff)
+                    {
+                        uint8_t c = data_[pos_++];
+                        uint64_t n;
+                        if (c >> 5 != major || !cbor_argument(c & 0x1f, n) || !has(n))
+                            return false;
+                        if (building_)
+                        {
+                            std::memcpy(text_, data_ + pos_, n);
+                            text_ += n;
+                        }
+                        text_size_ += n;
+                        pos_ += n;
+                    }
+                    if (!has(1))
+                        return false;
+                    pos_++;
+                    if (building_)
+                    {
+                        *text_ = 0;
+                        out = rvalue(type::String, text_ - (text_size_ - start - 1), text_);
+                        text_++;
+                    }
+                    text_size_++;
+                    last_was_string_ = true;
+                    return true;
+                }
+
+                /// `count` is UINT64_MAX for a CBOR list or object that ends with a break.
+                bool container(rvalue& out, type t, uint64_t count, int depth)
+                {
+                    if (building_)
+                    {
+                        out = rvalue(t);
+                        // the elements are read in place when their number is known
+                        if (count != UINT64_MAX && count)
+                        {
+                            out.lremain_ = static_cast<uint16_t>(std::min<uint64_t>(count, UINT16_MAX));
+                            out.l_.reset(new rvalue[out.lremain_]);
+                        }
+                    }
+                    for (uint64_t i = 0; i < count; i++)
+                    {
+                        if (count == UINT64_MAX)
+                        {
+                            if (!has(1))
+                                return false;
+                            if (data_[pos_] == 0xff)
+                            {
+                                pos_++;
+                                break;
+                            }
+                        }
+                        rvalue element;
+                        rvalue& target = building_ && out.lremain_ ? out.l_[out.lsize_] : element;
+                        if (t == type::Object)
+                        {
+                            rvalue key;
+                            if (!value(key, depth + 1) || !last_was_string_ || !value(target, depth + 1))
+                                return false;
+                            if (building_)
+                            {
+                                target.key_.s_ = key.start_;
+                                target.key_.e_ = key.end_;
+                            }
+                        }
+                        else if (!value(target, depth + 1))
+                            return false;
+                        if (&target != &element)
+                        {
+                            out.lsize_++;
+                            out.lremain_--;
+                        }
+                        else if (building_)
+                            out.emplace_back(std::move(element));
+                    }
+                    last_was_string_ = false;
+                    return true;
+                }
+
+                bool string(rvalue& out, uint64_t size)
+                {
+                    if (!has(size))
+                        return false;
+                    if (building_)
+                    {
+                        *text_++ = 0;
+                        std::memcpy(text_, data_ + pos_, size);
+                        out = rvalue(type::String, text_, text_ + size);
+                        text_ += size;
+                        *text_++ = 0;
+                    }
+                    text_size_ += size + 2;
+                    pos_ += size;
+                    last_was_string_ = true;
+                    return true;
+                }
+
+                bool literal(rvalue& out, type t)
+                {
+                    if (building_)
+                        out = rvalue(t);
+                    last_was_string_ = false;
+                    return true;
+                }
+
+                template <typename T>
+                bool number(rvalue& out, T n)
+                {
+                    if (!building_)
+                        return measure_number();
+                    char text[number::max_length];
+                    return add_number(out, text, number::write_integer(text, n));
+                }
+
+                /// Numbers are only written the second time, room is made for the longest one.
+                bool measure_number()
+                {
+                    text_size_ += number::max_length + 3;
+                    last_was_string_ = false;
+                    return true;
+                }
+
+                /// A half, single or double precision float, from its bits.
+                bool floating(rvalue& out, uint64_t bits, int bytes)
+                {
+                    double d;
+                    if (bytes == 2)
+                    {
+                        int exponent = (bits >> 10) & 0x1f;
+                        double mantissa = static_cast<double>(bits & 0x3ff);
+                        if (exponent == 0)
+                            d = std::ldexp(mantissa, -24);
+                        else if (exponent != 31)
+                            d = std::ldexp(mantissa + 1024, exponent - 25);
+                        else
+                            d = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+                        if (bits & 0x8000)
+                            d = -d;
+                    }
+                    else if (bytes == 4)
+                    {
+                        uint32_t b = static_cast<uint32_t>(bits);
+                        float f;
+                        std::memcpy(&f, &b, sizeof(f));
+                        d = f;
+                    }
+                    else
+                        std::memcpy(&d, &bits, sizeof(d));
+
+                    // JSON has no NaN or infinities, they read as null like they're written
+                    if (d != d || d == std::numeric_limits<double>::infinity() || d == -std::numeric_limits<double>::infinity())
+                        return literal(out, type::Null);
+                    if (!building_)
+                        return measure_number();
+                    char text[number::max_length + 2];
+                    char* end = number::write_double(text, d);
+                    // keep it a floating point number when it's written without a fraction or exponent
+                    if (std::find_if(text, end, [](char c) { return c == '.' || c == 'e' || c == 'E'; }) == end)
+                    {
+                        *end++ = '.';
+                        *end++ = '0';
+                    }
+                    return add_number(out, text, end);
+                }
+
+                bool add_number(rvalue& out, const char* text, const char* end)
+                {
+                    size_t size = end - text;
+                    if (building_)
+                    {
+                        std::memcpy(text_, text, size);
+                        out = rvalue(type::Number, text_, text_ + size);
+                        text_ += size;
+                        *text_++ = 0;
+                    }
+                    text_size_ += size + 1;
+                    last_was_string_ = false;
+                    return true;
+                }
+
+                const uint8_t* data_;
+                size_t size_;
+                size_t pos_{0};
+                encoding encoding_;
+                bool building_{false}; ///< Whether this is the second time the input is read.
+                bool last_was_string_{false}; ///< Whether the last value read was a string, to check the keys of objects.
+                size_t text_size_{0};
+                char* text_{nullptr};
+            };
+        }
+
+        /// Read MessagePack or CBOR (or JSON text) into an \ref rvalue, an error value if the input isn't valid.
+
+        ///
+        /// Binary strings read as strings, tags are ignored and extension types aren't supported.
+        /// The keys of objects have to be strings.
+        inline rvalue load(const char* data, size_t size, encoding e)
+        {
+            if (e == encoding::Json)
+                return load(data, size);
+            return detail::binary_reader(data, size, e).read();
+        }
+
+        inline rvalue load(const std::string& str, encoding e)
+        {
+            return load(str.data(), str.size(), e);
+        }
 
+        inline const char* content_type(encoding e)
+        {
+            switch (e)
+            {
+                case encoding::MessagePack: return "application/msgpack";
+                case encoding::Cbor: return "application/cbor";
+                default: return "application/json";
+            }
+        }
+
+        /// The encoding of a body with this content type, false if it's neither JSON, MessagePack nor CBOR.
+        inline bool encoding_of(const std::string& content_type, encoding& e)
+        {
+            std::string media = content_type.substr(0, content_type.find(';'));
+            boost::trim(media);
+            if (boost::iequals(media, "application/json"))
+                e = encoding::Json;
+            else if (boost::iequals(media, "application/msgpack") || boost::iequals(media, "application/x-msgpack") || boost::iequals(media, "application/vnd.msgpack"))
+                e = encoding::MessagePack;
+            else if (boost::iequals(media, "application/cbor"))
+                e = encoding::Cbor;
+            else
+                return false;
+            return true;
+        }
 
-        //std::vector<boost::asio::const_buffer> dump_ref(wvalue& v)
-        //{
-        //}
+        /// The encoding an `Accept` header prefers, JSON unless it ranks MessagePack or CBOR higher.
+        inline encoding negotiate(const std::string& accept)
+        {
+            encoding best = encoding::Json;
+            double best_quality = -1;
+            size_t start = 0;
+            while (start < accept.size())
+            {
+                size_t end = std::min(accept.find(',', start), accept.size());
+                std::string range = accept.substr(start, end - start);
+                start = end + 1;
+
+                double quality = 1;
+                size_t q = range.find(";q=");
+                if (q == std::string::npos)
+                    q = range.find("; q=");
+                if (q != std::string::npos)
+                    quality = std::atof(range.c_str() + range.find('=', q) + 1);
+
+                encoding e;
+                std::string media = range.substr(0, range.find(';'));
+                boost::trim(media);
+                if (!encoding_of(media, e))
+                {
+                    if (media != "*/*" && !boost::iequals(media, "application/*"))
+                        continue;
+                    e = encoding::Json;
+                }
+                if (quality > 0 && quality > best_quality)
+                {
+                    best = e;
+                    best_quality = quality;
+                }
+            }
+            return best;
+        }
     }
 }
 
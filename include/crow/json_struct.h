@@ -0,0 +1,279 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "crow/json.h"
+
+/// Write and read the listed members of `Type` as the members of a JSON object.
+
+///
+/// Use it at namespace scope, in the namespace of `Type`, with up to 32 members:
+/// `CROW_JSON_STRUCT(point, x, y)`.<br>
+/// The members can be of any type \ref crow::json::traits handles, including other types declared with this macro.
+/// When reading, the members missing from the JSON object keep their value and the keys that aren't members are ignored.
+#define CROW_JSON_STRUCT(Type, ...)                                                                           \
+    inline void crow_json_write(::crow::json::writer& w, const Type& value)                                  \
+    {                                                                                                        \
+        w.begin_object();                                                                                    \
+        CROW_JSON_EXPAND(CROW_JSON_FOR_EACH(CROW_JSON_WRITE_MEMBER, __VA_ARGS__))                            \
+        w.end_object();                                                                                      \
+    }                                                                                                        \
+    inline void crow_json_read(const ::crow::json::lazy_value& json, Type& value)                            \
+    {                                                                                                        \
+        if (json.t() != ::crow::json::type::Object)                                                          \
+            throw std::runtime_error("value is not an object");                                              \
+        for (auto member : json)                                                                             \
+        {                                                                                                    \
+            const std::string key = member.key();                                                            \
+            CROW_JSON_EXPAND(CROW_JSON_FOR_EACH(CROW_JSON_READ_MEMBER, __VA_ARGS__))                         \
+            {}                                                                                               \
+        }                                                                                                    \
+    }
+
+#define CROW_JSON_WRITE_MEMBER(name)                                      \
+    ::crow::json::traits<decltype(value.name)>::write(w.key(#name), value.name);
+#define CROW_JSON_READ_MEMBER(name)                                       \
+    if (key == #name)                                                     \
+        ::crow::json::traits<decltype(value.name)>::read(member, value.name); \
+    else
+
+#define CROW_JSON_EXPAND(x) x
+#define CROW_JSON_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, name, ...) name
+#define CROW_JSON_FOR_EACH(action, ...) \
+    CROW_JSON_EXPAND(CROW_JSON_SELECT(__VA_ARGS__, CROW_JSON_FOR_EACH_32, CROW_JSON_FOR_EACH_31, CROW_JSON_FOR_EACH_30, CROW_JSON_FOR_EACH_29, CROW_JSON_FOR_EACH_28, CROW_JSON_FOR_EACH_27, CROW_JSON_FOR_EACH_26, CROW_JSON_FOR_EACH_25, CROW_JSON_FOR_EACH_24, CROW_JSON_FOR_EACH_23, CROW_JSON_FOR_EACH_22, CROW_JSON_FOR_EACH_21, CROW_JSON_FOR_EACH_20, CROW_JSON_FOR_EACH_19, CROW_JSON_FOR_EACH_18, CROW_JSON_FOR_EACH_17, CROW_JSON_FOR_EACH_16, CROW_JSON_FOR_EACH_15, CROW_JSON_FOR_EACH_14, CROW_JSON_FOR_EACH_13, CROW_JSON_FOR_EACH_12, CROW_JSON_FOR_EACH_11, CROW_JSON_FOR_EACH_10, CROW_JSON_FOR_EACH_9, CROW_JSON_FOR_EACH_8, CROW_JSON_FOR_EACH_7, CROW_JSON_FOR_EACH_6, CROW_JSON_FOR_EACH_5, CROW_JSON_FOR_EACH_4, CROW_JSON_FOR_EACH_3, CROW_JSON_FOR_EACH_2, CROW_JSON_FOR_EACH_1)(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_1(action, x) action(x)
+#define CROW_JSON_FOR_EACH_2(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_1(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_3(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_2(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_4(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_3(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_5(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_4(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_6(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_5(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_7(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_6(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_8(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_7(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_9(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_8(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_10(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_9(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_11(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_10(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_12(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_11(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_13(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_12(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_14(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_13(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_15(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_14(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_16(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_15(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_17(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_16(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_18(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_17(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_19(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_18(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_20(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_19(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_21(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_20(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_22(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_21(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_23(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_22(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_24(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_23(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_25(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_24(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_26(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_25(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_27(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_26(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_28(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_27(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_29(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_28(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_30(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_29(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_31(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_30(action, __VA_ARGS__))
+#define CROW_JSON_FOR_EACH_32(action, x, ...) action(x) CROW_JSON_EXPAND(CROW_JSON_FOR_EACH_31(action, __VA_ARGS__))
+
+namespace crow
+{
+    namespace json
+    {
+        /// How values of type `T` are written to a \ref writer and read from a \ref lazy_value.
+
+        ///
+        /// By default this calls `crow_json_write(writer&, const T&)` and `crow_json_read(const lazy_value&, T&)`,
+        /// found in the namespace of `T`, which is what \ref CROW_JSON_STRUCT defines.<br>
+        /// Specialize it to handle other types.
+        template <typename T, typename Enable = void>
+        struct traits
+        {
+            static void write(writer& w, const T& value)
+            {
+                crow_json_write(w, value);
+            }
+
+            static void read(const lazy_value& json, T& value)
+            {
+                crow_json_read(json, value);
+            }
+        };
+
+        template <>
+        struct traits<bool>
+        {
+            static void write(writer& w, bool value)
+            {
+                w.value(value);
+            }
+
+            static void read(const lazy_value& json, bool& value)
+            {
+                value = json.b();
+            }
+        };
+
+        template <typename T>
+        struct traits<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+        {
+            static void write(writer& w, T value)
+            {
+                w.value(value);
+            }
+
+            static void read(const lazy_value& json, T& value)
+            {
+                if (std::is_signed<T>::value)
+                {
+                    int64_t n = json.i();
+                    if (n < static_cast<int64_t>(std::numeric_limits<T>::min()) || n > static_cast<int64_t>(std::numeric_limits<T>::max()))
+                        throw std::runtime_error("number out of range");
+                    value = static_cast<T>(n);
+                }
+                else
+                {
+                    uint64_t n = json.u();
+                    if (n > static_cast<uint64_t>(std::numeric_limits<T>::max()) || json.d() < 0)
+                        throw std::runtime_error("number out of range");
+                    value = static_cast<T>(n);
+                }
+            }
+        };
+
+        template <typename T>
+        struct traits<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+        {
+            static void write(writer& w, T value)
+            {
+                w.value(static_cast<double>(value));
+            }
+
+            static void read(const lazy_value& json, T& value)
+            {
+                value = static_cast<T>(json.d());
+            }
+        };
+
+        template <>
+        struct traits<std::string>
+        {
+            static void write(writer& w, const std::string& value)
+            {
+                w.value(value);
+            }
+
+            static void read(const lazy_value& json, std::string& value)
+            {
+                value = json.s();
+            }
+        };
+
+        template <typename T, typename Allocator>
+        struct traits<std::vector<T, Allocator>>
+        {
+            static void write(writer& w, const std::vector<T, Allocator>& value)
+            {
+                w.begin_array();
+                for (auto& element : value)
+                    traits<T>::write(w, element);
+                w.end_array();
+            }
+
+            static void read(const lazy_value& json, std::vector<T, Allocator>& value)
+            {
+                if (json.t() != type::List)
+                    throw std::runtime_error("value is not a list");
+                value.clear();
+                for (auto element : json)
+                {
+                    value.emplace_back();
+                    traits<T>::read(element, value.back());
+                }
+            }
+        };
+
+        namespace detail
+        {
+            /// Traits of maps with string keys, written as objects.
+            template <typename Map>
+            struct map_traits
+            {
+                static void write(writer& w, const Map& value)
+                {
+                    w.begin_object();
+                    for (auto& member : value)
+                        traits<typename Map::mapped_type>::write(w.key(member.first), member.second);
+                    w.end_object();
+                }
+
+                static void read(const lazy_value& json, Map& value)
+                {
+                    if (json.t() != type::Object)
+                        throw std::runtime_error("value is not an object");
+                    value.clear();
+                    for (auto member : json)
+                        traits<typename Map::mapped_type>::read(member, value[member.key()]);
+                }
+            };
+        }
+
+        template <typename T, typename Compare, typename Allocator>
+        struct traits<std::map<std::string, T, Compare, Allocator>> : detail::map_traits<std::map<std::string, T, Compare, Allocator>>
+        {};
+
+        template <typename T, typename Hash, typename Equal, typename Allocator>
+        struct traits<std::unordered_map<std::string, T, Hash, Equal, Allocator>> : detail::map_traits<std::unordered_map<std::string, T, Hash, Equal, Allocator>>
+        {};
+
+        /// Whether `T` was declared with \ref CROW_JSON_STRUCT (or has its own `crow_json_write`).
+        template <typename T>
+        struct is_reflected
+        {
+        private:
+            template <typename U>
+            static auto test(int) -> decltype(crow_json_write(std::declval<writer&>(), std::declval<const U&>()), std::true_type());
+            template <typename U>
+            static std::false_type test(...);
+
+        public:
+            static constexpr bool value = decltype(test<T>(0))::value;
+        };
+
+        /// Write `value` as JSON text, without building a \ref wvalue.
+        template <typename T>
+        std::string serialize(const T& value)
+        {
+            writer w;
+            traits<T>::write(w, value);
+            return w.release();
+        }
+
+        /// Read the JSON text into `value`, without building an \ref rvalue.
+
+        ///
+        /// \return false if the text isn't valid JSON or doesn't match the type of `value`, which may then be partially read.
+        template <typename T>
+        bool deserialize(std::string text, T& value)
+        {
+            lazy_document doc(std::move(text));
+            if (!doc)
+                return false;
+            try
+            {
+                traits<T>::read(doc.root(), value);
+            }
+            catch (const std::runtime_error&)
+            {
+                return false;
+            }
+            catch (const boost::bad_lexical_cast&)
+            {
+                return false;
+            }
+            return true;
+        }
+    }
+}
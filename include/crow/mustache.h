@@ -134,9 +134,16 @@ namespace crow
             void escape(const std::string& in, std::string& out)
             {
                 out.reserve(out.size() + in.size());
-                for(auto it = in.begin(); it != in.end(); ++it)
+                const char* p = in.data();
+                const char* end = p + in.size();
+                for (;;)
                 {
-                    switch(*it)
+                    size_t clean = json::detail::find_html_escape(p, end - p);
+                    out.append(p, clean);
+                    p += clean;
+                    if (p == end)
+                        break;
+                    switch(*p++)
                     {
                         case '&': out += "&amp;"; break;
                         case '<': out += "&lt;"; break;
@@ -144,7 +151,6 @@ namespace crow
                         case '"': out += "&quot;"; break;
                         case '\'': out += "&#39;"; break;
                         case '/': out += "&#x2F;"; break;
-                        default: out += *it; break;
                     }
                 }
             }
@@ -234,7 +240,7 @@ namespace crow
                                 switch(ctx.t())
                                 {
                                     case json::type::List:
-                                        if (ctx.l && !ctx.l->empty())
+                                        if (ctx.size())
                                             current = action.pos;
                                         else
                                             stack.emplace_back(&nullContext);
@@ -262,13 +268,12 @@ namespace crow
                                 switch(ctx.t())
                                 {
                                     case json::type::List:
-                                        if (ctx.l)
-                                            for(auto it = ctx.l->begin(); it != ctx.l->end(); ++it)
-                                            {
-                                                stack.push_back(&*it);
-                                                render_internal(current+1, action.pos, stack, out, indent);
-                                                stack.pop_back();
-                                            }
+                                        for(unsigned i = 0; i < ctx.size(); ++i)
+                                        {
+                                            stack.push_back(&ctx[i]);
+                                            render_internal(current+1, action.pos, stack, out, indent);
+                                            stack.pop_back();
+                                        }
                                         current = action.pos;
                                         break;
                                     case json::type::Number:
@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <boost/algorithm/string.hpp>
 #include <algorithm>
+#include <memory>
 
 #include "crow/http_parser_merged.h"
 #include "crow/http_request.h"
@@ -70,23 +71,26 @@ namespace crow
             {
                 self->headers.emplace(std::move(self->header_field), std::move(self->header_value));
             }
+
+            // url params
+            self->url = self->raw_url.substr(0, self->raw_url.find("?"));
+            self->url_params = query_string(self->raw_url);
+
             self->process_header();
             return 0;
         }
         static int on_body(http_parser* self_, const char* at, size_t length)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
-            self->body.insert(self->body.end(), at, at+length);
+            if (self->json_parser)
+                self->json_parser->feed(at, length);
+            else
+                self->body.insert(self->body.end(), at, at+length);
             return 0;
         }
         static int on_message_complete(http_parser* self_)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
-
-            // url params
-            self->url = self->raw_url.substr(0, self->raw_url.find("?"));
-            self->url_params = query_string(self->raw_url);
-
             self->process_message();
             return 0;
         }
@@ -112,7 +116,8 @@ namespace crow
             };
 
             int nparsed = http_parser_execute(this, &settings_, buffer, length);
-            return nparsed == length;
+            // a stopped parser ignores the rest on purpose
+            return nparsed == length || CROW_HTTP_PARSER_ERRNO(this) == HPE_PAUSED;
         }
 
         bool done()
@@ -130,6 +135,25 @@ namespace crow
             headers.clear();
             url_params.clear();
             body.clear();
+            json_parser.reset();
+            body_encoding = json::encoding::Json;
+            route = routing_handle_result();
+        }
+
+        /// Parse the body as JSON while it arrives (or once it's complete for MessagePack and CBOR), instead of leaving it in \ref body.
+        void parse_json_body(json::encoding e = json::encoding::Json)
+        {
+            body_encoding = e;
+            if (e != json::encoding::Json)
+                return;
+            // only a hint, announcing a huge body doesn't get it allocated up front
+            json_parser.reset(new json::incremental_parser((flags & F_CHUNKED) ? 0 : std::min<uint64_t>(content_length, 1 << 24)));
+        }
+
+        /// Stop parsing, whatever is fed afterwards is ignored.
+        void stop()
+        {
+            http_parser_pause(this, 1);
         }
 
         void process_header()
@@ -145,7 +169,15 @@ namespace crow
         /// Take the parsed HTTP request data and convert it to a \ref crow.request
         request to_request() const
         {
-            return request{static_cast<HTTPMethod>(method), std::move(raw_url), std::move(url), std::move(url_params), std::move(headers), std::move(body)};
+            request req{static_cast<HTTPMethod>(method), std::move(raw_url), std::move(url), std::move(url_params), std::move(headers), std::move(body)};
+            if (json_parser)
+                req.json_body = json_parser->finish();
+            else if (body_encoding != json::encoding::Json)
+            {
+                req.json_body = json::load(req.body, body_encoding);
+                req.body.clear();
+            }
+            return req;
         }
 
 		bool is_upgrade() const
@@ -158,6 +190,12 @@ namespace crow
             return http_major == major && http_minor == minor;
         }
 
+        /// Whether a body follows the headers, known once they're complete.
+        bool has_body() const
+        {
+            return (flags & F_CHUNKED) || (content_length != 0 && content_length != CROW_ULLONG_MAX);
+        }
+
         std::string raw_url;
         std::string url;
 
@@ -167,6 +205,9 @@ namespace crow
         ci_map headers;
         query_string url_params; ///< What comes after the `?` in the URL.
         std::string body;
+        std::unique_ptr<json::incremental_parser> json_parser; ///< Set when the body is parsed as JSON while it arrives.
+        json::encoding body_encoding{json::encoding::Json}; ///< Set to MessagePack or CBOR when the complete body is to be decoded.
+        routing_handle_result route; ///< The route found when the headers were complete.
 
         Handler* handler_; ///< This is currently an HTTP connection object (\ref crow.Connection).
     };
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+namespace crow
+{
+    namespace detail
+    {
+        /// Holds the current snapshot of an object, which can be replaced while other threads are reading it (RCU style).
+
+        ///
+        /// Readers never lock: they announce the epoch they started reading in and load the current pointer.<br>
+        /// Writers publish a complete new snapshot, and the old one is deleted once no reader that could have seen it is still reading.
+        /// Replaced snapshots are reclaimed when the next snapshot is published, or by the last reader that could still be using them.
+        template <typename T>
+        class rcu_ptr
+        {
+            struct reader
+            {
+                std::atomic<uint64_t> epoch{0}; ///< The epoch the thread started reading in, 0 when it isn't reading.
+                reader* next{nullptr};
+            };
+
+        public:
+            /// Keeps a snapshot alive while it exists.
+            class read_guard
+            {
+            public:
+                read_guard(rcu_ptr& owner)
+                    : owner_(&owner), reader_(owner.local_reader())
+                {
+                    // a nested read (e.g. a handler publishing routes) keeps the older epoch of the outer one
+                    nested_ = reader_->epoch.load(std::memory_order_relaxed) != 0;
+                    if (!nested_)
+                        reader_->epoch.store(owner.epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+                    ptr_ = owner.current_.load(std::memory_order_seq_cst);
+                }
+
+                read_guard(read_guard&& other)
+                    : owner_(other.owner_), reader_(other.reader_), ptr_(other.ptr_), nested_(other.nested_)
+                {
+                    other.owner_ = nullptr;
+                }
+
+                read_guard(const read_guard&) = delete;
+                read_guard& operator = (const read_guard&) = delete;
+
+                ~read_guard()
+                {
+                    if (!owner_ || nested_)
+                        return;
+                    reader_->epoch.store(0, std::memory_order_seq_cst);
+                    if (owner_->retired_count_.load(std::memory_order_relaxed))
+                        owner_->try_reclaim();
+                }
+
+                T* operator->() const { return ptr_; }
+                T& operator*() const { return *ptr_; }
+
+            private:
+                rcu_ptr* owner_;
+                reader* reader_;
+                T* ptr_;
+                bool nested_;
+            };
+
+            rcu_ptr(T* initial)
+                : id_(next_id()), current_(initial)
+            {
+            }
+
+            rcu_ptr(const rcu_ptr&) = delete;
+            rcu_ptr& operator = (const rcu_ptr&) = delete;
+
+            ~rcu_ptr()
+            {
+                delete current_.load();
+                for (auto& r : retired_)
+                    delete r.second;
+                for (reader* r = readers_.load(); r;)
+                {
+                    reader* next = r->next;
+                    delete r;
+                    r = next;
+                }
+            }
+
+            /// Start reading the current snapshot.
+            read_guard read()
+            {
+                return read_guard(*this);
+            }
+
+            /// Access the current snapshot without protection.
+
+            ///
+            /// Only safe while no snapshot can be published concurrently (e.g. before the server starts).
+            T* get() const
+            {
+                return current_.load(std::memory_order_acquire);
+            }
+
+            /// The lock serializing writers, to be held while building a snapshot from the current one.
+            std::mutex& write_mutex()
+            {
+                return write_mutex_;
+            }
+
+            /// Replace the current snapshot, the caller must hold \ref write_mutex().
+            void publish(std::unique_ptr<T> next)
+            {
+                T* old = current_.exchange(next.release(), std::memory_order_seq_cst);
+                uint64_t retire_epoch = epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+                {
+                    std::lock_guard<std::mutex> lock(reclaim_mutex_);
+                    retired_.emplace_back(retire_epoch, old);
+                    retired_count_.store(retired_.size(), std::memory_order_relaxed);
+                    reclaim();
+                }
+            }
+
+            /// The number of replaced snapshots that are still waiting for readers to finish.
+            size_t retired_count() const
+            {
+                return retired_count_.load(std::memory_order_relaxed);
+            }
+
+        private:
+            /// Reclaim what can be reclaimed, without ever blocking a reader.
+            void try_reclaim()
+            {
+                std::unique_lock<std::mutex> lock(reclaim_mutex_, std::try_to_lock);
+                if (lock.owns_lock())
+                    reclaim();
+            }
+
+            /// Delete every retired snapshot no active reader could have loaded, the caller must hold `reclaim_mutex_`.
+            void reclaim()
+            {
+                uint64_t oldest = UINT64_MAX;
+                for (reader* r = readers_.load(std::memory_order_seq_cst); r; r = r->next)
+                {
+                    uint64_t e = r->epoch.load(std::memory_order_seq_cst);
+                    if (e && e < oldest)
+                        oldest = e;
+                }
+
+                auto it = std::partition(retired_.begin(), retired_.end(), [oldest](const std::pair<uint64_t, T*>& r) { return r.first > oldest; });
+                for (auto i = it; i != retired_.end(); ++i)
+                    delete i->second;
+                retired_.erase(it, retired_.end());
+                retired_count_.store(retired_.size(), std::memory_order_relaxed);
+            }
+
+            /// The reader of this thread, owned by the rcu_ptr.
+
+            ///
+            /// Every thread keeps the readers it registered by rcu_ptr id (ids are never reused, so the entry of a destroyed one is never matched).
+            /// A thread reading an rcu_ptr for the first time pushes a new reader on the lock free list the writers go through.
+            reader* local_reader()
+            {
+                static thread_local std::unordered_map<uint64_t, reader*> local;
+                reader*& r = local[id_];
+                if (!r)
+                {
+                    r = new reader;
+                    r->next = readers_.load(std::memory_order_relaxed);
+                    while (!readers_.compare_exchange_weak(r->next, r, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        ;
+                }
+                return r;
+            }
+
+            static uint64_t next_id()
+            {
+                static std::atomic<uint64_t> id{0};
+                return ++id;
+            }
+
+            uint64_t id_;
+            std::atomic<T*> current_;
+            std::atomic<uint64_t> epoch_{1};
+            std::atomic<size_t> retired_count_{0};
+
+            std::mutex write_mutex_;
+            std::mutex reclaim_mutex_;
+            std::atomic<reader*> readers_{nullptr};
+            std::vector<std::pair<uint64_t, T*>> retired_;
+        };
+    }
+}
@@ -7,6 +7,11 @@
 #include <memory>
 #include <boost/lexical_cast.hpp>
 #include <vector>
+#include <list>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
 
 #include "crow/common.h"
 #include "crow/http_response.h"
@@ -106,64 +111,52 @@ namespace crow
                 response& res;
             };
 
-            template <typename F, int NInt, int NUint, int NDouble, int NString, typename S1, typename S2>
-            struct call
-            {
-            };
-
-            template <typename F, int NInt, int NUint, int NDouble, int NString, typename ... Args1, typename ... Args2>
-            struct call<F, NInt, NUint, NDouble, NString, black_magic::S<int64_t, Args1...>, black_magic::S<Args2...>>
+            /// Reads a parameter, string parameters are handed out as views of the request url.
+            template <typename T>
+            struct get_param
             {
-                void operator()(F cparams)
+                template <typename F>
+                static T get(F& cparams, unsigned pos)
                 {
-                    using pushed = typename black_magic::S<Args2...>::template push_back<call_pair<int64_t, NInt>>;
-                    call<F, NInt+1, NUint, NDouble, NString,
-                        black_magic::S<Args1...>, pushed>()(cparams);
+                    return cparams.params.template at<T>(pos);
                 }
             };
 
-            template <typename F, int NInt, int NUint, int NDouble, int NString, typename ... Args1, typename ... Args2>
-            struct call<F, NInt, NUint, NDouble, NString, black_magic::S<uint64_t, Args1...>, black_magic::S<Args2...>>
+            template <>
+            struct get_param<std::string>
             {
-                void operator()(F cparams)
+                template <typename F>
+                static detail::string_param get(F& cparams, unsigned pos)
                 {
-                    using pushed = typename black_magic::S<Args2...>::template push_back<call_pair<uint64_t, NUint>>;
-                    call<F, NInt, NUint+1, NDouble, NString,
-                        black_magic::S<Args1...>, pushed>()(cparams);
+                    return cparams.params.string_at(pos, cparams.req.url);
                 }
             };
 
-            template <typename F, int NInt, int NUint, int NDouble, int NString, typename ... Args1, typename ... Args2>
-            struct call<F, NInt, NUint, NDouble, NString, black_magic::S<double, Args1...>, black_magic::S<Args2...>>
+            template <typename F, int N, typename S1, typename S2>
+            struct call
             {
-                void operator()(F cparams)
-                {
-                    using pushed = typename black_magic::S<Args2...>::template push_back<call_pair<double, NDouble>>;
-                    call<F, NInt, NUint, NDouble+1, NString,
-                        black_magic::S<Args1...>, pushed>()(cparams);
-                }
             };
 
-            template <typename F, int NInt, int NUint, int NDouble, int NString, typename ... Args1, typename ... Args2>
-            struct call<F, NInt, NUint, NDouble, NString, black_magic::S<std::string, Args1...>, black_magic::S<Args2...>>
+            template <typename F, int N, typename Arg, typename ... Args1, typename ... Args2>
+            struct call<F, N, black_magic::S<Arg, Args1...>, black_magic::S<Args2...>>
             {
                 void operator()(F cparams)
                 {
-                    using pushed = typename black_magic::S<Args2...>::template push_back<call_pair<std::string, NString>>;
-                    call<F, NInt, NUint, NDouble, NString+1,
+                    using pushed = typename black_magic::S<Args2...>::template push_back<call_pair<Arg, N>>;
+                    call<F, N+1,
                         black_magic::S<Args1...>, pushed>()(cparams);
                 }
             };
 
-            template <typename F, int NInt, int NUint, int NDouble, int NString, typename ... Args1>
-            struct call<F, NInt, NUint, NDouble, NString, black_magic::S<>, black_magic::S<Args1...>>
+            template <typename F, int N, typename ... Args1>
+            struct call<F, N, black_magic::S<>, black_magic::S<Args1...>>
             {
                 void operator()(F cparams)
                 {
                     cparams.handler(
                         cparams.req,
                         cparams.res,
-                        cparams.params.template get<typename Args1::type>(Args1::pos)...
+                        get_param<typename Args1::type>::get(cparams, Args1::pos)...
                     );
                 }
             };
@@ -257,7 +250,7 @@ namespace crow
                     detail::routing_handler_call_helper::call<
                         detail::routing_handler_call_helper::call_params<
                             decltype(handler_)>,
-                        0, 0, 0, 0,
+                        0,
                         typename handler_type_helper<ArgsWrapped...>::args_type,
                         black_magic::S<>
                     >()(
@@ -391,12 +384,12 @@ namespace crow
 
         void handle_upgrade(const request& req, response&, SocketAdaptor&& adaptor) override
         {
-            new crow::websocket::Connection<SocketAdaptor>(req, std::move(adaptor), open_handler_, message_handler_, close_handler_, error_handler_, accept_handler_);
+            new crow::websocket::Connection<SocketAdaptor>(req, std::move(adaptor), open_handler_, message_handler_, close_handler_, error_handler_, accept_handler_, backpressure_handler_, chunk_handler_, settings_);
         }
 #ifdef CROW_ENABLE_SSL
         void handle_upgrade(const request& req, response&, SSLAdaptor&& adaptor) override
         {
-            new crow::websocket::Connection<SSLAdaptor>(req, std::move(adaptor), open_handler_, message_handler_, close_handler_, error_handler_, accept_handler_);
+            new crow::websocket::Connection<SSLAdaptor>(req, std::move(adaptor), open_handler_, message_handler_, close_handler_, error_handler_, accept_handler_, backpressure_handler_, chunk_handler_, settings_);
         }
 #endif
 
@@ -435,12 +428,94 @@ namespace crow
             return *this;
         }
 
+        /// Receive text and binary messages in pieces as they arrive, instead of whole in the message handler.
+
+        ///
+        /// The handler is called as `(connection, data, size, is_binary, is_last)`, the last call of each message having `is_last` set (and possibly no data).<br>
+        /// A compressed message comes in one piece, once inflated.
+        template <typename Func>
+        self_t& onchunk(Func f)
+        {
+            chunk_handler_ = f;
+            return *this;
+        }
+
+        /// Disconnect clients sending a text or binary message of more than `size` bytes, with status 1009.
+
+        ///
+        /// The limit is checked against the frame headers, before the payload is read.
+        self_t& max_message_size(uint64_t size)
+        {
+            settings_.max_message_size = size;
+            return *this;
+        }
+
+        /// Called with true when a connection's send queue reaches the high watermark, and with false once it drained to the low one.
+        template <typename Func>
+        self_t& onbackpressure(Func f)
+        {
+            backpressure_handler_ = f;
+            return *this;
+        }
+
+        /// Bound the send queue of each connection to `high_watermark` bytes.
+
+        ///
+        /// A text or binary message that would go over it is handled according to `policy` (blocking the sender, or dropping messages, or closing the connection).
+        /// The queue counts as full until it drained to `low_watermark` bytes.
+        self_t& send_queue(size_t high_watermark, size_t low_watermark, websocket::overflow policy = websocket::overflow::drop_newest)
+        {
+            settings_.send_high_watermark = high_watermark;
+            settings_.send_low_watermark = low_watermark;
+            settings_.send_overflow = policy;
+            return *this;
+        }
+
+        /// Ping each client every `interval`, and drop the connections that leave `max_missed_pongs` pings in a row unanswered.
+        self_t& keepalive(std::chrono::milliseconds interval, unsigned max_missed_pongs = 2)
+        {
+            settings_.ping_interval = interval;
+            settings_.max_missed_pongs = max_missed_pongs;
+            return *this;
+        }
+
+        /// Drop the connections that sent no text or binary message for `timeout`.
+        self_t& idle_timeout(std::chrono::milliseconds timeout)
+        {
+            settings_.idle_timeout = timeout;
+            return *this;
+        }
+
+        /// Drop the connections that didn't answer a close frame within `timeout` (5 seconds by default).
+        self_t& close_timeout(std::chrono::milliseconds timeout)
+        {
+            settings_.close_timeout = timeout;
+            return *this;
+        }
+
+#ifdef CROW_ENABLE_COMPRESSION
+        /// Compress messages with permessage-deflate for the clients offering it.
+
+        ///
+        /// `window_bits` (9 to 15) sets the largest window the server compresses with.
+        /// Without `context_takeover` each message is compressed on its own, which lets a message published on a channel be compressed once for all its subscribers.
+        self_t& permessage_deflate(int window_bits = 15, bool context_takeover = true)
+        {
+            settings_.deflate_window_bits = std::max(9, std::min(15, window_bits));
+            settings_.deflate_context_takeover = context_takeover;
+            return *this;
+        }
+#endif
+
     protected:
         std::function<void(crow::websocket::connection&)> open_handler_;
         std::function<void(crow::websocket::connection&, const std::string&, bool)> message_handler_;
         std::function<void(crow::websocket::connection&, const std::string&)> close_handler_;
         std::function<void(crow::websocket::connection&)> error_handler_;
         std::function<bool(const crow::request&)> accept_handler_;
+        std::function<void(crow::websocket::connection&, bool)> backpressure_handler_;
+        std::function<void(crow::websocket::connection&, const char*, size_t, bool, bool)> chunk_handler_;
+        websocket::settings settings_;
     };
 
     /// Allows the user to assign parameters using functions.
@@ -584,14 +659,15 @@ namespace crow
             static_assert(!std::is_same<void, decltype(f(std::declval<Args>()...))>::value,
                 "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
 
+            using views = takes_views<Func>;
             handler_ = (
 #ifdef CROW_CAN_USE_CPP14
                 [f = std::move(f)]
 #else
                 [f]
 #endif
-                (const request&, response& res, Args ... args){
-                    res = response(f(args...));
+                (const request&, response& res, typename detail::param_type<Args>::type ... args){
+                    res = response(f(static_cast<typename detail::handler_param<Args, views::value>::type>(args)...));
                     res.end();
                 });
         }
@@ -609,14 +685,15 @@ namespace crow
             static_assert(!std::is_same<void, decltype(f(std::declval<crow::request>(), std::declval<Args>()...))>::value,
                 "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
 
+            using views = takes_views<Func>;
             handler_ = (
 #ifdef CROW_CAN_USE_CPP14
                 [f = std::move(f)]
 #else
                 [f]
 #endif
-                (const crow::request& req, crow::response& res, Args ... args){
-                    res = response(f(req, args...));
+                (const crow::request& req, crow::response& res, typename detail::param_type<Args>::type ... args){
+                    res = response(f(req, static_cast<typename detail::handler_param<Args, views::value>::type>(args)...));
                     res.end();
                 });
         }
@@ -635,14 +712,15 @@ namespace crow
               "Handler type is mismatched with URL parameters");
           static_assert(std::is_same<void, decltype(f(std::declval<crow::response&>(), std::declval<Args>()...))>::value,
                         "Handler function with response argument should have void return type");
+          using views = takes_views<Func>;
           handler_ = (
 #ifdef CROW_CAN_USE_CPP14
                 [f = std::move(f)]
 #else
                 [f]
 #endif
-                (const crow::request&, crow::response& res, Args ... args){
-                  f(res, args...);
+                (const crow::request&, crow::response& res, typename detail::param_type<Args>::type ... args){
+                  f(res, static_cast<typename detail::handler_param<Args, views::value>::type>(args)...);
                 });
         }
 
@@ -662,7 +740,7 @@ namespace crow
             static_assert(std::is_same<void, decltype(f(std::declval<crow::request>(), std::declval<crow::response&>(), std::declval<Args>()...))>::value,
                 "Handler function with response argument should have void return type");
 
-                handler_ = std::move(f);
+            set_handler(std::move(f), takes_views<Func>());
         }
 
         template <typename Func>
@@ -677,7 +755,7 @@ namespace crow
             detail::routing_handler_call_helper::call<
                 detail::routing_handler_call_helper::call_params<
                     decltype(handler_)>,
-                0, 0, 0, 0,
+                0,
                 black_magic::S<Args...>,
                 black_magic::S<>
             >()(
@@ -688,7 +766,31 @@ namespace crow
         }
 
     private:
-        std::function<void(const crow::request&, crow::response&, Args...)> handler_;
+        /// Whether a handler gets string parameters as views of the url, it gets `std::string`s if it takes them as `auto`.
+        template <typename Func>
+        using takes_views = std::integral_constant<bool, !detail::is_generic_handler<typename std::decay<Func>::type>::value>;
+
+        template <typename Func>
+        void set_handler(Func&& f, std::true_type)
+        {
+            handler_ = std::move(f);
+        }
+
+        template <typename Func>
+        void set_handler(Func&& f, std::false_type)
+        {
+            handler_ = (
+#ifdef CROW_CAN_USE_CPP14
+                [f = std::move(f)]
+#else
+                [f]
+#endif
+                (const crow::request& req, crow::response& res, typename detail::param_type<Args>::type ... args){
+                    f(req, res, static_cast<typename detail::handler_param<Args, false>::type>(args)...);
+                });
+        }
+
+        std::function<void(const crow::request&, crow::response&, typename detail::param_type<Args>::type...)> handler_;
 
     };
 
@@ -850,10 +952,10 @@ namespace crow
                             long long int value = strtoll(req_url.data()+pos, &eptr, 10);
                             if (errno != ERANGE && eptr != req_url.data()+pos)
                             {
-                                params->int_params.push_back(value);
+                                params->push_int(value);
                                 auto ret = find(req_url, child, eptr - req_url.data(), params);
                                 update_found(ret);
-                                params->int_params.pop_back();
+                                params->pop();
                             }
                         }
                     }
@@ -868,10 +970,10 @@ namespace crow
                             unsigned long long int value = strtoull(req_url.data()+pos, &eptr, 10);
                             if (errno != ERANGE && eptr != req_url.data()+pos)
                             {
-                                params->uint_params.push_back(value);
+                                params->push_uint(value);
                                 auto ret = find(req_url, child, eptr - req_url.data(), params);
                                 update_found(ret);
-                                params->uint_params.pop_back();
+                                params->pop();
                             }
                         }
                     }
@@ -886,10 +988,10 @@ namespace crow
                             double value = strtod(req_url.data()+pos, &eptr);
                             if (errno != ERANGE && eptr != req_url.data()+pos)
                             {
-                                params->double_params.push_back(value);
+                                params->push_double(value);
                                 auto ret = find(req_url, child, eptr - req_url.data(), params);
                                 update_found(ret);
-                                params->double_params.pop_back();
+                                params->pop();
                             }
                         }
                     }
@@ -905,10 +1007,10 @@ namespace crow
 
                         if (epos != pos)
                         {
-                            params->string_params.push_back(req_url.substr(pos, epos-pos));
+                            params->push_string(pos, epos-pos);
                             auto ret = find(req_url, child, epos, params);
                             update_found(ret);
-                            params->string_params.pop_back();
+                            params->pop();
                         }
                     }
 
@@ -918,10 +1020,10 @@ namespace crow
 
                         if (epos != pos)
                         {
-                            params->string_params.push_back(req_url.substr(pos, epos-pos));
+                            params->push_string(pos, epos-pos);
                             auto ret = find(req_url, child, epos, params);
                             update_found(ret);
-                            params->string_params.pop_back();
+                            params->pop();
                         }
                     }
                 }
@@ -942,6 +1044,7 @@ namespace crow
         void add(const std::string& url, unsigned rule_index)
         {
             Node* idx = &head_;
+            unsigned param_count = 0;
 
             for(unsigned i = 0; i < url.size(); i ++)
             {
@@ -967,6 +1070,9 @@ namespace crow
                     {
                         if (url.compare(i, x.name.size(), x.name) == 0)
                         {
+                            if (++param_count > routing_params::max_params)
+                                throw std::runtime_error("too many parameters in " + url);
+
                             bool found = false;
                             for (Node* child : idx->children)
                             {
@@ -1050,12 +1156,165 @@ namespace crow
     };
 
 
+    namespace detail
+    {
+        /// A bounded cache of routing results for exact request URLs.
+
+        ///
+        /// Maps a method and URL to the rule index and parameters the trie found for them, evicting the least recently used entry when full.<br>
+        /// Every worker thread owns one, so only the counters need to be atomic (they can be read from any thread).
+        class route_cache
+        {
+        public:
+            using result_type = std::pair<unsigned, routing_params>;
+
+            struct stats
+            {
+                uint64_t hits{};
+                uint64_t misses{};
+                uint64_t evictions{};
+                size_t size{};
+            };
+
+            route_cache(size_t capacity)
+                : capacity_(capacity)
+            {
+            }
+
+            /// Find a cached result, returns `nullptr` on a miss.
+
+            ///
+            /// The cache is emptied first if the rules changed (`generation` differs from the one the entries were stored with).
+            const result_type* find(unsigned generation, int method, const std::string& url)
+            {
+                if (generation != generation_)
+                {
+                    clear();
+                    generation_ = generation;
+                }
+
+                auto& index = index_[method];
+                auto it = index.find(url);
+                if (it == index.end())
+                {
+                    misses_.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                lru_.splice(lru_.begin(), lru_, it->second);
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return &it->second->result;
+            }
+
+            void insert(int method, const std::string& url, const result_type& result)
+            {
+                if (!capacity_)
+                    return;
+                if (lru_.size() >= capacity_)
+                {
+                    auto& last = lru_.back();
+                    index_[last.method].erase(last.url);
+                    lru_.pop_back();
+                    evictions_.fetch_add(1, std::memory_order_relaxed);
+                }
+                lru_.push_front(entry{method, url, result});
+                index_[method].emplace(url, lru_.begin());
+                size_.store(lru_.size(), std::memory_order_relaxed);
+            }
+
+            void clear()
+            {
+                for (auto& index : index_)
+                    index.clear();
+                lru_.clear();
+                size_.store(0, std::memory_order_relaxed);
+            }
+
+            /// Add this cache's counters to `s`.
+            void collect(stats& s) const
+            {
+                s.hits += hits_.load(std::memory_order_relaxed);
+                s.misses += misses_.load(std::memory_order_relaxed);
+                s.evictions += evictions_.load(std::memory_order_relaxed);
+                s.size += size_.load(std::memory_order_relaxed);
+            }
+
+        private:
+            struct entry
+            {
+                int method;
+                std::string url;
+                result_type result;
+            };
+
+            size_t capacity_;
+            unsigned generation_{};
+            std::list<entry> lru_;
+            std::array<std::unordered_map<std::string, std::list<entry>::iterator>, static_cast<int>(HTTPMethod::InternalMethodCount)> index_;
+
+            std::atomic<uint64_t> hits_{0};
+            std::atomic<uint64_t> misses_{0};
+            std::atomic<uint64_t> evictions_{0};
+            std::atomic<size_t> size_{0};
+        };
+
+        /// The route caches of every worker thread, shared by a router and the routers cloned from it, so replacing the routes keeps them (and their counters).
+        struct route_cache_set
+        {
+            uint64_t id; ///< Never reused, a thread's cache for the set is found by it.
+            std::mutex mutex;
+            std::vector<std::unique_ptr<route_cache>> caches;
+        };
+    }
+
     /// Handles matching requests to existing rules and upgrade requests.
     class Router
     {
     public:
         Router()
+            : id_(next_id())
+        {
+        }
+
+        /// Create an unvalidated router with the same rules and settings, to be modified and published as a new snapshot.
+
+        ///
+        /// The rules themselves are shared between both routers.
+        std::unique_ptr<Router> clone() const
+        {
+            std::unique_ptr<Router> ret(new Router());
+            ret->catchall_rule_ = catchall_rule_;
+            ret->all_rules_ = all_rules_;
+            ret->route_cache_capacity_ = route_cache_capacity_;
+            // the caches carry over, and the new generation empties them of the old rule indexes
+            ret->route_caches_ = route_caches_;
+            ret->generation_ = generation_ + 1;
+            return ret;
+        }
+
+        /// Remove every rule registered for a URL, returns the number of rules removed.
+
+        ///
+        /// Only valid before `validate()` is called.
+        size_t remove_rule(const std::string& rule)
+        {
+            auto it = std::remove_if(all_rules_.begin(), all_rules_.end(), [&rule](const std::shared_ptr<BaseRule>& r) { return r && r->rule() == rule; });
+            size_t removed = all_rules_.end() - it;
+            all_rules_.erase(it, all_rules_.end());
+            return removed;
+        }
+
+        ///Create a dynamic route using a rule (**Use CROW_ROUTE instead**)
+        DynamicRule& route_dynamic(std::string&& rule)
+        {
+            return new_rule_dynamic(std::move(rule));
+        }
+
+        ///Create a route using a rule (**Use CROW_ROUTE instead**)
+        template <uint64_t Tag>
+        typename black_magic::arguments<Tag>::type::template rebind<TaggedRule>& route(std::string&& rule)
         {
+            return new_rule_tagged<Tag>(std::move(rule));
         }
 
         DynamicRule& new_rule_dynamic(const std::string& rule)
@@ -1125,6 +1384,27 @@ namespace crow
             {
                 per_method.trie.validate();
             }
+            generation_++;
+        }
+
+        /// Cache the routing results of up to `capacity` URLs in every worker thread (0 disables the cache).
+
+        ///
+        /// Must be called before the server starts.
+        void route_cache(size_t capacity)
+        {
+            route_cache_capacity_ = capacity;
+            generation_++;
+        }
+
+        /// Hit, miss and eviction counters summed over the route caches of all worker threads.
+        detail::route_cache::stats route_cache_stats()
+        {
+            detail::route_cache::stats ret;
+            std::lock_guard<std::mutex> lock(route_caches_->mutex);
+            for (auto& cache : route_caches_->caches)
+                cache->collect(ret);
+            return ret;
         }
 
         //TODO maybe add actual_method
@@ -1136,7 +1416,7 @@ namespace crow
 
             auto& per_method = per_methods_[static_cast<int>(req.method)];
             auto& rules = per_method.rules;
-            unsigned rule_index = per_method.trie.find(req.url).first;
+            unsigned rule_index = find(static_cast<int>(req.method), req.url).first;
 
             if (!rule_index)
             {
@@ -1201,8 +1481,54 @@ namespace crow
             }
         }
 
-        void handle(const request& req, response& res)
+        /// Find the rule for a request from its method and url, which is all that's known once its headers are parsed.
+
+        ///
+        /// `OPTIONS` requests aren't looked up, they're answered from all the rules when handled.
+        routing_handle_result resolve(HTTPMethod method, const std::string& url)
+        {
+            routing_handle_result result;
+            result.router_id = id_;
+            if (method >= HTTPMethod::InternalMethodCount || method == HTTPMethod::Options)
+                return result;
+
+            HTTPMethod method_actual = method == HTTPMethod::Head ? HTTPMethod::Get : method;
+            auto found = find(static_cast<int>(method_actual), url);
+            result.rule_index = found.first;
+            result.params = found.second;
+
+            if (!result.rule_index)
+            {
+                for (auto& per_method: per_methods_)
+                {
+                    if (per_method.trie.find(url).first)
+                    {
+                        result.reject_code = 405;
+                        return result;
+                    }
+                }
+                if (!catchall_rule_.has_handler())
+                    result.reject_code = 404;
+            }
+            return result;
+        }
+
+        void handle(const request& req, response& res, uint32_t other_methods = 0)
         {
+            routing_handle_result found = resolve(req.method, req.url);
+            handle(req, res, found, other_methods);
+        }
+
+        /// Handle a request with the rule \ref resolve found for it, looking it up again if the routes were replaced since.
+
+        ///
+        /// `other_methods` are the methods of routes outside the router (compiled routes) matching the url,
+        /// they're listed for `OPTIONS` and make a url the router doesn't know a 405 rather than a 404.
+        void handle(const request& req, response& res, routing_handle_result& found, uint32_t other_methods = 0)
+        {
+            if (found.router_id != id_)
+                found = resolve(req.method, req.url);
+
             HTTPMethod method_actual = req.method;
             if (req.method >= HTTPMethod::InternalMethodCount)
                 return;
@@ -1235,7 +1561,7 @@ namespace crow
                 {
                     for(int i = 0; i < static_cast<int>(HTTPMethod::InternalMethodCount); i ++)
                     {
-                        if (per_methods_[i].trie.find(req.url).first)
+                        if ((other_methods & (1 << i)) || per_methods_[i].trie.find(req.url).first)
                         {
                             allow += method_name(static_cast<HTTPMethod>(i)) + ", ";
                         }
@@ -1260,24 +1586,18 @@ namespace crow
             }
 
             auto& per_method = per_methods_[static_cast<int>(method_actual)];
-            auto& trie = per_method.trie;
             auto& rules = per_method.rules;
 
-            auto found = trie.find(req.url);
-
-            unsigned rule_index = found.first;
+            unsigned rule_index = found.rule_index;
 
             if (!rule_index)
             {
-                for (auto& per_method: per_methods_)
+                if (found.reject_code == 405 || other_methods)
                 {
-                    if (per_method.trie.find(req.url).first)
-                    {
-                        CROW_LOG_DEBUG << "Cannot match method " << req.url << " " << method_name(method_actual);
-                        res = response(405);
-                        res.end();
-                        return;
-                    }
+                    CROW_LOG_DEBUG << "Cannot match method " << req.url << " " << method_name(method_actual);
+                    res = response(405);
+                    res.end();
+                    return;
                 }
 
                 if (catchall_rule_.has_handler())
@@ -1320,7 +1640,8 @@ namespace crow
             // any uncaught exceptions become 500s
             try
             {
-                rules[rule_index]->handle(req, res, found.second);
+                found.params.url = &req.url;
+                rules[rule_index]->handle(req, res, found.params);
             }
             catch(std::exception& e)
             {
@@ -1348,6 +1669,46 @@ namespace crow
         }
 
     private:
+        /// Look up a URL in the trie of a method, going through this thread's route cache if it's enabled.
+        std::pair<unsigned, routing_params> find(int method, const std::string& url)
+        {
+            detail::route_cache* cache = local_route_cache();
+            if (cache)
+            {
+                auto cached = cache->find(generation_.load(std::memory_order_acquire), method, url);
+                if (cached)
+                    return *cached;
+            }
+
+            auto found = per_methods_[method].trie.find(url);
+            if (cache && found.first)
+                cache->insert(method, url, found);
+            return found;
+        }
+
+        detail::route_cache* local_route_cache()
+        {
+            if (!route_cache_capacity_)
+                return nullptr;
+
+            // one entry per cache set, which every snapshot of an app's routes shares, and set ids are never reused
+            static thread_local std::unordered_map<uint64_t, detail::route_cache*> caches;
+            auto& cache = caches[route_caches_->id];
+            if (!cache)
+            {
+                std::lock_guard<std::mutex> lock(route_caches_->mutex);
+                route_caches_->caches.emplace_back(new detail::route_cache(route_cache_capacity_));
+                cache = route_caches_->caches.back().get();
+            }
+            return cache;
+        }
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> id{0};
+            return ++id;
+        }
+
         CatchallRule catchall_rule_;
 
         struct PerMethod
@@ -1359,7 +1720,11 @@ namespace crow
             PerMethod() : rules(2) {}
         };
         std::array<PerMethod, static_cast<int>(HTTPMethod::InternalMethodCount)> per_methods_;
-        std::vector<std::unique_ptr<BaseRule>> all_rules_;
+        std::vector<std::shared_ptr<BaseRule>> all_rules_;
 
+        uint64_t id_;
+        std::atomic<unsigned> generation_{0};
+        size_t route_cache_capacity_{0};
+        std::shared_ptr<detail::route_cache_set> route_caches_{new detail::route_cache_set{next_id(), {}, {}}};
     };
 }
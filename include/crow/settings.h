@@ -40,6 +40,13 @@
 #define CROW_CAN_USE_CPP14
 #endif
 
+#if defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
+#define CROW_CAN_USE_CPP17
+#endif
+#if __cplusplus >= 201703L
+#define CROW_CAN_USE_CPP17
+#endif
+
 #if defined(_MSC_VER)
 #if _MSC_VER < 1900
 #define CROW_MSVC_WORKAROUND
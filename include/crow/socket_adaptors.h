@@ -80,6 +80,37 @@ namespace crow
             f(boost::system::error_code());
         }
 
+        /// Hand the socket over to another io_service, which must have no operation pending on it.
+
+        ///
+        /// Returns false if it can't be moved, the socket is closed if it failed after the socket was released.
+        bool move_to(boost::asio::io_service& io_service)
+        {
+#if BOOST_VERSION >= 107000
+            boost::system::error_code ec;
+            tcp::endpoint local = socket_.local_endpoint(ec);
+            if (ec)
+                return false;
+            tcp::socket::native_handle_type handle = socket_.release(ec);
+            if (ec)
+                return false;
+            tcp::socket moved(io_service);
+            moved.assign(local.protocol(), handle, ec);
+            if (ec)
+            {
+                // nothing owns the descriptor anymore
+                boost::asio::detail::socket_ops::state_type state = 0;
+                boost::asio::detail::socket_ops::close(handle, state, true, ec);
+                return false;
+            }
+            socket_ = std::move(moved);
+            return true;
+#else
+            (void)io_service;
+            return false;
+#endif
+        }
+
         tcp::socket socket_;
     };
 
@@ -164,6 +195,12 @@ namespace crow
                     });
         }
 
+        /// An SSL stream can't change io_service, its connection stays where it is.
+        bool move_to(boost::asio::io_service&)
+        {
+            return false;
+        }
+
         std::unique_ptr<boost::asio::ssl::stream<tcp::socket>> ssl_socket_;
     };
 #endif
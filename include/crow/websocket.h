@@ -1,9 +1,24 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/array.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include "crow/socket_adaptors.h"
 #include "crow/http_request.h"
 #include "crow/TinySHA1.hpp"
+#include "crow/compression.h"
 
 namespace crow
 {
@@ -11,13 +26,449 @@ namespace crow
     {
         enum class WebSocketReadState
         {
-            MiniHeader,
-            Len16,
-            Len64,
-            Mask,
+            MiniHeader, ///< Waiting for a complete header (opcode, length and mask).
             Payload,
         };
 
+        /// What to do with a text or binary message that doesn't fit in a connection's send queue.
+        enum class overflow
+        {
+            block,       ///< Make the thread sending it wait until the queue drains to the low watermark (from the connection's own thread, the message is dropped instead).
+            drop_oldest, ///< Drop the oldest queued messages to make room (not the ones already being written, nor the ones compressed with permessage-deflate context takeover).
+            drop_newest, ///< Drop the message.
+            close,       ///< Drop the message and close the connection with 1008.
+        };
+
+        /// The options of the connections of a websocket route.
+        struct settings
+        {
+            /// The bytes queued for sending to one client past which the \ref overflow policy applies, 0 for no limit.
+            size_t send_high_watermark{0};
+            /// Once the high watermark was hit, the queue stops counting as full when it drains to this many bytes.
+            size_t send_low_watermark{0};
+            overflow send_overflow{overflow::drop_newest};
+            /// How often to ping the client, 0 for never.
+            std::chrono::milliseconds ping_interval{0};
+            /// The pings in a row the client may leave unanswered, the connection is dropped when the next one is due.
+            unsigned max_missed_pongs{2};
+            /// Drop the connection after this long without a text or binary message from the client (pings and pongs don't count), 0 for never.
+            std::chrono::milliseconds idle_timeout{0};
+            /// Drop the connection this long after sending a close frame if the client didn't answer it, 0 for never.
+            std::chrono::milliseconds close_timeout{5000};
+            /// The largest text or binary message accepted, decompressed, 0 for no limit. A client sending a larger one is disconnected with 1009 as soon as a frame header shows it.
+            uint64_t max_message_size{0};
+            /// Compress messages with permessage-deflate (RFC 7692) when the client offers it, with a window of 2^`deflate_window_bits` bytes (9 to 15), 0 turning it off.
+
+            ///
+            /// Only available with `CROW_ENABLE_COMPRESSION`.
+            int deflate_window_bits{0};
+            /// Keep the compression context between the messages of a connection.
+
+            ///
+            /// Compresses better, but every message has to be compressed for each connection.
+            /// Without it, a message published on a \ref channel is compressed once for all its subscribers.
+            bool deflate_context_takeover{true};
+        };
+
+        namespace detail
+        {
+            /// Pick the first permessage-deflate offer of a `Sec-WebSocket-Extensions` header the server can accept.
+
+            ///
+            /// On success `window_bits` and `context_takeover` are what the server compresses with (a client can only lower them)
+            /// and `response` is the extension to answer with.<br>
+            /// Offers with unknown or repeated parameters, or a server window under 2^9 bytes (zlib's smallest), are declined.
+            inline bool negotiate_deflate(const std::string& offers, int& window_bits, bool& context_takeover, std::string& response)
+            {
+                std::vector<std::string> extensions;
+                boost::split(extensions, offers, boost::is_any_of(","));
+                for (auto& extension : extensions)
+                {
+                    std::vector<std::string> params;
+                    boost::split(params, extension, boost::is_any_of(";"));
+                    for (auto& param : params)
+                        boost::trim(param);
+                    if (params[0] != "permessage-deflate")
+                        continue;
+
+                    int bits = window_bits;
+                    bool takeover = context_takeover;
+                    bool client_takeover = true;
+                    bool valid = true;
+                    std::vector<std::string> seen;
+                    for (size_t i = 1; i < params.size() && valid; i++)
+                    {
+                        std::string name = params[i], value;
+                        size_t eq = name.find('=');
+                        if (eq != std::string::npos)
+                        {
+                            value = name.substr(eq + 1);
+                            name.resize(eq);
+                            boost::trim(name);
+                            boost::trim(value);
+                            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                                value = value.substr(1, value.size() - 2);
+                            if (value.empty())
+                                valid = false;
+                        }
+                        if (std::find(seen.begin(), seen.end(), name) != seen.end())
+                            valid = false;
+                        seen.push_back(name);
+
+                        bool has_value = eq != std::string::npos;
+                        int n = value.size() == 1 || value.size() == 2 ? std::atoi(value.c_str()) : 0;
+                        if (value.find_first_not_of("0123456789") != std::string::npos)
+                            n = 0;
+                        if (name == "server_no_context_takeover" && !has_value)
+                            takeover = false;
+                        else if (name == "client_no_context_takeover" && !has_value)
+                            client_takeover = false;
+                        else if (name == "server_max_window_bits" && n >= 9 && n <= 15)
+                            bits = std::min(bits, n);
+                        // the client may lower its window, any window is inflated with 2^15 bytes
+                        else if (name == "client_max_window_bits" && (!has_value || (n >= 8 && n <= 15)))
+                            ;
+                        else
+                            valid = false;
+                    }
+                    if (!valid)
+                        continue;
+
+                    window_bits = bits;
+                    context_takeover = takeover;
+                    response = "permessage-deflate";
+                    if (!takeover)
+                        response += "; server_no_context_takeover";
+                    if (!client_takeover)
+                        response += "; client_no_context_takeover";
+                    if (bits < 15)
+                        response += "; server_max_window_bits=" + std::to_string(bits);
+                    return true;
+                }
+                return false;
+            }
+
+            /// XOR `size` bytes of payload at `data` with the 4 byte masking key, `offset` being the position of `data[0]` in the payload.
+
+            ///
+            /// Bytes are done one at a time up to an 8 byte boundary and at the end, and in between 32, 16 or 8 at a time
+            /// (AVX2, SSE2 or a 64 bit word) with the key rotated to the boundary. The intrinsics are picked like the JSON parser's, so `CROW_JSON_NO_SIMD` turns them off.
+            inline void unmask(char* data, size_t size, const char* mask, size_t offset)
+            {
+                size_t i = 0;
+                for (; i < size && (reinterpret_cast<uintptr_t>(data + i) & 7); i++)
+                    data[i] ^= mask[(offset + i) & 3];
+                if (size - i >= 8)
+                {
+                    char key[8];
+                    for (size_t j = 0; j < 8; j++)
+                        key[j] = mask[(offset + i + j) & 3];
+                    uint64_t word_key;
+                    std::memcpy(&word_key, key, 8);
+#if defined(CROW_JSON_AVX2)
+                    __m256i avx_key = _mm256_set1_epi64x(static_cast<int64_t>(word_key));
+                    for (; i + 32 <= size; i += 32)
+                    {
+                        __m256i* p = reinterpret_cast<__m256i*>(data + i);
+                        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), avx_key));
+                    }
+#endif
+#if defined(CROW_JSON_AVX2) || defined(CROW_JSON_SSE2)
+                    __m128i sse_key = _mm_set1_epi64x(static_cast<int64_t>(word_key));
+                    for (; i + 16 <= size; i += 16)
+                    {
+                        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+                        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), sse_key));
+                    }
+#endif
+                    for (; i + 8 <= size; i += 8)
+                    {
+                        uint64_t word;
+                        std::memcpy(&word, data + i, 8);
+                        word ^= word_key;
+                        std::memcpy(data + i, &word, 8);
+                    }
+                }
+                for (; i < size; i++)
+                    data[i] ^= mask[(offset + i) & 3];
+            }
+
+            /// Checks that text is valid UTF-8 (RFC 3629), fed in pieces that may split a character.
+
+            ///
+            /// ASCII, most of any text, is skipped 32, 16 or 8 bytes at a time (AVX2, SSE2 or a 64 bit word, picked like in \ref unmask),
+            /// multibyte characters are checked a byte at a time against the ranges allowed for each byte, which rules out
+            /// overlong forms, surrogates and code points above U+10FFFF.
+            class utf8_validator
+            {
+            public:
+                /// Check the next piece of text, returning false as soon as it can't be valid UTF-8.
+                bool feed(const char* data, size_t size)
+                {
+                    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+                    size_t i = 0;
+                    while (i < size)
+                    {
+                        if (need_ == 0)
+                        {
+                            i = skip_ascii(p, i, size);
+                            if (i == size)
+                                break;
+                        }
+                        unsigned char c = p[i++];
+                        if (need_)
+                        {
+                            if (c < lower_ || c > upper_)
+                                return false;
+                            lower_ = 0x80;
+                            upper_ = 0xBF;
+                            need_--;
+                        }
+                        else if (c < 0x80)
+                            continue;
+                        else if (c >= 0xC2 && c <= 0xDF)
+                            need_ = 1;
+                        else if (c >= 0xE0 && c <= 0xEF)
+                        {
+                            need_ = 2;
+                            if (c == 0xE0)
+                                lower_ = 0xA0; // overlong
+                            else if (c == 0xED)
+                                upper_ = 0x9F; // surrogates
+                        }
+                        else if (c >= 0xF0 && c <= 0xF4)
+                        {
+                            need_ = 3;
+                            if (c == 0xF0)
+                                lower_ = 0x90; // overlong
+                            else if (c == 0xF4)
+                                upper_ = 0x8F; // above U+10FFFF
+                        }
+                        else
+                            return false;
+                    }
+                    return true;
+                }
+
+                /// Whether the text fed so far doesn't end in the middle of a character.
+                bool complete() const
+                {
+                    return need_ == 0;
+                }
+
+                void reset()
+                {
+                    need_ = 0;
+                    lower_ = 0x80;
+                    upper_ = 0xBF;
+                }
+
+            private:
+                /// The position of the first byte at or after `i` that isn't ASCII, or `size`.
+                static size_t skip_ascii(const unsigned char* p, size_t i, size_t size)
+                {
+#if defined(CROW_JSON_AVX2)
+                    for (; i + 32 <= size; i += 32)
+                    {
+                        uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i))));
+                        if (bits)
+                            return i + json::detail::trailing_zeros(bits);
+                    }
+#endif
+#if defined(CROW_JSON_AVX2) || defined(CROW_JSON_SSE2)
+                    for (; i + 16 <= size; i += 16)
+                    {
+                        uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))));
+                        if (bits)
+                            return i + json::detail::trailing_zeros(bits);
+                    }
+#endif
+                    for (; i + 8 <= size; i += 8)
+                    {
+                        uint64_t word;
+                        std::memcpy(&word, p + i, 8);
+                        if (word & 0x8080808080808080ull)
+                            break;
+                    }
+                    while (i < size && p[i] < 0x80)
+                        i++;
+                    return i;
+                }
+
+                unsigned need_{0}; ///< Continuation bytes still to come for the current character.
+                unsigned char lower_{0x80}; ///< The range of the next continuation byte.
+                unsigned char upper_{0xBF};
+            };
+        }
+
+        struct connection;
+        class channel;
+
+        /// A message framed once (its header followed by its payload), queued on any number of connections without being copied again.
+        using frame = std::shared_ptr<const std::string>;
+
+        /// Build the frame of a message, with opcode 1 for text, 2 for binary, 0x8 for a close, 0x9 for a ping or 0xA for a pong.
+
+        ///
+        /// `compressed` sets RSV1, for a payload compressed with permessage-deflate.
+        inline frame make_frame(int opcode, const char* payload, size_t size, bool compressed = false)
+        {
+            char header[2+8] = {static_cast<char>(0x80 | (compressed ? 0x40 : 0) | opcode), 0};
+            size_t header_size = 2;
+            if (size < 126)
+                header[1] = static_cast<char>(size);
+            else if (size < 0x10000)
+            {
+                header[1] = 126;
+                header[2] = static_cast<char>(size >> 8);
+                header[3] = static_cast<char>(size);
+                header_size = 4;
+            }
+            else
+            {
+                header[1] = 127;
+                for (int i = 0; i < 8; i++)
+                    header[2 + i] = static_cast<char>(static_cast<uint64_t>(size) >> (56 - 8 * i));
+                header_size = 10;
+            }
+            auto f = std::make_shared<std::string>();
+            f->reserve(header_size + size);
+            f->append(header, header_size);
+            f->append(payload, size);
+            return f;
+        }
+
+        inline frame make_frame(int opcode, const std::string& payload)
+        {
+            return make_frame(opcode, payload.data(), payload.size());
+        }
+
+        /// A text or binary message sent to many connections, framed once and compressed at most once.
+
+        ///
+        /// Connections compressing without context takeover share one compressed frame, made by the first of them to send it.
+        /// The others compress the payload themselves.
+        class message
+        {
+        public:
+            message(int opcode, const std::string& payload):
+              frame_(make_frame(opcode, payload)), opcode_(opcode), size_(payload.size())
+            {
+            }
+
+            int opcode() const { return opcode_; }
+            const char* payload() const { return frame_->data() + frame_->size() - size_; }
+            size_t size() const { return size_; }
+
+            /// The frame of the message as it is.
+            const frame& plain() const { return frame_; }
+
+#ifdef CROW_ENABLE_COMPRESSION
+            /// The frame of the message compressed without context, for a connection compressing with a window of at most 2^`window_bits` bytes.
+
+            ///
+            /// Compressed once, with the window of the first connection asking. Null if that window is larger than `window_bits`, or if zlib failed.
+            frame deflated(int window_bits) const
+            {
+                std::call_once(deflate_once_, [this, window_bits] {
+                    compression::message_deflater deflater(window_bits, false);
+                    std::string compressed;
+                    if (deflater.compress(payload(), size_, compressed))
+                    {
+                        deflated_ = make_frame(opcode_, compressed.data(), compressed.size(), true);
+                        deflated_bits_ = window_bits;
+                    }
+                });
+                return deflated_bits_ <= window_bits ? deflated_ : nullptr;
+            }
+#endif
+
+        private:
+            frame frame_;
+            int opcode_;
+            size_t size_;
+#ifdef CROW_ENABLE_COMPRESSION
+            mutable std::once_flag deflate_once_;
+            mutable frame deflated_;
+            mutable int deflated_bits_{16};
+#endif
+        };
+
+        /// The state of a connection's send queue.
+        struct send_queue_stats
+        {
+            size_t bytes;              ///< Bytes queued, counting the frames being written.
+            size_t frames;
+            uint64_t dropped_messages; ///< Messages dropped because the queue was full.
+            uint64_t dropped_bytes;
+        };
+
+        namespace detail
+        {
+            /// What a thread blocked on a full send queue waits for, shared with it so it can outlive the connection.
+            struct send_gate
+            {
+                std::mutex mutex;
+                std::condition_variable cv;
+                bool open{true};
+                bool closed{false};
+            };
+
+            struct channel_shard;
+
+            /// A connection moving to the shard of another io_service, which holds back what's published until the connection settled there.
+            struct joining_subscriber
+            {
+                channel_shard* shard;
+                std::vector<std::pair<std::shared_ptr<const message>, frame>> held; ///< A message or a frame each.
+            };
+
+            /// The subscribers of a channel that run on one io_service, only ever touched from that io_service's thread.
+            struct channel_shard
+            {
+                boost::asio::io_service* io_service;
+                std::vector<connection*> subscribers;
+                std::atomic<size_t>* count; ///< The subscriber count of the whole channel.
+                channel* owner;
+                std::vector<std::shared_ptr<joining_subscriber>> joining;
+                bool publishing; ///< A message is being sent to the subscribers, which only get nulled out when they leave meanwhile.
+                size_t vacated; ///< The subscribers nulled out while publishing, removed once it's done.
+            };
+
+            struct subscription
+            {
+                channel_shard* shard;
+                size_t index; ///< The position of the connection in the shard's subscribers.
+            };
+
+            /// Handlers sent to a connection from other threads (or while it moves), run in order on the connection's thread.
+            struct mailbox
+            {
+                std::mutex mutex;
+                std::vector<std::function<void()>> handlers;
+                bool scheduled{false}; ///< A drain is posted to the connection's io_service.
+                bool closed{false}; ///< The connection was destroyed.
+            };
+
+            /// The websocket traffic of one worker thread, which the server compares between workers to move connections off busy ones.
+            struct worker_load
+            {
+                boost::asio::io_service* io_service;
+                std::atomic<uint64_t> messages{0}; ///< Messages received and queued for sending by the worker's connections.
+                std::atomic<uint64_t> round{0}; ///< The balancing round, connections count their own messages per round.
+                std::vector<connection*> connections; ///< Only touched from the worker's thread.
+
+                /// The load of the worker running on this thread, null if the server doesn't balance websockets.
+                static worker_load*& current()
+                {
+                    static thread_local worker_load* load = nullptr;
+                    return load;
+                }
+
+                void shed(boost::asio::io_service& to, uint64_t budget);
+            };
+        }
+
         ///A base class for websocket connection.
 		struct connection
 		{
@@ -26,15 +477,403 @@ namespace crow
             virtual void send_ping(const std::string& msg) = 0;
             virtual void send_pong(const std::string& msg) = 0;
             virtual void close(const std::string& msg = "quit") = 0;
-            virtual ~connection(){}
+            /// Queue a frame built by \ref make_frame, from any thread.
+            virtual void send_frame(frame f) = 0;
+            /// Send a message shared with other connections, compressing it if the connection uses permessage-deflate.
+            virtual void send_message(std::shared_ptr<const message> m) = 0;
+            virtual boost::asio::io_service& get_io_service() = 0;
+            /// The size of the send queue and the messages dropped from it, from any thread.
+            virtual send_queue_stats send_queue() const = 0;
+            /// Move the connection to another worker's io_service, from the connection's own thread.
+            virtual bool move_to(boost::asio::io_service& io_service) = 0;
+            virtual ~connection()
+            {
+                while (!subscriptions_.empty())
+                    leave(subscriptions_.back().shard);
+                untrack();
+            }
 
             void userdata(void* u) { userdata_ = u; }
             void* userdata() { return userdata_; }
 
+        protected:
+            /// Count the connection in the load of the worker running this thread, if the server balances websockets.
+            void track()
+            {
+                worker_ = detail::worker_load::current();
+                if (!worker_)
+                    return;
+                worker_index_ = worker_->connections.size();
+                worker_->connections.push_back(this);
+                round_ = worker_->round;
+                round_messages_ = last_round_messages_ = 0;
+            }
+
+            void untrack()
+            {
+                if (!worker_)
+                    return;
+                connection* moved = worker_->connections.back();
+                worker_->connections[worker_index_] = moved;
+                moved->worker_index_ = worker_index_;
+                worker_->connections.pop_back();
+                worker_ = nullptr;
+            }
+
+            /// Count a message received or queued, for the worker and for the connection's current round.
+            void count_message()
+            {
+                if (!worker_)
+                    return;
+                worker_->messages.fetch_add(1, std::memory_order_relaxed);
+                uint64_t round = worker_->round.load(std::memory_order_relaxed);
+                if (round != round_)
+                {
+                    last_round_messages_ = round == round_ + 1 ? round_messages_ : 0;
+                    round_messages_ = 0;
+                    round_ = round;
+                }
+                round_messages_++;
+            }
+
+            /// Move the channel subscriptions to the shards of another io_service, calling `done` on this thread once the old shards let go.
+            void move_subscriptions(boost::asio::io_service& io_service, std::function<void()> done);
+            /// On the new io_service's thread, join the shards for good and send what they held back.
+            void settle_subscriptions();
+
         private:
+            friend class channel;
+            friend struct detail::worker_load;
+
+            /// The messages of the round before `round`.
+            uint64_t last_round_messages(uint64_t round) const
+            {
+                return round == round_ ? last_round_messages_ : round == round_ + 1 ? round_messages_ : 0;
+            }
+
+            /// Remove the connection from the subscribers of one channel shard (`counted` is false when it moves to another shard of the channel).
+            void leave(detail::channel_shard* shard, bool counted = true)
+            {
+                for (size_t i = 0; i < subscriptions_.size(); i++)
+                {
+                    if (subscriptions_[i].shard != shard)
+                        continue;
+                    size_t index = subscriptions_[i].index;
+                    if (shard->publishing)
+                    {
+                        // the shard is being iterated (this runs from a handler called while sending to a subscriber)
+                        shard->subscribers[index] = nullptr;
+                        shard->vacated++;
+                    }
+                    else
+                    {
+                        // the last subscriber takes the place of this one
+                        connection* moved = shard->subscribers.back();
+                        shard->subscribers[index] = moved;
+                        shard->subscribers.pop_back();
+                        for (auto& s : moved->subscriptions_)
+                            if (s.shard == shard)
+                                s.index = index;
+                    }
+                    if (counted)
+                        (*shard->count)--;
+                    subscriptions_[i] = subscriptions_.back();
+                    subscriptions_.pop_back();
+                    return;
+                }
+            }
+
             void* userdata_;
+            std::vector<detail::subscription> subscriptions_;
+            std::vector<std::shared_ptr<detail::joining_subscriber>> joining_;
+            detail::worker_load* worker_{nullptr};
+            size_t worker_index_{0};
+            uint64_t round_{0};
+            uint64_t round_messages_{0};
+            uint64_t last_round_messages_{0};
 		};
 
+        /// A group of connections that messages are sent to together (a room, a topic).
+
+        ///
+        /// A message is framed once, and the same frame is queued on every subscriber (connections using permessage-deflate share one compressed frame when they can).<br>
+        /// The subscribers are kept per io_service (worker thread), so each worker queues the frame on its own connections without any lock.
+        /// `subscribe()` and `unsubscribe()` are called on the connection's own thread (from its handlers), `publish_*()` from any thread.
+        /// A connection leaves its channels when it's destroyed, so a channel has to outlive its subscribers (channels from `app.channel()` live as long as the app).<br>
+        /// A connection moved to another worker takes its subscriptions along, without missing or repeating a message.
+        class channel
+        {
+        public:
+            channel() = default;
+            channel(const channel&) = delete;
+            channel& operator=(const channel&) = delete;
+
+            /// Add a connection to the channel (doing nothing if it's already in it).
+            void subscribe(connection& conn)
+            {
+                detail::channel_shard* shard = shard_for(conn.get_io_service());
+                for (auto& s : conn.subscriptions_)
+                    if (s.shard == shard)
+                        return;
+                conn.subscriptions_.push_back({shard, shard->subscribers.size()});
+                shard->subscribers.push_back(&conn);
+                count_++;
+            }
+
+            void unsubscribe(connection& conn)
+            {
+                conn.leave(shard_for(conn.get_io_service()));
+            }
+
+            void publish_text(const std::string& msg)
+            {
+                publish(std::make_shared<const message>(1, msg));
+            }
+
+            void publish_binary(const std::string& msg)
+            {
+                publish(std::make_shared<const message>(2, msg));
+            }
+
+            /// Send a message to every subscriber, each worker sending it to its own connections.
+
+            ///
+            /// The message is always posted, even to the worker publishing it, so each worker gets the messages and the moves of its subscribers in the order of this lock
+            /// (and a backpressure handler publishing again doesn't run into it).
+            void publish(std::shared_ptr<const message> m)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& shard : shards_)
+                {
+                    detail::channel_shard* s = shard.get();
+                    s->io_service->post([s, m] {
+                        deliver(s, [&m](connection& conn) {
+                            conn.send_message(m);
+                        });
+                        for (auto& joining : s->joining)
+                            joining->held.emplace_back(m, nullptr);
+                    });
+                }
+            }
+
+            /// Queue a frame on every subscriber as it is, each worker queueing it on its own connections.
+            void publish(frame f)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& shard : shards_)
+                {
+                    detail::channel_shard* s = shard.get();
+                    s->io_service->post([s, f] {
+                        deliver(s, [&f](connection& conn) {
+                            conn.send_frame(f);
+                        });
+                        for (auto& joining : s->joining)
+                            joining->held.emplace_back(nullptr, f);
+                    });
+                }
+            }
+
+            /// The number of subscribers, on all workers.
+            size_t size() const
+            {
+                return count_;
+            }
+
+        private:
+            friend struct connection;
+
+            detail::channel_shard* shard_for(boost::asio::io_service& io_service)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return find_shard(io_service);
+            }
+
+            /// Send to the subscribers of a shard, on its thread.
+
+            ///
+            /// The backpressure handler of a subscriber may unsubscribe connections while this runs,
+            /// so the subscribers that leave meanwhile are only nulled out, and removed once it's done.
+            template <typename Send>
+            static void deliver(detail::channel_shard* s, Send send)
+            {
+                s->publishing = true;
+                // the ones subscribing meanwhile don't get this message
+                for (size_t i = 0, n = s->subscribers.size(); i < n; i++)
+                    if (connection* conn = s->subscribers[i])
+                        send(*conn);
+                s->publishing = false;
+                if (!s->vacated)
+                    return;
+                size_t kept = 0;
+                for (connection* conn : s->subscribers)
+                {
+                    if (!conn)
+                        continue;
+                    for (auto& sub : conn->subscriptions_)
+                        if (sub.shard == s)
+                            sub.index = kept;
+                    s->subscribers[kept++] = conn;
+                }
+                s->subscribers.resize(kept);
+                s->vacated = 0;
+            }
+
+            detail::channel_shard* find_shard(boost::asio::io_service& io_service)
+            {
+                for (auto& shard : shards_)
+                    if (shard->io_service == &io_service)
+                        return shard.get();
+                shards_.emplace_back(new detail::channel_shard{&io_service, {}, &count_, this, {}, false, 0});
+                return shards_.back().get();
+            }
+
+            /// Start moving a subscriber from its shard to the one of another io_service, from the connection's old thread.
+
+            ///
+            /// Publishing is cut in two at this point: what was published before still goes through the old shard, which lets go of the connection after it,
+            /// and what comes after is held back by the new shard until the connection settled on its new thread.
+            std::shared_ptr<detail::joining_subscriber> transfer(connection& conn, detail::channel_shard* from, boost::asio::io_service& io_service, std::function<void()> done)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                detail::channel_shard* to = find_shard(io_service);
+                std::shared_ptr<detail::joining_subscriber> joining(new detail::joining_subscriber{to, {}});
+                to->io_service->post([to, joining] {
+                    to->joining.push_back(joining);
+                });
+                from->io_service->post([&conn, from, done] {
+                    conn.leave(from, false);
+                    done();
+                });
+                return joining;
+            }
+
+            std::mutex mutex_;
+            std::vector<std::unique_ptr<detail::channel_shard>> shards_;
+            std::atomic<size_t> count_{0};
+        };
+
+        inline void connection::move_subscriptions(boost::asio::io_service& io_service, std::function<void()> done)
+        {
+            if (subscriptions_.empty())
+            {
+                done();
+                return;
+            }
+            // every old shard lets go on this thread, so the count needs no lock
+            std::shared_ptr<size_t> pending = std::make_shared<size_t>(subscriptions_.size());
+            std::vector<detail::subscription> subscriptions = subscriptions_;
+            for (auto& s : subscriptions)
+            {
+                joining_.push_back(s.shard->owner->transfer(*this, s.shard, io_service, [pending, done] {
+                    if (--*pending == 0)
+                        done();
+                }));
+            }
+        }
+
+        inline void connection::settle_subscriptions()
+        {
+            for (auto& joining : joining_)
+            {
+                detail::channel_shard* shard = joining->shard;
+                shard->joining.erase(std::find(shard->joining.begin(), shard->joining.end(), joining));
+                for (auto& held : joining->held)
+                {
+                    if (held.first)
+                        send_message(held.first);
+                    else
+                        send_frame(held.second);
+                }
+                subscriptions_.push_back({shard, shard->subscribers.size()});
+                shard->subscribers.push_back(this);
+            }
+            joining_.clear();
+        }
+
+        /// Move connections to another worker, on this worker's thread: the busiest ones that handled at most `budget` messages in the last round.
+
+        ///
+        /// A connection busier than that would only make the other worker the busy one.
+        inline void detail::worker_load::shed(boost::asio::io_service& to, uint64_t budget)
+        {
+            uint64_t last = round;
+            std::vector<std::pair<uint64_t, connection*>> busy;
+            for (connection* conn : connections)
+            {
+                uint64_t n = conn->last_round_messages(last);
+                if (n && n <= budget)
+                    busy.emplace_back(n, conn);
+            }
+            std::sort(busy.begin(), busy.end(), [](const std::pair<uint64_t, connection*>& a, const std::pair<uint64_t, connection*>& b) {
+                return a.first > b.first;
+            });
+            for (auto& b : busy)
+            {
+                if (b.first <= budget && b.second->move_to(to))
+                    budget -= b.first;
+            }
+        }
+
+        namespace detail
+        {
+            /// Compares the websocket message rates of the workers every round, and has the busiest move connections to the quietest one.
+
+            ///
+            /// Rounds run on the server's own thread. The workers count messages in relaxed atomics, which is all the tracking costs them.
+            class balancer
+            {
+            public:
+                explicit balancer(double threshold = 2):
+                    threshold_(threshold)
+                {}
+
+                /// The load of a worker, set as \ref worker_load::current on its thread.
+                worker_load& add(boost::asio::io_service& io_service)
+                {
+                    workers_.emplace_back(new worker_load);
+                    workers_.back()->io_service = &io_service;
+                    last_.push_back(0);
+                    return *workers_.back();
+                }
+
+                /// Start a new round, moving connections if the busiest worker handled more than `threshold` times the messages of the quietest in the last one.
+
+                ///
+                /// The busiest worker moves at most half the difference, so it can't become the quietest.
+                void round()
+                {
+                    if (workers_.size() < 2)
+                        return;
+                    size_t busiest = 0, quietest = 0;
+                    std::vector<uint64_t> rates(workers_.size());
+                    for (size_t i = 0; i < workers_.size(); i++)
+                    {
+                        uint64_t total = workers_[i]->messages.load(std::memory_order_relaxed);
+                        rates[i] = total - last_[i];
+                        last_[i] = total;
+                        workers_[i]->round++;
+                        if (rates[i] > rates[busiest])
+                            busiest = i;
+                        if (rates[i] < rates[quietest])
+                            quietest = i;
+                    }
+                    if (rates[busiest] < 2 || rates[busiest] <= threshold_ * rates[quietest])
+                        return;
+                    worker_load* from = workers_[busiest].get();
+                    boost::asio::io_service* to = workers_[quietest]->io_service;
+                    uint64_t budget = (rates[busiest] - rates[quietest]) / 2;
+                    from->io_service->post([from, to, budget] {
+                        from->shed(*to, budget);
+                    });
+                }
+
+            private:
+                double threshold_;
+                std::vector<std::unique_ptr<worker_load>> workers_;
+                std::vector<uint64_t> last_;
+            };
+        }
+
         //  0               1               2               3               -byte
         //  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 -bit
         // +-+-+-+-+-------+-+-------------+-------------------------------+
@@ -63,15 +902,23 @@ namespace crow
 
                 ///
                 /// Requires a request with an "Upgrade: websocket" header.<br>
-                /// Automatically handles the handshake.
+                /// Automatically handles the handshake, accepting permessage-deflate if `config` enables it and the client offers it.<br>
+                /// `backpressure_handler` is called with true when the send queue reaches the high watermark, and false once it drained to the low one.<br>
+                /// If there's a `chunk_handler`, text and binary messages are passed to it piece by piece as they're read, instead of whole to `message_handler`.
 				Connection(const crow::request& req, Adaptor&& adaptor, 
 						std::function<void(crow::websocket::connection&)> open_handler,
 						std::function<void(crow::websocket::connection&, const std::string&, bool)> message_handler,
 						std::function<void(crow::websocket::connection&, const std::string&)> close_handler,
 						std::function<void(crow::websocket::connection&)> error_handler,
-						std::function<bool(const crow::request&)> accept_handler)
+						std::function<bool(const crow::request&)> accept_handler,
+						std::function<void(crow::websocket::connection&, bool)> backpressure_handler = nullptr,
+						std::function<void(crow::websocket::connection&, const char*, size_t, bool, bool)> chunk_handler = nullptr,
+						const settings& config = {})
 					: adaptor_(std::move(adaptor)), open_handler_(std::move(open_handler)), message_handler_(std::move(message_handler)), close_handler_(std::move(close_handler)), error_handler_(std::move(error_handler))
-					, accept_handler_(std::move(accept_handler))
+					, accept_handler_(std::move(accept_handler)), backpressure_handler_(std::move(backpressure_handler)), chunk_handler_(std::move(chunk_handler))
+					, high_watermark_(config.send_high_watermark), low_watermark_(std::min(config.send_low_watermark, config.send_high_watermark)), overflow_(config.send_overflow)
+					, io_service_(&adaptor_.get_io_service()), timer_(adaptor_.get_io_service()), ping_interval_(config.ping_interval), max_missed_pongs_(config.max_missed_pongs)
+					, idle_timeout_(config.idle_timeout), close_timeout_(config.close_timeout), max_message_size_(config.max_message_size)
 				{
 					if (!boost::iequals(req.get_header_value("upgrade"), "websocket"))
 					{
@@ -97,21 +944,65 @@ namespace crow
                     s.processBytes(magic.data(), magic.size());
                     uint8_t digest[20];
                     s.getDigestBytes(digest);   
-                    start(crow::utility::base64encode((char*)digest, 20));
+
+                    std::string extensions;
+#ifdef CROW_ENABLE_COMPRESSION
+                    int window_bits = config.deflate_window_bits;
+                    bool context_takeover = config.deflate_context_takeover;
+                    if (window_bits && detail::negotiate_deflate(req.get_header_value("Sec-WebSocket-Extensions"), window_bits, context_takeover, extensions))
+                    {
+                        deflater_.reset(new compression::message_deflater(window_bits, context_takeover));
+                        inflater_.reset(new compression::message_inflater());
+                        deflate_window_bits_ = window_bits;
+                        deflate_context_takeover_ = context_takeover;
+                    }
+#else
+                    (void)config;
+#endif
+                    start(crow::utility::base64encode((char*)digest, 20), extensions);
 				}
 
+                ~Connection()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(mailbox_->mutex);
+                        mailbox_->closed = true;
+                    }
+                    // release the threads waiting for room in the queue
+                    std::lock_guard<std::mutex> lock(gate_->mutex);
+                    gate_->closed = true;
+                    gate_->cv.notify_all();
+                }
+
                 /// Send data through the socket.
+
+                ///
+                /// Runs the handler right away on the connection's own thread, or later on it, after what was sent before.
                 template<typename CompletionHandler>
                 void dispatch(CompletionHandler handler)
                 {
-                    adaptor_.get_io_service().dispatch(handler);
+                    if (on_own_thread() && !moving_)
+                        handler();
+                    else
+                        post(std::move(handler));
                 }
 
                 /// Send data through the socket and return immediately.
+
+                ///
+                /// The handler runs on the connection's thread, after the ones posted before it from any thread.
                 template<typename CompletionHandler>
                 void post(CompletionHandler handler)
                 {
-                    adaptor_.get_io_service().post(handler);
+                    std::lock_guard<std::mutex> lock(mailbox_->mutex);
+                    mailbox_->handlers.emplace_back(std::move(handler));
+                    if (mailbox_->scheduled)
+                        return;
+                    mailbox_->scheduled = true;
+                    std::shared_ptr<detail::mailbox> box = mailbox_;
+                    io_service_.load()->post([this, box] {
+                        drain(this, box);
+                    });
                 }
 
                 /// Send a "Ping" message.
@@ -120,11 +1011,9 @@ namespace crow
                 /// Usually invoked to check if the other point is still online.
                 void send_ping(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
-                        auto header = build_header(0x9, msg.size());
-                        write_buffers_.emplace_back(std::move(header));
-                        write_buffers_.emplace_back(msg);
-                        do_write();
+                    frame f = make_frame(0x9, msg);
+                    dispatch([this, f]{
+                        send_frame(f);
                     });
                 }
 
@@ -134,36 +1023,89 @@ namespace crow
                 /// Usually automatically invoked as a response to a "Ping" message.
                 void send_pong(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
-                        auto header = build_header(0xA, msg.size());
-                        write_buffers_.emplace_back(std::move(header));
-                        write_buffers_.emplace_back(msg);
-                        do_write();
+                    frame f = make_frame(0xA, msg);
+                    dispatch([this, f]{
+                        send_frame(f);
                     });
                 }
 
                 /// Send a binary encoded message.
                 void send_binary(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
-                        auto header = build_header(2, msg.size());
-                        write_buffers_.emplace_back(std::move(header));
-                        write_buffers_.emplace_back(msg);
-                        do_write();
-                    });
+                    send_data(2, msg);
                 }
 
                 /// Send a plaintext message.
                 void send_text(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
-                        auto header = build_header(1, msg.size());
-                        write_buffers_.emplace_back(std::move(header));
-                        write_buffers_.emplace_back(msg);
-                        do_write();
+                    send_data(1, msg);
+                }
+
+                /// Send a message shared with other connections, from any thread.
+
+                ///
+                /// Its frame is queued as it is, or its compressed frame if the connection can use it.
+                void send_message(std::shared_ptr<const message> m) override
+                {
+                    if (!wait_for_room())
+                        return;
+                    bool waited = overflow_ == overflow::block && !on_own_thread();
+                    dispatch([this, m, waited]{
+#ifdef CROW_ENABLE_COMPRESSION
+                        if (deflater_)
+                        {
+                            frame f = deflate_context_takeover_ ? nullptr : m->deflated(deflate_window_bits_);
+                            if (f)
+                                queue(f, waited);
+                            else
+                                queue_deflated(m->opcode(), m->payload(), m->size(), waited);
+                            return;
+                        }
+#endif
+                        queue(m->plain(), waited);
                     });
                 }
 
+                /// Queue a frame, which can be shared with other connections.
+                void send_frame(frame f) override
+                {
+                    dispatch([this, f]{
+                        queue(f);
+                    });
+                }
+
+                send_queue_stats send_queue() const override
+                {
+                    return {queued_bytes_, queued_frames_, dropped_messages_, dropped_bytes_};
+                }
+
+                boost::asio::io_service& get_io_service() override
+                {
+                    return *io_service_.load();
+                }
+
+                /// Move the connection to another worker's io_service, from its own thread.
+
+                ///
+                /// Reading stops, and the socket is handed over once the pending read, write and timer wait are done. Meanwhile what's sent to the connection waits,
+                /// and goes out from the new thread in the order it was sent. The channel subscriptions move along.<br>
+                /// Returns false if the move can't start. A connection that started moving still stays where it is if a message was half read when the socket was to be handed over,
+                /// if the adaptor can't move (an SSL stream), or if its send queue is full then:
+                /// with the block policy, a handler on the old thread sending to it would wait for the new thread, which waits for the old one to let go of the subscriptions.
+                bool move_to(boost::asio::io_service& io_service) override
+                {
+                    if (!on_own_thread() || moving_ || full_ || &io_service == io_service_.load() || !adaptor_.is_open() || close_connection_ || has_sent_close_ || has_recv_close_)
+                        return false;
+                    moving_ = true;
+                    target_ = &io_service;
+                    boost::system::error_code ec;
+                    adaptor_.raw_socket().cancel(ec);
+                    if (timer_waits_)
+                        timer_.cancel();
+                    continue_move();
+                    return true;
+                }
+
                 /// Send a close signal.
 
                 ///
@@ -171,275 +1113,544 @@ namespace crow
                 void close(const std::string& msg) override
                 {
                     dispatch([this, msg]{
-                        has_sent_close_ = true;
+                        if (!has_sent_close_)
+                        {
+                            has_sent_close_ = true;
+                            close_sent_ = clock::now();
+                            schedule();
+                        }
                         if (has_recv_close_ && !is_close_handler_called_)
                         {
                             is_close_handler_called_ = true;
                             if (close_handler_)
                                 close_handler_(*this, msg);
                         }
-                        auto header = build_header(0x8, msg.size());
-                        write_buffers_.emplace_back(std::move(header));
-                        write_buffers_.emplace_back(msg);
-                        do_write();
+                        send_frame(make_frame(0x8, msg));
                     });
                 }
 
             protected:
 
-                /// Generate the websocket headers using an opcode and the message size (in bytes).
-                std::string build_header(int opcode, size_t size)
-                {
-                    char buf[2+8] = "\x80\x00";
-                    buf[0] += opcode;
-                    if (size < 126)
-                    {
-                        buf[1] += size;
-                        return {buf, buf+2};
-                    }
-                    else if (size < 0x10000)
-                    {
-                        buf[1] += 126;
-                        *(uint16_t*)(buf+2) = htons(static_cast<uint16_t>(size));
-                        return {buf, buf+4};
-                    }
-                    else
-                    {
-                        buf[1] += 127;
-                        *reinterpret_cast<uint64_t*>(buf+2) = ((1==htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size) & 0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
-                        return {buf, buf+10};
-                    }
-                }
-
                 /// Send the HTTP upgrade response.
 
                 ///
                 /// Finishes the handshake process, then starts reading messages from the socket.
-                void start(std::string&& hello)
+                void start(std::string&& hello, const std::string& extensions)
                 {
                     static std::string header = "HTTP/1.1 101 Switching Protocols\r\n"
                         "Upgrade: websocket\r\n"
                         "Connection: Upgrade\r\n"
                         "Sec-WebSocket-Accept: ";
                     static std::string crlf = "\r\n";
-                    write_buffers_.emplace_back(header);
-                    write_buffers_.emplace_back(std::move(hello));
-                    write_buffers_.emplace_back(crlf);
-                    write_buffers_.emplace_back(crlf);
+                    std::string response = header + hello + crlf;
+                    if (!extensions.empty())
+                        response += "Sec-WebSocket-Extensions: " + extensions + crlf;
+                    response += crlf;
+                    queued_bytes_ += response.size();
+                    queued_frames_++;
+                    write_buffers_.emplace_back(std::make_shared<const std::string>(std::move(response)));
                     do_write();
+                    track();
                     if (open_handler_)
                         open_handler_(*this);
                     do_read();
+                    last_message_ = next_ping_ = clock::now();
+                    next_ping_ += ping_interval_;
+                    schedule();
                 }
 
-                /// Read a websocket message.
+                /// Wait for the earliest of the next ping, the idle timeout and the close timeout, on the worker's io_service.
 
                 ///
-                /// Involves:<br>
-                /// Handling headers (opcodes, size).<br>
-                /// Unmasking the payload.<br>
-                /// Reading the actual payload.<br>
-                void do_read()
+                /// Arrival of messages doesn't move the timer: when it fires early, it's just set again.
+                void schedule()
                 {
-                    is_reading = true;
-                    switch(state_)
+                    if (!adaptor_.is_open())
+                        return;
+                    clock::time_point next = clock::time_point::max();
+                    if (ping_interval_.count())
+                        next = std::min(next, next_ping_);
+                    if (idle_timeout_.count())
+                        next = std::min(next, last_message_ + idle_timeout_);
+                    if (has_sent_close_ && close_timeout_.count())
+                        next = std::min(next, close_sent_ + close_timeout_);
+                    if (next == clock::time_point::max() || (timer_waits_ && timer_.expiry() <= next))
+                        return;
+                    // a wait already going on is cancelled, its handler still runs
+                    timer_.expires_at(next);
+                    timer_waits_++;
+                    timer_.async_wait([this](const boost::system::error_code& ec) {
+                        timer_waits_--;
+                        if (!adaptor_.is_open())
+                            check_destroy();
+                        else if (moving_)
+                            continue_move();
+                        else if (ec != boost::asio::error::operation_aborted)
+                            handle_timer();
+                    });
+                }
+
+                /// Ping the client, or drop the connection if it missed too many pongs or was idle or didn't answer a close for too long.
+                void handle_timer()
+                {
+                    clock::time_point now = clock::now();
+                    bool expired = (has_sent_close_ && close_timeout_.count() && now >= close_sent_ + close_timeout_) ||
+                                   (idle_timeout_.count() && now >= last_message_ + idle_timeout_);
+                    if (!expired && !has_sent_close_ && ping_interval_.count() && now >= next_ping_)
                     {
-                        case WebSocketReadState::MiniHeader:
-                            {
-                                mini_header_ = 0;
-                                //boost::asio::async_read(adaptor_.socket(), boost::asio::buffer(&mini_header_, 1), 
-                                adaptor_.socket().async_read_some(boost::asio::buffer(&mini_header_, 2),
-                                    [this](const boost::system::error_code& ec, std::size_t 
-#ifdef CROW_ENABLE_DEBUG
-                                        bytes_transferred
+                        if (missed_pongs_ >= max_missed_pongs_)
+                            expired = true;
+                        else
+                        {
+                            missed_pongs_++;
+                            next_ping_ = now + ping_interval_;
+                            send_frame(make_frame(0x9, ""));
+                        }
+                    }
+                    if (expired)
+                    {
+                        CROW_LOG_DEBUG << "websocket " << this << " timed out";
+                        // the pending read fails and destroys the connection
+                        close_connection_ = true;
+                        adaptor_.close();
+                        return;
+                    }
+                    schedule();
+                }
+
+                /// Frame a text or binary message, compressing it on the connection's thread if permessage-deflate is on.
+                void send_data(int opcode, const std::string& msg)
+                {
+                    if (!wait_for_room())
+                        return;
+                    bool waited = overflow_ == overflow::block && !on_own_thread();
+#ifdef CROW_ENABLE_COMPRESSION
+                    if (deflater_)
+                    {
+                        dispatch([this, opcode, msg, waited]{
+                            queue_deflated(opcode, msg.data(), msg.size(), waited);
+                        });
+                        return;
+                    }
 #endif
-                                        )
+                    frame f = make_frame(opcode, msg);
+                    dispatch([this, f, waited]{
+                        queue(f, waited);
+                    });
+                }
 
-                                    {
-                                        is_reading = false;
-                                        mini_header_ = ntohs(mini_header_);
-#ifdef CROW_ENABLE_DEBUG
-                                        
-                                        if (!ec && bytes_transferred != 2)
-                                        {
-                                            throw std::runtime_error("WebSocket:MiniHeader:async_read fail:asio bug?");
-                                        }
+                bool on_own_thread() const
+                {
+                    return std::this_thread::get_id() == thread_id_.load();
+                }
+
+                /// Run the handlers posted to the connection, if this is its thread and it isn't moving (it runs them itself once it's settled).
+                static void drain(Connection* self, const std::shared_ptr<detail::mailbox>& box)
+                {
+                    std::vector<std::function<void()>> handlers;
+                    {
+                        std::lock_guard<std::mutex> lock(box->mutex);
+                        box->scheduled = false;
+                        if (box->closed || !self->on_own_thread() || self->moving_)
+                            return;
+                        handlers.swap(box->handlers);
+                    }
+                    for (auto& handler : handlers)
+                        handler();
+                }
+
+                /// Hand the socket over once nothing is pending on it or on the timer, or stay if the connection can't move anymore.
+                void continue_move()
+                {
+                    if (is_reading || timer_waits_ || !sending_buffers_.empty())
+                        return;
+                    if (close_connection_ || !adaptor_.is_open())
+                    {
+                        moving_ = false;
+                        adaptor_.close();
+                        check_destroy();
+                        return;
+                    }
+                    boost::asio::io_service* to = target_;
+                    if (state_ != WebSocketReadState::MiniHeader || read_end_ || in_message_ || has_recv_close_ || has_sent_close_ || full_ || !adaptor_.move_to(*to))
+                    {
+                        resume();
+                        return;
+                    }
+                    timer_ = boost::asio::steady_timer(*to);
+                    untrack();
+                    // no thread is the connection's own until it settles, what's sent meanwhile is posted
+                    thread_id_ = std::thread::id();
+                    io_service_ = to;
+                    move_subscriptions(*to, [this, to] {
+                        to->post([this] {
+                            settle();
+                        });
+                    });
+                }
+
+                /// Finish a move on the new io_service's thread.
+                void settle()
+                {
+                    thread_id_ = std::this_thread::get_id();
+                    track();
+                    // still moving: what the new shards held back is posted after what the old ones sent
+                    settle_subscriptions();
+                    resume();
+                }
+
+                /// Carry on after a move, or where the connection was if it stayed.
+                void resume()
+                {
+                    moving_ = false;
+                    drain(this, mailbox_);
+                    if (!write_buffers_.empty())
+                        do_write();
+                    if (adaptor_.is_open())
+                    {
+                        do_read();
+                        schedule();
+                    }
+                    else
+                        check_destroy();
+                }
+
+                /// With the block policy, wait until the send queue isn't full (not on the connection's own thread, which drains it).
+
+                ///
+                /// Returns false if the connection was destroyed meanwhile.
+                bool wait_for_room()
+                {
+                    if (overflow_ != overflow::block || on_own_thread())
+                        return true;
+                    std::shared_ptr<detail::send_gate> gate = gate_;
+                    std::unique_lock<std::mutex> lock(gate->mutex);
+                    gate->cv.wait(lock, [&gate] {
+                        return gate->open || gate->closed;
+                    });
+                    return !gate->closed;
+                }
+
+                /// Whether a frame is a text, binary or continuation frame, which are the ones the overflow policy may drop.
+                static bool is_data(const std::string& f)
+                {
+                    int opcode = f[0] & 0x0f;
+                    return opcode < 0x8;
+                }
+
+                /// Whether a queued frame was compressed with the connection's stream, which the client's window depends on.
+                bool uses_stream(const std::string& f)
+                {
+#ifdef CROW_ENABLE_COMPRESSION
+                    return deflater_ && deflate_context_takeover_ && (f[0] & 0x40);
+#else
+                    (void)f;
+                    return false;
 #endif
+                }
 
-                                        if (!ec)
-                                        {
-                                            if ((mini_header_ & 0x80) == 0x80)
-                                                has_mask_ = true;
-
-                                            if ((mini_header_ & 0x7f) == 127)
-                                            {
-                                                state_ = WebSocketReadState::Len64;
-                                            }
-                                            else if ((mini_header_ & 0x7f) == 126)
-                                            {
-                                                state_ = WebSocketReadState::Len16;
-                                            }
-                                            else
-                                            {
-                                                remaining_length_ = mini_header_ & 0x7f;
-                                                state_ = WebSocketReadState::Mask;
-                                            }
-                                            do_read();
-                                        }
-                                        else
-                                        {
-                                            close_connection_ = true;
-                                            adaptor_.close();
-                                            if (error_handler_)
-                                                error_handler_(*this);
-                                            check_destroy();
-                                        }
-                                    });
-                            }
-                            break;
-                        case WebSocketReadState::Len16:
-                            {
-                                remaining_length_ = 0;
-                                remaining_length16_ = 0;
-                                boost::asio::async_read(adaptor_.socket(), boost::asio::buffer(&remaining_length16_, 2), 
-                                    [this](const boost::system::error_code& ec, std::size_t 
-#ifdef CROW_ENABLE_DEBUG
-                                        bytes_transferred
+                /// Add a frame to the send queue, applying the overflow policy to a message that goes over the high watermark.
+
+                ///
+                /// `waited` is set for a message whose sender already waited for room (the block policy), which is always queued.
+                void queue(frame f, bool waited = false)
+                {
+                    if (admit(f->size(), is_data(*f), waited))
+                        push(std::move(f));
+                }
+
+#ifdef CROW_ENABLE_COMPRESSION
+                /// Compress a message with the connection's stream and queue it, if the overflow policy lets it in.
+
+                ///
+                /// The policy is applied to the uncompressed size before compressing:
+                /// with context takeover the client's window holds every message compressed so far, so a compressed message has to be sent.
+                void queue_deflated(int opcode, const char* data, size_t size, bool waited)
+                {
+                    if (admit(size, true, waited))
+                        push(deflate_frame(opcode, data, size));
+                }
 #endif
-                                        ) 
+
+                /// Apply the overflow policy to a message of `size` bytes about to be queued, returns whether it can be.
+                bool admit(size_t size, bool data, bool waited)
+                {
+                    if (high_watermark_ && queued_bytes_ + size > high_watermark_ && data)
+                    {
+                        set_full(true);
+                        switch (overflow_)
+                        {
+                            case overflow::block:
+                                if (!waited)
+                                {
+                                    drop(size);
+                                    return false;
+                                }
+                                break;
+                            case overflow::drop_oldest:
+                                for (size_t i = 0; i < write_buffers_.size() && queued_bytes_ + size > high_watermark_;)
+                                {
+                                    // a message compressed with context takeover can't be taken back
+                                    if (!is_data(*write_buffers_[i]) || uses_stream(*write_buffers_[i]))
                                     {
-                                        is_reading = false;
-                                        remaining_length16_ = ntohs(remaining_length16_);
-                                        remaining_length_ = remaining_length16_;
-#ifdef CROW_ENABLE_DEBUG
-                                        if (!ec && bytes_transferred != 2)
-                                        {
-                                            throw std::runtime_error("WebSocket:Len16:async_read fail:asio bug?");
-                                        }
+                                        i++;
+                                        continue;
+                                    }
+                                    queued_bytes_ -= write_buffers_[i]->size();
+                                    queued_frames_--;
+                                    drop(write_buffers_[i]->size());
+                                    write_buffers_.erase(write_buffers_.begin() + i);
+                                }
+                                // larger than what's left to drop
+                                if (queued_bytes_ + size > high_watermark_)
+                                {
+                                    drop(size);
+                                    return false;
+                                }
+                                break;
+                            case overflow::drop_newest:
+                                drop(size);
+                                return false;
+                            case overflow::close:
+                                drop(size);
+                                if (!has_sent_close_)
+                                    close(std::string("\x03\xf0") + "send queue full");
+                                return false;
+                        }
+                    }
+                    return true;
+                }
+
+                void push(frame f)
+                {
+                    queued_bytes_ += f->size();
+                    queued_frames_++;
+                    write_buffers_.emplace_back(std::move(f));
+                    count_message();
+                    do_write();
+                }
+
+                void drop(size_t size)
+                {
+                    dropped_messages_++;
+                    dropped_bytes_ += size;
+                }
+
+                /// Mark the send queue full or not, opening or closing the gate for the block policy and calling the backpressure handler.
+                void set_full(bool full)
+                {
+                    if (full_ == full)
+                        return;
+                    full_ = full;
+                    {
+                        std::lock_guard<std::mutex> lock(gate_->mutex);
+                        gate_->open = !full;
+                    }
+                    if (!full)
+                        gate_->cv.notify_all();
+                    if (backpressure_handler_)
+                        backpressure_handler_(*this, full);
+                }
+
+#ifdef CROW_ENABLE_COMPRESSION
+                /// Compress a message with the connection's own stream (sent uncompressed if zlib fails).
+                frame deflate_frame(int opcode, const char* data, size_t size)
+                {
+                    std::string compressed;
+                    if (!deflater_->compress(data, size, compressed))
+                        return make_frame(opcode, data, size);
+                    return make_frame(opcode, compressed.data(), compressed.size(), true);
+                }
 #endif
 
-                                        if (!ec)
-                                        {
-                                            state_ = WebSocketReadState::Mask;
-                                            do_read();
-                                        }
-                                        else
-                                        {
-                                            close_connection_ = true;
-                                            adaptor_.close();
-                                            if (error_handler_)
-                                                error_handler_(*this);
-                                            check_destroy();
-                                        }
-                                    });
+                /// Close the connection because of what the client sent, with a status code (1002 for a protocol error).
+
+                ///
+                /// Nothing more is read from the client.
+                void fail(uint16_t code, const std::string& reason)
+                {
+                    has_recv_close_ = true;
+                    std::string payload{static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+                    close(payload + reason);
+                }
+
+                /// Read a websocket message.
+
+                ///
+                /// Reads as much as the socket has (up to the size of the read buffer), then handles every frame in the buffer:<br>
+                /// Handling headers (opcodes, size, mask).<br>
+                /// Reading the actual payload, unmasking each part as it arrives.<br>
+                /// A frame cut off by the end of what was read is completed by the next read.
+                void do_read()
+                {
+                    is_reading = true;
+                    adaptor_.socket().async_read_some(boost::asio::buffer(buffer_.data() + read_end_, buffer_.size() - read_end_),
+                        [this](const boost::system::error_code& ec, std::size_t bytes_transferred)
+                        {
+                            if (!ec)
+                            {
+                                read_end_ += bytes_transferred;
+                                // is_reading stays set so a handler closing the connection can't destroy it under the loop
+                                handle_frames();
+                                is_reading = false;
+                                if (moving_)
+                                    continue_move();
+                                else if (adaptor_.is_open())
+                                    do_read();
+                                else
+                                    check_destroy();
                             }
-                            break;
-                        case WebSocketReadState::Len64:
+                            else if (moving_ && ec == boost::asio::error::operation_aborted)
                             {
-                                boost::asio::async_read(adaptor_.socket(), boost::asio::buffer(&remaining_length_, 8), 
-                                    [this](const boost::system::error_code& ec, std::size_t 
-#ifdef CROW_ENABLE_DEBUG
-                                        bytes_transferred
-#endif
-                                        ) 
-                                    {
-                                        is_reading = false;
-                                        remaining_length_ = ((1==ntohl(1)) ? (remaining_length_) : (static_cast<uint64_t>(ntohl((remaining_length_) & 0xFFFFFFFF)) << 32) | ntohl((remaining_length_) >> 32));
-#ifdef CROW_ENABLE_DEBUG
-                                        if (!ec && bytes_transferred != 8)
-                                        {
-                                            throw std::runtime_error("WebSocket:Len16:async_read fail:asio bug?");
-                                        }
-#endif
-
-                                        if (!ec)
-                                        {
-                                            state_ = WebSocketReadState::Mask;
-                                            do_read();
-                                        }
-                                        else
-                                        {
-                                            close_connection_ = true;
-                                            adaptor_.close();
-                                            if (error_handler_)
-                                                error_handler_(*this);
-                                            check_destroy();
-                                        }
-                                    });
+                                is_reading = false;
+                                continue_move();
                             }
-                            break;
-                        case WebSocketReadState::Mask:
-                            if (has_mask_)
+                            else
                             {
-                                    boost::asio::async_read(adaptor_.socket(), boost::asio::buffer((char*)&mask_, 4),
-                                        [this](const boost::system::error_code& ec, std::size_t
-#ifdef CROW_ENABLE_DEBUG
-                                            bytes_transferred
-#endif
-                                        )
-                                        {
-                                            is_reading = false;
-#ifdef CROW_ENABLE_DEBUG
-                                            if (!ec && bytes_transferred != 4)
-                                            {
-                                                throw std::runtime_error("WebSocket:Mask:async_read fail:asio bug?");
-                                            }
-#endif
+                                is_reading = false;
+                                close_connection_ = true;
+                                adaptor_.close();
+                                if (error_handler_)
+                                    error_handler_(*this);
+                                check_destroy();
+                            }
+                        });
+                }
+
+                /// Handle the frames in the read buffer, and as much of the payload of the last one as it holds.
+
+                ///
+                /// What's left is at most the start of a header, which is moved to the front of the buffer.
+                void handle_frames()
+                {
+                    size_t pos = 0;
+                    while (pos < read_end_ && !has_recv_close_)
+                    {
+                        if (state_ == WebSocketReadState::MiniHeader)
+                        {
+                            const unsigned char* header = reinterpret_cast<const unsigned char*>(buffer_.data() + pos);
+                            size_t available = read_end_ - pos;
+                            if (available < 2)
+                                break;
+                            size_t length = header[1] & 0x7f;
+                            size_t header_size = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + (header[1] & 0x80 ? 4 : 0);
+                            if (available < header_size)
+                                break;
 
-                                            if (!ec)
-                                            {
-                                                state_ = WebSocketReadState::Payload;
-                                                do_read();
-                                            }
-                                            else
-                                            {
-                                                close_connection_ = true;
-                                                if (error_handler_)
-                                                    error_handler_(*this);
-                                                adaptor_.close();
-                                            }
-                                        });
+                            mini_header_ = (header[0] << 8) | header[1];
+                            has_mask_ = (header[1] & 0x80) == 0x80;
+                            // RSV1 marks the first frame of a compressed message, and only if permessage-deflate is on
+                            if (header[0] & 0x40)
+                            {
+                                if (!deflate_on() || opcode() == 0 || opcode() >= 0x8)
+                                {
+                                    fail(1002, "unexpected RSV1");
+                                    break;
+                                }
                             }
-                            else
+                            if (header[0] & 0x30)
                             {
-                                state_ = WebSocketReadState::Payload;
-                                do_read();
+                                fail(1002, "unexpected RSV2 or RSV3");
+                                break;
                             }
-                            break;
-                        case WebSocketReadState::Payload:
+                            const unsigned char* p = header + 2;
+                            if (length == 126)
                             {
-                                size_t to_read = buffer_.size();
-                                if (remaining_length_ < to_read)
-                                    to_read = remaining_length_;
-                                adaptor_.socket().async_read_some( boost::asio::buffer(buffer_, to_read), 
-                                    [this](const boost::system::error_code& ec, std::size_t bytes_transferred)
-                                    {
-                                        is_reading = false;
-
-                                        if (!ec)
-                                        {
-                                            fragment_.insert(fragment_.end(), buffer_.begin(), buffer_.begin() + bytes_transferred);
-                                            remaining_length_ -= bytes_transferred;
-                                            if (remaining_length_ == 0)
-                                            {
-                                                handle_fragment();
-                                                state_ = WebSocketReadState::MiniHeader;
-                                                do_read();
-                                            }
-					    else
-                                                do_read();
-                                        }
-                                        else
-                                        {
-                                            close_connection_ = true;
-                                            if (error_handler_)
-                                                error_handler_(*this);
-                                            adaptor_.close();
-                                        }
-                                    });
+                                remaining_length_ = (p[0] << 8) | p[1];
+                                p += 2;
                             }
-                            break;
+                            else if (length == 127)
+                            {
+                                remaining_length_ = 0;
+                                for (int i = 0; i < 8; i++)
+                                    remaining_length_ = (remaining_length_ << 8) | p[i];
+                                p += 8;
+                            }
+                            else
+                                remaining_length_ = length;
+                            if (has_mask_)
+                                std::memcpy(&mask_, p, 4);
+                            pos += header_size;
+                            state_ = WebSocketReadState::Payload;
+                            frame_offset_ = 0;
+                            if (!start_frame())
+                                break;
+                        }
+
+                        size_t size = static_cast<size_t>(std::min<uint64_t>(read_end_ - pos, remaining_length_));
+                        if (size)
+                        {
+                            // unmasked while it's still in the read buffer, at its position in the payload
+                            if (has_mask_)
+                                detail::unmask(buffer_.data() + pos, size, reinterpret_cast<const char*>(&mask_), static_cast<size_t>(frame_offset_));
+                            // text is checked as it arrives, so invalid UTF-8 fails the connection before the rest is read
+                            if (opcode() < 0x8 && !is_binary_ && !is_compressed_ && !utf8_.feed(buffer_.data() + pos, size))
+                            {
+                                fail(1007, "invalid UTF-8");
+                                break;
+                            }
+                            if (opcode() < 0x8 && is_streaming())
+                                chunk_handler_(*this, buffer_.data() + pos, size, is_binary_, false);
+                            else
+                                fragment_.append(buffer_.data() + pos, size);
+                            frame_offset_ += size;
+                            pos += size;
+                            remaining_length_ -= size;
+                        }
+                        if (remaining_length_ == 0)
+                        {
+                            state_ = WebSocketReadState::MiniHeader;
+                            handle_fragment();
+                        }
+                    }
+
+                    // nothing is read after a close frame
+                    if (has_recv_close_)
+                        pos = read_end_;
+                    if (pos != read_end_)
+                        std::memmove(buffer_.data(), buffer_.data() + pos, read_end_ - pos);
+                    read_end_ -= pos;
+                }
+
+                /// Check a frame's header against the message it belongs to and the size limit, failing the connection if it's not valid.
+                bool start_frame()
+                {
+                    if (opcode() >= 0x8)
+                    {
+                        // control frames come whole, between the frames of a message
+                        if (!is_FIN() || remaining_length_ > 125)
+                        {
+                            fail(1002, "invalid control frame");
+                            return false;
+                        }
+                        return true;
+                    }
+                    if (opcode() == 0 ? !in_message_ : (in_message_ || opcode() > 2))
+                    {
+                        fail(1002, "unexpected opcode");
+                        return false;
+                    }
+                    if (opcode() != 0)
+                    {
+                        is_binary_ = opcode() == 2;
+                        is_compressed_ = (mini_header_ & 0x4000) != 0;
+                        message_size_ = 0;
+                        utf8_.reset();
+                    }
+                    in_message_ = !is_FIN();
+                    message_size_ += remaining_length_;
+                    if (max_message_size_ && (message_size_ > max_message_size_ || message_size_ < remaining_length_))
+                    {
+                        fail(1009, "message too big");
+                        return false;
                     }
+                    return true;
+                }
+
+                /// Whether the payload of text and binary messages goes to the chunk handler as it's read (compressed messages are inflated whole first).
+                bool is_streaming()
+                {
+                    return chunk_handler_ && !is_compressed_;
                 }
 
                 /// Check if the FIN bit is set.
@@ -457,51 +1668,24 @@ namespace crow
                 /// Process the payload fragment.
 
                 ///
-                /// Unmasks the fragment, checks the opcode, merges fragments into 1 message body, and calls the appropriate handler.
+                /// Checks the opcode, merges fragments into 1 message body, and calls the appropriate handler (the payload was unmasked as it was read).
                 void handle_fragment()
                 {
-                    if (has_mask_)
-                    {
-                        for(decltype(fragment_.length()) i = 0; i < fragment_.length(); i ++)
-                        {
-                            fragment_[i] ^= ((char*)&mask_)[i%4];
-                        }
-                    }
                     switch(opcode())
                     {
                         case 0: // Continuation
                             {
                                 message_ += fragment_;
                                 if (is_FIN())
-                                {
-                                    if (message_handler_)
-                                        message_handler_(*this, message_, is_binary_);
-                                    message_.clear();
-                                }
+                                    handle_message();
                             }
                             break;
                         case 1: // Text
-                            {
-                                is_binary_ = false;
-                                message_ += fragment_;
-                                if (is_FIN())
-                                {
-                                    if (message_handler_)
-                                        message_handler_(*this, message_, is_binary_);
-                                    message_.clear();
-                                }
-                            }
-                            break;
                         case 2: // Binary
                             {
-                                is_binary_ = true;
                                 message_ += fragment_;
                                 if (is_FIN())
-                                {
-                                    if (message_handler_)
-                                        message_handler_(*this, message_, is_binary_);
-                                    message_.clear();
-                                }
+                                    handle_message();
                             }
                             break;
                         case 0x8: // Close
@@ -532,7 +1716,7 @@ namespace crow
                             break;
                         case 0xA: // Pong
                             {
-                                pong_received_ = true;
+                                missed_pongs_ = 0;
                             }
                             break;
                     }
@@ -540,31 +1724,97 @@ namespace crow
                     fragment_.clear();
                 }
 
+                /// Pass a whole message to the message handler, decompressing it first if it was sent compressed.
+                void handle_message()
+                {
+                    last_message_ = clock::now();
+                    count_message();
+                    if (!is_binary_ && !is_compressed_ && !utf8_.complete())
+                    {
+                        message_.clear();
+                        fail(1007, "invalid UTF-8");
+                        return;
+                    }
+                    if (is_streaming())
+                    {
+                        chunk_handler_(*this, "", 0, is_binary_, true);
+                        return;
+                    }
+#ifdef CROW_ENABLE_COMPRESSION
+                    if (is_compressed_)
+                    {
+                        std::string inflated;
+                        if (!inflater_->decompress(message_, inflated, max_message_size_ ? static_cast<size_t>(max_message_size_) : std::string::npos))
+                        {
+                            message_.clear();
+                            if (max_message_size_ && inflated.size() > max_message_size_)
+                                fail(1009, "message too big");
+                            else
+                                fail(1002, "invalid compressed data");
+                            return;
+                        }
+                        message_.swap(inflated);
+                        if (!is_binary_ && (!utf8_.feed(message_.data(), message_.size()) || !utf8_.complete()))
+                        {
+                            message_.clear();
+                            fail(1007, "invalid UTF-8");
+                            return;
+                        }
+                    }
+#endif
+                    if (chunk_handler_)
+                    {
+                        chunk_handler_(*this, message_.data(), message_.size(), is_binary_, true);
+                        message_.clear();
+                        return;
+                    }
+                    if (message_handler_)
+                        message_handler_(*this, message_, is_binary_);
+                    message_.clear();
+                }
+
+                bool deflate_on()
+                {
+#ifdef CROW_ENABLE_COMPRESSION
+                    return deflater_ != nullptr;
+#else
+                    return false;
+#endif
+                }
+
                 /// Send the buffers' data through the socket.
 
                 ///
                 /// Also destroyes the object if the Close flag is set.
                 void do_write()
                 {
-                    if (sending_buffers_.empty())
+                    // a moving connection writes from its new thread
+                    if (sending_buffers_.empty() && !moving_)
                     {
                         sending_buffers_.swap(write_buffers_);
                         std::vector<boost::asio::const_buffer> buffers;
                         buffers.reserve(sending_buffers_.size());
                         for(auto& s:sending_buffers_)
                         {
-                            buffers.emplace_back(boost::asio::buffer(s));
+                            buffers.emplace_back(boost::asio::buffer(*s));
                         }
                         boost::asio::async_write(adaptor_.socket(), buffers, 
                             [&](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/)
                             {
+                                for (auto& s : sending_buffers_)
+                                    queued_bytes_ -= s->size();
+                                queued_frames_ -= sending_buffers_.size();
                                 sending_buffers_.clear();
+                                if (full_ && queued_bytes_ <= low_watermark_)
+                                    set_full(false);
                                 if (!ec && !close_connection_)
                                 {
                                     if (!write_buffers_.empty())
                                         do_write();
                                     if (has_sent_close_)
                                         close_connection_ = true;
+                                    if (moving_)
+                                        continue_move();
                                 }
                                 else
                                 {
@@ -580,23 +1830,36 @@ namespace crow
                 {
                     //if (has_sent_close_ && has_recv_close_)
                     if (!is_close_handler_called_)
+                    {
+                        is_close_handler_called_ = true;
                         if (close_handler_)
                             close_handler_(*this, "uncleanly");
+                    }
+                    if (timer_waits_)
+                    {
+                        timer_.cancel();
+                        return;
+                    }
                     if (sending_buffers_.empty() && !is_reading)
                         delete this;
                 }
 			private:
 				Adaptor adaptor_;
 
-                std::vector<std::string> sending_buffers_;
-                std::vector<std::string> write_buffers_;
+                std::vector<frame> sending_buffers_;
+                std::vector<frame> write_buffers_;
 
                 boost::array<char, 4096> buffer_;
+                size_t read_end_{0};
                 bool is_binary_;
+                bool is_compressed_{false};
+                bool in_message_{false}; ///< A text or binary message's last frame is still to come.
+                uint64_t message_size_{0};
+                uint64_t frame_offset_{0}; ///< The payload bytes of the current frame read so far.
+                detail::utf8_validator utf8_;
                 std::string message_;
                 std::string fragment_;
                 WebSocketReadState state_{WebSocketReadState::MiniHeader};
-                uint16_t remaining_length16_{0};
                 uint64_t remaining_length_{0};
                 bool close_connection_{false};
                 bool is_reading{false};
@@ -606,14 +1869,49 @@ namespace crow
                 bool has_sent_close_{false};
                 bool has_recv_close_{false};
                 bool error_occured_{false};
-                bool pong_received_{false};
                 bool is_close_handler_called_{false};
+#ifdef CROW_ENABLE_COMPRESSION
+                std::unique_ptr<compression::message_deflater> deflater_;
+                std::unique_ptr<compression::message_inflater> inflater_;
+                int deflate_window_bits_{15};
+                bool deflate_context_takeover_{true};
+#endif
 
 				std::function<void(crow::websocket::connection&)> open_handler_;
 				std::function<void(crow::websocket::connection&, const std::string&, bool)> message_handler_;
 				std::function<void(crow::websocket::connection&, const std::string&)> close_handler_;
 				std::function<void(crow::websocket::connection&)> error_handler_;
 				std::function<bool(const crow::request&)> accept_handler_;
+				std::function<void(crow::websocket::connection&, bool)> backpressure_handler_;
+				std::function<void(crow::websocket::connection&, const char*, size_t, bool, bool)> chunk_handler_;
+
+                size_t high_watermark_;
+                size_t low_watermark_;
+                overflow overflow_;
+                bool full_{false};
+                std::atomic<size_t> queued_bytes_{0};
+                std::atomic<size_t> queued_frames_{0};
+                std::atomic<uint64_t> dropped_messages_{0};
+                std::atomic<uint64_t> dropped_bytes_{0};
+                std::atomic<std::thread::id> thread_id_{std::this_thread::get_id()};
+                std::shared_ptr<detail::send_gate> gate_{std::make_shared<detail::send_gate>()};
+                std::shared_ptr<detail::mailbox> mailbox_{std::make_shared<detail::mailbox>()};
+                std::atomic<boost::asio::io_service*> io_service_;
+                bool moving_{false};
+                boost::asio::io_service* target_{nullptr};
+
+                using clock = std::chrono::steady_clock;
+                boost::asio::steady_timer timer_;
+                int timer_waits_{0}; ///< Waits whose handler hasn't run yet, the connection can't be destroyed before.
+                std::chrono::milliseconds ping_interval_;
+                unsigned max_missed_pongs_;
+                unsigned missed_pongs_{0};
+                std::chrono::milliseconds idle_timeout_;
+                std::chrono::milliseconds close_timeout_;
+                clock::time_point next_ping_;
+                clock::time_point last_message_;
+                clock::time_point close_sent_;
+                uint64_t max_message_size_;
         };
     }
 }
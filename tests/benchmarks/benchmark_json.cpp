@@ -0,0 +1,213 @@
+// Parsing throughput of the JSON parser, the time to read one value eagerly or with a json::lazy_document,
+// and the throughput of escaping and unescaping strings.
+// Pass JSON files (e.g. twitter.json, canada.json) to measure them, otherwise similar documents are generated.
+#define CROW_MAIN
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crow.h"
+
+using namespace crow;
+
+namespace
+{
+    /// Objects with short strings, nested objects and a few numbers, like an API response.
+    std::string generate_records(unsigned count)
+    {
+        std::string out = "{\"statuses\":[";
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (i)
+                out += ',';
+            out += "{\"id\":" + std::to_string(100000000000ull + i * 7919ull) +
+                   ",\"text\":\"Status number " + std::to_string(i) + " with a \\\"quoted\\\" word and a link https:\\/\\/example.com\\/" + std::to_string(i) + "\"" +
+                   ",\"user\":{\"id\":" + std::to_string(i * 31) + ",\"name\":\"user" + std::to_string(i) + "\",\"verified\":" + (i % 3 ? "false" : "true") +
+                   ",\"followers_count\":" + std::to_string(i * 13 % 10007) + ",\"description\":null}" +
+                   ",\"entities\":{\"hashtags\":[],\"urls\":[{\"url\":\"https:\\/\\/t.co\\/" + std::to_string(i) + "\",\"indices\":[12,35]}]}" +
+                   ",\"retweet_count\":" + std::to_string(i % 97) + ",\"favorited\":false,\"lang\":\"en\"}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    /// Long arrays of coordinates, nearly all numbers.
+    std::string generate_coordinates(unsigned count)
+    {
+        std::string out = "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[";
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (i)
+                out += ',';
+            char pair[64];
+            std::snprintf(pair, sizeof(pair), "[%.14f,%.14f]", -65.613616999999977 + i * 1e-5, 43.420273000000009 - i * 3e-6);
+            out += pair;
+        }
+        out += "]]}}]}";
+        return out;
+    }
+
+    double measure(const std::string& text, unsigned rounds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            auto x = json::load(text);
+            if (!x)
+            {
+                std::fprintf(stderr, "parse error\n");
+                return 0;
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(text.size()) * rounds / std::chrono::duration<double>(elapsed).count() / 1e6;
+    }
+
+    struct eager_document
+    {
+        explicit eager_document(const std::string& text):
+          value(json::load(text))
+        {}
+
+        json::rvalue value;
+    };
+
+    json::rvalue& doc_root(eager_document& doc)
+    {
+        return doc.value;
+    }
+
+    json::lazy_value doc_root(const json::lazy_document& doc)
+    {
+        return doc.root();
+    }
+
+    /// Microseconds to parse the text and read the last element of the first list in the root object.
+    template <typename Document>
+    double measure_lookup(const std::string& text, unsigned rounds)
+    {
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            Document doc(text);
+            auto&& root = doc_root(doc);
+            for (auto& key : root.keys())
+            {
+                auto&& list = root[key];
+                if (list.t() == json::type::List && list.size())
+                {
+                    found += static_cast<size_t>(list[list.size() - 1].t());
+                    break;
+                }
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return found ? std::chrono::duration<double, std::micro>(elapsed).count() / rounds : 0;
+    }
+
+    /// Log lines and HTML fragments, mostly clean with the odd quote, tab or markup character.
+    std::vector<std::string> generate_strings(unsigned count)
+    {
+        std::vector<std::string> out;
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (i % 2)
+                out.push_back("2024-05-17T12:00:" + std::to_string(i % 60) + "Z INFO request handled path=/api/v1/items/" + std::to_string(i) +
+                              " status=200 took=" + std::to_string(i % 977) + "us agent=\"Mozilla/5.0 (X11; Linux x86_64)\"\tid=" + std::to_string(i * 7));
+            else
+                out.push_back("<p class='note'>Item " + std::to_string(i) + " was updated by user" + std::to_string(i % 31) +
+                              " &amp; needs a review before it can be published on the front page.</p>");
+        }
+        return out;
+    }
+
+    /// Megabytes per second of input through `f`, the best of a few runs.
+    template <typename F>
+    double measure_strings(const std::vector<std::string>& strings, F f)
+    {
+        size_t bytes = 0;
+        for (auto& s : strings)
+            bytes += s.size();
+        double best = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int round = 0; round < 20; round++)
+                for (auto& s : strings)
+                    f(s);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            best = std::max(best, static_cast<double>(bytes) * 20 / std::chrono::duration<double>(elapsed).count() / 1e6);
+        }
+        return best;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::pair<std::string, std::string>> corpora;
+    for (int i = 1; i < argc; i++)
+    {
+        std::ifstream in(argv[i], std::ios::binary);
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        corpora.emplace_back(argv[i], buffer.str());
+    }
+    if (corpora.empty())
+    {
+        corpora.emplace_back("records", generate_records(5000));
+        corpora.emplace_back("coordinates", generate_coordinates(50000));
+    }
+
+    for (auto& corpus : corpora)
+    {
+        unsigned rounds = static_cast<unsigned>(40000000 / (corpus.second.size() + 1)) + 1;
+        // the best of a few runs, to keep the noise of a busy machine out
+        double parse = 0;
+        for (int run = 0; run < 5; run++)
+            parse = std::max(parse, measure(corpus.second, rounds));
+        std::printf("%-16s %9zu bytes  parse: %8.1f MB/s\n", corpus.first.c_str(), corpus.second.size(), parse);
+
+        if (corpus.second.find('{') != 0)
+            continue;
+        rounds = rounds / 4 + 1;
+        double eager = 0, lazy = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            double e = measure_lookup<eager_document>(corpus.second, rounds);
+            double l = measure_lookup<json::lazy_document>(corpus.second, rounds);
+            eager = run ? std::min(eager, e) : e;
+            lazy = run ? std::min(lazy, l) : l;
+        }
+        if (eager && lazy)
+            std::printf("%-16s one lookup     eager: %8.1f us    lazy: %8.1f us    (%.2fx)\n",
+                        corpus.first.c_str(), eager, lazy, eager / lazy);
+    }
+
+    auto strings = generate_strings(20000);
+    std::vector<std::string> escaped;
+    for (auto& s : strings)
+        escaped.push_back(json::escape(s));
+    std::string out;
+    double escape = measure_strings(strings, [&out](const std::string& s) {
+        out.clear();
+        json::escape(s, out);
+    });
+    double unescape = measure_strings(escaped, [&out](const std::string& s) {
+        out.resize(s.size());
+        out.resize(json::detail::unescape(s.data(), s.data() + s.size(), &out[0]) - &out[0]);
+    });
+    auto html = mustache::compile("{{value}}");
+    double html_escape = measure_strings(strings, [&html](const std::string& s) {
+        mustache::context ctx;
+        ctx["value"] = s;
+        html.render(ctx);
+    });
+    std::printf("strings          json escape: %8.1f MB/s  unescape: %8.1f MB/s  html escape: %8.1f MB/s\n", escape, unescape, html_escape);
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Per-request dispatch cost of the runtime router (trie, virtual call and std::function)
+// against a CompiledRouter holding the same routes.
+#define CROW_MAIN
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "crow.h"
+
+using namespace crow;
+
+namespace
+{
+    template <typename Handle>
+    double measure(const std::vector<request>& requests, unsigned rounds, Handle&& handle)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            for (auto& req : requests)
+            {
+                response res;
+                handle(req, res);
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(rounds) * requests.size());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned rounds = argc > 1 ? std::stoul(argv[1]) : 100000;
+    logger::setLogLevel(LogLevel::Warning);
+
+    SimpleApp app;
+    CROW_ROUTE(app, "/")([] { return "root"; });
+    CROW_ROUTE(app, "/health")([] { return "ok"; });
+    CROW_ROUTE(app, "/users")([] { return "users"; });
+    CROW_ROUTE(app, "/users/<uint>")([](uint64_t id) { return std::to_string(id); });
+    CROW_ROUTE(app, "/users/<uint>/posts")([](uint64_t id) { return std::to_string(id); });
+    CROW_ROUTE(app, "/users/<uint>/posts/<uint>")([](uint64_t, uint64_t post) { return std::to_string(post); });
+    CROW_ROUTE(app, "/posts/<string>")([](const std::string& slug) { return slug; });
+    CROW_ROUTE(app, "/add/<int>/<int>")([](int a, int b) { return std::to_string(a + b); });
+    CROW_ROUTE(app, "/scale/<double>")([](double x) { return std::to_string(x); });
+    CROW_ROUTE(app, "/static/<path>")([](const std::string& path) { return path; });
+    app.validate();
+
+    auto compiled = compile_routes(
+        CROW_COMPILED_ROUTE("/")([] { return "root"; }),
+        CROW_COMPILED_ROUTE("/health")([] { return "ok"; }),
+        CROW_COMPILED_ROUTE("/users")([] { return "users"; }),
+        CROW_COMPILED_ROUTE("/users/<uint>")([](uint64_t id) { return std::to_string(id); }),
+        CROW_COMPILED_ROUTE("/users/<uint>/posts")([](uint64_t id) { return std::to_string(id); }),
+        CROW_COMPILED_ROUTE("/users/<uint>/posts/<uint>")([](uint64_t, uint64_t post) { return std::to_string(post); }),
+        CROW_COMPILED_ROUTE("/posts/<string>")([](const std::string& slug) { return slug; }),
+        CROW_COMPILED_ROUTE("/add/<int>/<int>")([](int a, int b) { return std::to_string(a + b); }),
+        CROW_COMPILED_ROUTE("/scale/<double>")([](double x) { return std::to_string(x); }),
+        CROW_COMPILED_ROUTE("/static/<path>")([](const std::string& path) { return path; }));
+
+    std::vector<request> requests;
+    for (const char* url : {"/", "/health", "/users", "/users/42", "/users/42/posts", "/users/42/posts/7",
+                            "/posts/hello-world", "/add/1/2", "/scale/1.5", "/static/css/site.css"})
+    {
+        request req;
+        req.url = url;
+        requests.push_back(std::move(req));
+    }
+
+    double runtime = measure(requests, rounds, [&](const request& req, response& res) { app.handle(req, res); });
+    double direct = measure(requests, rounds, [&](const request& req, response& res) { compiled.handle(req, res); });
+
+    std::printf("runtime router:  %8.1f ns/request\n", runtime);
+    std::printf("compiled router: %8.1f ns/request\n", direct);
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Throughput of unmasking WebSocket payloads a byte at a time against websocket::detail::unmask,
+// for whole payloads and for payloads that arrive in 4 KB reads,
+// of checking text for UTF-8 a byte at a time against websocket::detail::utf8_validator,
+// and the rate at which a server receives small messages sent back to back over one connection.
+#define CROW_MAIN
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <string>
+#include <thread>
+
+#include "crow.h"
+
+using namespace crow;
+
+namespace
+{
+    const char mask[4] = {'\x37', '\xfa', '\x21', '\x3d'};
+
+    void unmask_bytewise(char* data, size_t size, const char* key, size_t offset)
+    {
+        for (size_t i = 0; i < size; i++)
+            data[i] ^= key[(offset + i) % 4];
+    }
+
+    /// Megabytes per second through `f`, unmasking `size` bytes at `data` in `chunk` byte parts (the best of a few runs).
+    template <typename F>
+    double measure(char* data, size_t size, size_t chunk, F f)
+    {
+        size_t rounds = 400000000 / size + 1;
+        double best = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < rounds; r++)
+                for (size_t at = 0; at < size; at += chunk)
+                    f(data + at, std::min(chunk, size - at), mask, at);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            best = std::max(best, static_cast<double>(size) * rounds / std::chrono::duration<double>(elapsed).count() / 1e6);
+        }
+        return best;
+    }
+
+    /// Whether `size` bytes at `data` are valid UTF-8, decoding every byte.
+    bool utf8_bytewise(const char* data, size_t size)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size;)
+        {
+            unsigned char c = p[i++];
+            if (c < 0x80)
+                continue;
+            size_t need = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+            uint32_t code = c & (0x3f >> need);
+            if (c < 0xc2 || c > 0xf4 || i + need > size)
+                return false;
+            for (size_t j = 0; j < need; j++, i++)
+            {
+                if ((p[i] & 0xc0) != 0x80)
+                    return false;
+                code = code << 6 | (p[i] & 0x3f);
+            }
+            if ((need == 2 && code < 0x800) || (need == 3 && code < 0x10000) || (code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff)
+                return false;
+        }
+        return true;
+    }
+
+    /// Megabytes per second through `f` checking `text` for UTF-8 (the best of a few runs).
+    template <typename F>
+    double measure_utf8(const std::string& text, F f)
+    {
+        size_t rounds = 400000000 / text.size() + 1;
+        double best = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            size_t valid = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < rounds; r++)
+                valid += f(text);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if (valid != rounds)
+                std::printf("invalid text\n");
+            best = std::max(best, static_cast<double>(text.size()) * rounds / std::chrono::duration<double>(elapsed).count() / 1e6);
+        }
+        return best;
+    }
+
+    /// Thousands of `size` byte masked messages a second the server hands to its message handler.
+    double measure_messages(size_t size, unsigned count)
+    {
+        std::atomic<unsigned> received{0};
+        SimpleApp app;
+        app.loglevel(LogLevel::Warning);
+        CROW_ROUTE(app, "/ws").websocket().onmessage([&](websocket::connection&, const std::string&, bool) {
+            received++;
+        });
+        auto server = std::async(std::launch::async, [&] { app.bindaddr("127.0.0.1").port(45451).run(); });
+        app.wait_for_server_start();
+
+        asio::io_service is;
+        asio::ip::tcp::socket c(is);
+        c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 45451));
+        c.set_option(asio::ip::tcp::no_delay(true));
+        asio::write(c, asio::buffer(std::string("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+        asio::streambuf handshake;
+        asio::read_until(c, handshake, "\r\n\r\n");
+
+        std::string frame(1, '\x82');
+        frame += static_cast<char>(0x80 | size);
+        frame.append(mask, 4);
+        for (size_t i = 0; i < size; i++)
+            frame += static_cast<char>('x' ^ mask[i % 4]);
+        std::string batch;
+        for (unsigned i = 0; i < 1000; i++)
+            batch += frame;
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned sent = 0; sent < count; sent += 1000)
+            asio::write(c, asio::buffer(batch));
+        while (received < count)
+            std::this_thread::yield();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        app.stop();
+        return count / std::chrono::duration<double>(elapsed).count() / 1e3;
+    }
+}
+
+int main()
+{
+    for (size_t size : {64, 1000, 65536, 4 << 20})
+    {
+        for (size_t chunk : {size, static_cast<size_t>(4093)})
+        {
+            if (chunk > size)
+                continue;
+            std::string payload(size + 1, 'x');
+            // start one byte in, a payload rarely starts on a word boundary
+            double bytewise = measure(&payload[1], size, chunk, unmask_bytewise);
+            double kernel = measure(&payload[1], size, chunk, websocket::detail::unmask);
+            std::printf("%8zu bytes in %5zu byte reads  bytewise: %8.1f MB/s  unmask: %8.1f MB/s  (%.1fx)\n",
+                        size, chunk, bytewise, kernel, bytewise ? kernel / bytewise : 0);
+        }
+    }
+
+    std::string ascii, mixed;
+    while (ascii.size() < 65536)
+        ascii += "{\"id\": 12345, \"name\": \"a plain ASCII JSON message\", \"tags\": [\"x\", \"y\"]}\n";
+    // about one character in ten takes 2 to 4 bytes
+    while (mixed.size() < 65536)
+        mixed += "{\"name\": \"caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9" "e\", \"price\": \"4 \xe2\x82\xac\", \"mood\": \"\xf0\x9f\x98\x80\"}\n";
+    for (const std::string* text : {&ascii, &mixed})
+    {
+        double bytewise = measure_utf8(*text, [](const std::string& t) {
+            return utf8_bytewise(t.data(), t.size());
+        });
+        double validator = measure_utf8(*text, [](const std::string& t) {
+            websocket::detail::utf8_validator v;
+            return v.feed(t.data(), t.size()) && v.complete();
+        });
+        std::printf("%s text  bytewise: %8.1f MB/s  utf8_validator: %8.1f MB/s  (%.1fx)\n",
+                    text == &ascii ? "ASCII" : "mixed", bytewise, validator, bytewise ? validator / bytewise : 0);
+    }
+
+    for (size_t size : {16, 100})
+        std::printf("%8zu byte messages  %8.1f k/s\n", size, measure_messages(size, 500000));
+    return 0;
+}
@@ -253,18 +253,261 @@ TEST_CASE("RoutingTest")
   }
 }
 
+TEST_CASE("route_cache")
+{
+  SimpleApp app;
+  int A{};
+  string D{};
+
+  CROW_ROUTE(app, "/health")
+  ([] { return "OK"; });
+
+  CROW_ROUTE(app, "/item/<int>/<string>")
+  ([&](int a, string d) {
+    A = a;
+    D = d;
+    return "OK";
+  });
+
+  CROW_ROUTE(app, "/dir/")
+  ([] { return "dir"; });
+
+  app.route_cache(2);
+  app.validate();
+
+  auto get = [&](const std::string& url) {
+    request req;
+    response res;
+    req.url = url;
+    app.handle(req, res);
+    return res.code;
+  };
+
+  CHECK(200 == get("/health"));
+  CHECK(200 == get("/health"));
+  CHECK(1 == app.route_cache_stats().hits);
+  CHECK(1 == app.route_cache_stats().misses);
+
+  // parameters are cached along with the rule
+  CHECK(200 == get("/item/5/abc"));
+  A = 0;
+  D.clear();
+  CHECK(200 == get("/item/5/abc"));
+  CHECK(5 == A);
+  CHECK("abc" == D);
+  CHECK(2 == app.route_cache_stats().size);
+
+  // unknown urls are never cached
+  CHECK(404 == get("/nothing"));
+  CHECK(404 == get("/nothing"));
+  CHECK(2 == app.route_cache_stats().size);
+
+  // the redirect for a missing trailing slash is cached like any other match
+  CHECK(301 == get("/dir"));
+  CHECK(301 == get("/dir"));
+  CHECK(1 == app.route_cache_stats().evictions);
+  CHECK(2 == app.route_cache_stats().size);
+}
+
+TEST_CASE("update_routes")
+{
+  SimpleApp app;
+
+  CROW_ROUTE(app, "/a")
+  ([] { return "a"; });
+
+  CROW_ROUTE(app, "/toggle")
+  ([&app] {
+    // publishing from inside a handler must not wait for the handler itself
+    app.update_routes([](Router& router) {
+      CROW_ROUTE(router, "/c")
+      ([] { return "c"; });
+    });
+    return "toggled";
+  });
+
+  app.route_cache(8);
+  app.validate();
+
+  auto get = [&](const std::string& url) {
+    request req;
+    response res;
+    req.url = url;
+    app.handle(req, res);
+    return res.code;
+  };
+
+  CHECK(200 == get("/a"));
+  CHECK(200 == get("/a"));
+  CHECK(404 == get("/b"));
+
+  app.update_routes([](Router& router) {
+    CHECK(1 == router.remove_rule("/a"));
+    CROW_ROUTE(router, "/b/<int>")
+    ([](int x) { return std::to_string(x); });
+  });
+
+  // the cached result of the old router is gone along with it
+  CHECK(404 == get("/a"));
+  CHECK(200 == get("/b/3"));
+  // the new router keeps the thread's cache and its counters, emptied of the old results
+  CHECK(200 == get("/b/3"));
+  CHECK(2 == app.route_cache_stats().hits);
+  CHECK(1 == app.route_cache_stats().size);
+
+  // a failing update leaves the routes untouched
+  try {
+    app.update_routes([](Router& router) {
+      CROW_ROUTE(router, "/b/<int>")
+      ([](int x) { return std::to_string(x); });
+    });
+    FAIL_CHECK("duplicate rule should fail to validate");
+  } catch (std::exception&) {
+  }
+  CHECK(200 == get("/b/3"));
+
+  CHECK(404 == get("/c"));
+  CHECK(200 == get("/toggle"));
+  CHECK(200 == get("/c"));
+}
+
+TEST_CASE("rcu_ptr")
+{
+  // several pointers, read in turn
+  std::vector<std::unique_ptr<crow::detail::rcu_ptr<int>>> ptrs;
+  for (int i = 0; i < 6; i++)
+    ptrs.emplace_back(new crow::detail::rcu_ptr<int>(new int(i)));
+  for (int round = 0; round < 3; round++)
+    for (int i = 0; i < 6; i++)
+      CHECK(i == *ptrs[i]->read());
+
+  // a reader still holding the old snapshot delays its deletion
+  {
+    auto guard = ptrs[0]->read();
+    ptrs[0]->publish(std::unique_ptr<int>(new int(10)));
+    CHECK(1 == ptrs[0]->retired_count());
+    CHECK(0 == *guard);
+  }
+  CHECK(0 == ptrs[0]->retired_count());
+  CHECK(10 == *ptrs[0]->read());
+
+  // threads reading all of them while they're replaced
+  std::atomic<bool> stop{false};
+  std::atomic<int> bad{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; t++)
+    readers.emplace_back([&] {
+      while (!stop)
+        for (auto& p : ptrs)
+          if (*p->read() < 0)
+            bad++;
+    });
+  for (int round = 0; round < 200; round++)
+    for (auto& p : ptrs)
+    {
+      std::lock_guard<std::mutex> lock(p->write_mutex());
+      p->publish(std::unique_ptr<int>(new int(round)));
+    }
+  stop = true;
+  for (auto& t : readers)
+    t.join();
+  CHECK(0 == bad);
+  for (auto& p : ptrs)
+  {
+    CHECK(199 == *p->read());
+    CHECK(0 == p->retired_count());
+  }
+}
+
+TEST_CASE("compiled_routes")
+{
+  SimpleApp app;
+
+  CROW_ROUTE(app, "/runtime")
+  ([] { return "runtime"; });
+  CROW_ROUTE(app, "/post")
+  ([] { return "runtime get"; });
+
+  app.compiled_routes(crow::compile_routes(
+    CROW_COMPILED_ROUTE("/")([] { return "root"; }),
+    CROW_COMPILED_ROUTE("/add/<int>/<uint>")([](int a, unsigned b) { return std::to_string(a + b); }),
+    CROW_COMPILED_ROUTE("/half/<double>")([](double x) { return std::to_string(x / 2); }),
+    CROW_COMPILED_ROUTE("/name/<string>/greet")([](const request&, std::string name) { return "hi " + name; }),
+    CROW_COMPILED_ROUTE("/files/<path>")([](response& res, std::string path) { res.write(path); res.end(); }),
+    CROW_COMPILED_ROUTE("/post").methods("POST"_method, "PUT"_method)([](const request& req, response& res) { res.write(req.body); res.end(); }),
+    CROW_COMPILED_ROUTE("/throw")([]() -> std::string { throw std::runtime_error("fail"); }),
+    CROW_COMPILED_ROUTE("/<string>/info")([](std::string name) { return "info " + name; })));
+  app.validate();
+
+  auto get = [&](const std::string& url, HTTPMethod method, std::string& body) {
+    request req;
+    response res;
+    req.url = url;
+    req.method = method;
+    req.body = "posted";
+    app.handle(req, res);
+    body = res.body;
+    return res.code;
+  };
+
+  std::string body;
+  CHECK(200 == get("/", "GET"_method, body));
+  CHECK("root" == body);
+  CHECK(200 == get("/add/-3/5", "GET"_method, body));
+  CHECK("2" == body);
+  CHECK(404 == get("/add/3/-5", "GET"_method, body));
+  CHECK(404 == get("/add/3/5/", "GET"_method, body));
+  CHECK(200 == get("/half/5", "GET"_method, body));
+  CHECK("2.500000" == body);
+  CHECK(200 == get("/name/crow/greet", "GET"_method, body));
+  CHECK("hi crow" == body);
+  CHECK(404 == get("/name//greet", "GET"_method, body));
+  CHECK(200 == get("/files/a/b.txt", "GET"_method, body));
+  CHECK("a/b.txt" == body);
+  CHECK(404 == get("/files/", "GET"_method, body));
+  CHECK(200 == get("/post", "PUT"_method, body));
+  CHECK("posted" == body);
+  CHECK(405 == get("/post", "DELETE"_method, body));
+  CHECK(405 == get("/half/5", "POST"_method, body));
+  // a runtime route takes the methods the compiled one doesn't
+  CHECK(200 == get("/post", "GET"_method, body));
+  CHECK("runtime get" == body);
+  CHECK(200 == get("/", "HEAD"_method, body));
+  CHECK(500 == get("/throw", "GET"_method, body));
+  // rules with a parameter in the first segment are tried after the ones of that segment
+  CHECK(200 == get("/add/info", "GET"_method, body));
+  CHECK("info add" == body);
+  CHECK(200 == get("/other/info", "GET"_method, body));
+  CHECK("info other" == body);
+  CHECK(404 == get("/other", "GET"_method, body));
+
+  // urls the compiled routes don't know go to the runtime router
+  CHECK(200 == get("/runtime", "GET"_method, body));
+  CHECK("runtime" == body);
+
+  request req;
+  response res;
+  req.url = "/post";
+  req.method = "OPTIONS"_method;
+  app.handle(req, res);
+  CHECK(204 == res.code);
+  CHECK("OPTIONS, HEAD, GET, POST, PUT" == res.get_header_value("Allow"));
+}
+
 TEST_CASE("simple_response_routing_params")
 {
   CHECK(100 == response(100).code);
   CHECK(200 == response("Hello there").code);
   CHECK(500 == response(500, "Internal Error?").code);
 
+  std::string url = "/1/5/2/3/hello";
   routing_params rp;
-  rp.int_params.push_back(1);
-  rp.int_params.push_back(5);
-  rp.uint_params.push_back(2);
-  rp.double_params.push_back(3);
-  rp.string_params.push_back("hello");
+  rp.push_int(1);
+  rp.push_int(5);
+  rp.push_uint(2);
+  rp.push_double(3);
+  rp.push_string(9, 5);
+  rp.url = &url;
   CHECK(1 == rp.get<int64_t>(0));
   CHECK(5 == rp.get<int64_t>(1));
   CHECK(2 == rp.get<uint64_t>(0));
@@ -272,6 +515,81 @@ TEST_CASE("simple_response_routing_params")
   CHECK("hello" == rp.get<string>(0));
 }
 
+TEST_CASE("routing_params_positions")
+{
+  std::string url = "/1/hello/2";
+  routing_params rp;
+  rp.push_int(1);
+  rp.push_string(3, 5);
+  rp.push_double(2);
+  CHECK(1 == rp.at<int64_t>(0));
+  CHECK("hello" == std::string(rp.string_at(1, url)));
+  CHECK(2 == rp.at<double>(2));
+  CHECK("hello" == std::string(rp.get_string(0, url)));
+  CHECK_THROWS_AS(rp.get<uint64_t>(0), std::out_of_range);
+  // no url to copy the string from
+  CHECK_THROWS_AS(rp.get<std::string>(0), std::logic_error);
+  rp.url = &url;
+  CHECK("hello" == rp.get<std::string>(0));
+}
+
+// takes its parameter like an `auto` one would
+struct SizeHandler
+{
+  template <typename T>
+  std::string operator()(const T& value) const
+  {
+    return std::to_string(value.size());
+  }
+};
+
+TEST_CASE("string_view_params")
+{
+  SimpleApp app;
+
+  const char* begin = nullptr;
+  CROW_ROUTE(app, "/view/<string>/<int>")
+  ([&](boost::string_view name, int n) {
+    begin = name.data();
+    return std::string(name) + std::to_string(n);
+  });
+  CROW_ROUTE(app, "/copy/<path>")
+  ([](std::string path) { return path; });
+  CROW_ROUTE(app, "/ref/<string>")
+  ([](const request&, const std::string& name) { return name; });
+  app.route_dynamic("/dynamic/<string>")
+  ([](boost::string_view name) { return std::string(name); });
+  CROW_ROUTE(app, "/auto/<string>")
+  (SizeHandler());
+  app.compiled_routes(crow::compile_routes(
+    CROW_COMPILED_ROUTE("/compiled/<string>")(SizeHandler())));
+  app.validate();
+
+  auto get = [&](request& req) {
+    response res;
+    app.handle(req, res);
+    return res.body;
+  };
+
+  request req;
+  req.url = "/view/crow/3";
+  CHECK("crow3" == get(req));
+  // the handler got a view of the url itself
+  CHECK(req.url.data() + 6 == begin);
+
+  req.url = "/copy/a/b";
+  CHECK("a/b" == get(req));
+  req.url = "/ref/crow";
+  CHECK("crow" == get(req));
+  req.url = "/dynamic/crow";
+  CHECK("crow" == get(req));
+  // handlers taking parameters as auto get std::strings
+  req.url = "/auto/crow";
+  CHECK("4" == get(req));
+  req.url = "/compiled/crow";
+  CHECK("4" == get(req));
+}
+
 TEST_CASE("handler_with_response")
 {
   SimpleApp app;
@@ -459,6 +777,235 @@ TEST_CASE("server_handling_error_request")
   app.stop();
 }
 
+TEST_CASE("early_route_resolution")
+{
+  static char buf[2048];
+  SimpleApp app;
+  CROW_ROUTE(app, "/upload").methods("POST"_method)([](const request& req) {
+    return req.body;
+  });
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto refused = [&](const std::string& sendmsg) {
+    asio::ip::tcp::socket c(is);
+    c.connect(asio::ip::tcp::endpoint(
+        asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+    c.send(asio::buffer(sendmsg));
+
+    // answered without waiting for the body, then closed
+    size_t received = c.receive(asio::buffer(buf, 2048));
+    std::string response(buf, received);
+    boost::system::error_code ec;
+    while (!ec)
+      c.receive(asio::buffer(buf, 2048), 0, ec);
+    CHECK(asio::error::eof == ec);
+    return response.substr(0, response.find("\r\n"));
+  };
+
+  CHECK("HTTP/1.1 404 Not Found" ==
+        refused("POST /missing HTTP/1.1\r\nHost: localhost\r\nContent-Length: "
+                "100000\r\nExpect: 100-continue\r\n\r\n"));
+  CHECK("HTTP/1.1 405 Method Not Allowed" ==
+        refused("PUT /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: "
+                "100000\r\n\r\nsome of the body"));
+
+  {
+    asio::ip::tcp::socket c(is);
+    c.connect(asio::ip::tcp::endpoint(
+        asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+    c.send(asio::buffer(std::string("POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: "
+                                    "5\r\nExpect: 100-continue\r\n\r\n")));
+    size_t received = c.receive(asio::buffer(buf, 2048));
+    CHECK("HTTP/1.1 100 Continue\r\n\r\n" == std::string(buf, received));
+
+    c.send(asio::buffer(std::string("hello")));
+    received = c.receive(asio::buffer(buf, 2048));
+    std::string response(buf, received);
+    CHECK(0 == response.find("HTTP/1.1 200 OK"));
+    CHECK("hello" == response.substr(response.size() - 5));
+  }
+
+  app.stop();
+}
+
+struct RewritingMiddleware
+{
+  struct context
+  {};
+
+  void before_handle(request& req, response& /*res*/, context& /*ctx*/)
+  {
+    if (req.url.compare(0, 4, "/v1/") == 0)
+      req.url = "/api/version/one/" + req.url.substr(4);
+    if (req.url == "/delete-me")
+      req.method = "DELETE"_method;
+  }
+
+  void after_handle(request& /*req*/, response& /*res*/, context& /*ctx*/) {}
+};
+
+TEST_CASE("middleware_rewrites_route")
+{
+  static char buf[2048];
+  App<RewritingMiddleware> app;
+  CROW_ROUTE(app, "/v1/<string>")([](const std::string&) { return "old"; });
+  CROW_ROUTE(app, "/api/version/one/<string>").methods("GET"_method, "POST"_method)([](const std::string& name) { return "new " + name; });
+  CROW_ROUTE(app, "/delete-me").methods("DELETE"_method)([] { return "deleted"; });
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto get = [&](const std::string& sendmsg) {
+    asio::ip::tcp::socket c(is);
+    c.connect(asio::ip::tcp::endpoint(
+        asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+    c.send(asio::buffer(sendmsg));
+    size_t received = c.receive(asio::buffer(buf, 2048));
+    return std::string(buf, received);
+  };
+
+  // the route found from the headers is dropped once the url or the method are rewritten
+  std::string response = get("GET /v1/abc HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  CHECK("new abc" == response.substr(response.size() - 7));
+  response = get("GET /delete-me HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  CHECK("deleted" == response.substr(response.size() - 7));
+  // a body isn't refused for the route of the url it was sent to
+  response = get("POST /v1/abc HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nhello");
+  CHECK("new abc" == response.substr(response.size() - 7));
+
+  app.stop();
+}
+
+TEST_CASE("json_body_while_receiving")
+{
+  static char buf[2048];
+  SimpleApp app;
+  app.parse_json_bodies();
+  CROW_ROUTE(app, "/ingest").methods("POST"_method)([](const request& req) {
+    if (!req.json_body)
+      return "not parsed: " + req.body;
+    return std::to_string(req.json_body["values"].size()) + " values, body of " + std::to_string(req.body.size());
+  });
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto post = [&](const std::vector<std::string>& parts, const std::string& content_type) {
+    size_t length = 0;
+    for (auto& part : parts)
+      length += part.size();
+    asio::ip::tcp::socket c(is);
+    c.connect(asio::ip::tcp::endpoint(
+        asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+    c.send(asio::buffer("POST /ingest HTTP/1.1\r\nHost: localhost\r\nContent-Type: " + content_type +
+                        "\r\nContent-Length: " + std::to_string(length) + "\r\n\r\n"));
+    for (auto& part : parts)
+    {
+      c.send(asio::buffer(part));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::string response(buf, c.receive(asio::buffer(buf, 2048)));
+    return response.substr(response.find("\r\n\r\n") + 4);
+  };
+
+  CHECK("3 values, body of 0" == post({"{\"values\":[1,", "2,3", "]}"}, "application/json; charset=utf-8"));
+  CHECK("not parsed: " == post({"{\"values\":[1,", "2,3"}, "application/json"));
+  // other bodies are left alone
+  CHECK("not parsed: [1,2]" == post({"[1,2]"}, "text/plain"));
+
+  app.stop();
+}
+
+TEST_CASE("json_body_encodings")
+{
+  static char buf[2048];
+  SimpleApp app;
+  app.parse_json_bodies();
+  CROW_ROUTE(app, "/echo").methods("POST"_method)([](const request& req) {
+    return json::wvalue(req.json_body);
+  });
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto post = [&](const std::string& body, const std::string& content_type, const std::string& accept) {
+    asio::ip::tcp::socket c(is);
+    c.connect(asio::ip::tcp::endpoint(
+        asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+    c.send(asio::buffer("POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Type: " + content_type +
+                        "\r\nAccept: " + accept + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body));
+    std::string response;
+    boost::system::error_code ec;
+    while (!ec)
+      response.append(buf, c.read_some(asio::buffer(buf, 2048), ec));
+    return response;
+  };
+
+  json::wvalue x;
+  x["a"] = 1;
+  std::string response = post(x.dump(json::encoding::MessagePack), "application/msgpack", "application/cbor, application/json;q=0.9");
+  CHECK(response.find("Content-Type: application/cbor") != std::string::npos);
+  CHECK(x.dump(json::encoding::Cbor) == response.substr(response.find("\r\n\r\n") + 4));
+
+  // requests that take JSON get JSON, the response still varies with Accept
+  response = post(x.dump(json::encoding::Cbor), "application/cbor", "*/*");
+  CHECK(response.find("Content-Type: application/json") != std::string::npos);
+  CHECK(response.find("Vary: Accept") != std::string::npos);
+  CHECK(R"({"a":1})" == response.substr(response.find("\r\n\r\n") + 4));
+
+  app.stop();
+
+  // a response made outside of a request is JSON
+  json::wvalue y;
+  y["a"] = 1;
+  crow::response made(std::move(y));
+  CHECK(R"({"a":1})" == made.body);
+  CHECK("application/json" == made.get_header_value("Content-Type"));
+}
+
+TEST_CASE("request_json")
+{
+  request req;
+  req.body = R"({"user":"crow","roles":["admin"]})";
+  const request& cref = req;
+  auto& first = cref.json();
+  CHECK("crow" == first["user"].s());
+  // the same tree every time, and the body is untouched
+  CHECK(&first == &cref.json());
+  CHECK(&req.json_body == &first);
+  CHECK(R"({"user":"crow","roles":["admin"]})" == req.body);
+
+  request binary;
+  binary.add_header("Content-Type", "application/cbor");
+  binary.body = std::string("\xa1\x61\x61\x01", 4);
+  CHECK(1 == binary.json()["a"].i());
+
+  request invalid;
+  invalid.body = "{\"a\":";
+  CHECK(!invalid.json());
+  CHECK(!invalid.json());
+
+  // a body already parsed while it was received is returned as it is
+  request parsed;
+  parsed.json_body = json::load("[1,2]");
+  CHECK(2 == parsed.json().size());
+
+  // requests without a parsed body can still be copied
+  request empty;
+  empty.url = "/copy";
+  request copy(empty);
+  CHECK("/copy" == copy.url);
+  CHECK(!copy.json_body);
+  copy = invalid;
+  CHECK(!copy.json_body);
+}
+
 TEST_CASE("multi_server")
 {
   static char buf[2048];
@@ -644,6 +1191,44 @@ TEST_CASE("json_read_real")
   CHECK(ret);
 }
 
+TEST_CASE("json_numbers")
+{
+    // reading is correctly rounded, including the slow cases of the fast path
+    for (auto x : {"0.1", "-2.5e-3", "1.7976931348623157e308", "2.2250738585072011e-308", "4.9406564584124654e-324",
+                   "9007199254740993", "123456789012345678901234567890", "1e400", "1e-400"})
+    {
+        INFO(x);
+        CHECK(json::load(x).d() == std::strtod(x, nullptr));
+    }
+    CHECK(-9223372036854775807ll - 1 == json::load("-9223372036854775808").i());
+    CHECK(18446744073709551615ull == json::load("18446744073709551615").u());
+    CHECK_THROWS(json::load("18446744073709551616").u());
+
+    // writing doubles keeps every digit needed to read them back, and no more
+    json::wvalue x;
+    for (double d : {0.1, 1.0 / 3, -2.5e-3, 1e-7, 5e-324, 1.7976931348623157e308, 123456.789, 1e21})
+    {
+        x = d;
+        std::string text = x.dump();
+        INFO(text);
+        CHECK(json::load(text).d() == d);
+    }
+    x = 0.1;
+    CHECK("0.1" == x.dump());
+    x = 3.0;
+    CHECK("3" == x.dump());
+    x = 1e21;
+    CHECK("1e+21" == x.dump());
+    x = -0.00025;
+    CHECK("-0.00025" == x.dump());
+    x = std::numeric_limits<double>::infinity();
+    CHECK("null" == x.dump());
+    x = std::numeric_limits<int64_t>::min();
+    CHECK("-9223372036854775808" == x.dump());
+    x = std::numeric_limits<uint64_t>::max();
+    CHECK("18446744073709551615" == x.dump());
+}
+
 TEST_CASE("json_read_unescaping")
 {
   {
@@ -666,6 +1251,228 @@ TEST_CASE("json_read_unescaping")
   }
 }
 
+TEST_CASE("json_escape")
+{
+  // long clean runs with escapes on and around the vector boundaries
+  std::string clean(40, 'x');
+  for (size_t at : {0, 15, 16, 31, 32, 39})
+  {
+    std::string s = clean;
+    s[at] = '"';
+    std::string expected = clean.substr(0, at) + "\\\"" + clean.substr(at + 1);
+    CHECK(expected == json::escape(s));
+    CHECK(s == json::load("\"" + json::escape(s) + "\"").s());
+  }
+  CHECK(R"(a\\b\n\u0001\u001f\t\r\b\f)" == json::escape(std::string("a\\b\n\x01\x1f\t\r\b\f")));
+  CHECK("\x7f\xc3\xa9 ok" == json::escape("\x7f\xc3\xa9 ok"));
+
+  std::string text = clean + "\\n" + clean + "\\u00e9" + clean + "\\\\";
+  auto x = json::load("{\"s\":\"" + text + "\"}");
+  CHECK(clean + "\n" + clean + "\xc3\xa9" + clean + "\\" == x["s"].s());
+
+  auto t = crow::mustache::compile("{{value}}");
+  crow::mustache::context ctx;
+  ctx["value"] = clean + "<a href='/x'>&\"</a>" + clean;
+  CHECK(clean + "&lt;a href=&#39;&#x2F;x&#39;&gt;&amp;&quot;&lt;&#x2F;a&gt;" + clean == t.render(ctx));
+}
+
+TEST_CASE("json_read_parsers")
+{
+    // every input is long enough to cross the 64 byte blocks lazy documents are indexed in
+    std::string padding(70, ' ');
+    std::vector<std::string> inputs = {
+      R"({"a":1,"b":[true,false,null,-1.5e3,"x\"yA"],"c":{}})",
+      R"({"k":[{"x":"\\\""}],"e":"\\","f":"\\\\"})",
+      R"(["a\\","b",  42 , {"c" : "d"}])",
+      "  42  ",
+      "[]",
+      "[1,2",
+      "[1 2]",
+      "[tru]",
+      "truex",
+      "\"abc",
+      "[1,]",
+      "{\"a\":}",
+      "1 2",
+      R"("a\x")",
+      "[01]",
+      "",
+    };
+    std::string long_string = "[\"" + std::string(200, 'x') + "\\\"" + std::string(60, 'y') + "\\\\\"," + padding + "true]";
+    inputs.push_back(long_string);
+
+    for (auto& input : inputs)
+    {
+        for (auto& text : {input, padding + input, input + padding})
+        {
+            auto eager = json::load(text);
+            json::lazy_document lazy(text);
+            INFO(text);
+            CHECK(bool(eager) == bool(lazy));
+            if (eager && lazy)
+                CHECK(json::wvalue(eager).dump() == json::wvalue(lazy.root().materialize()).dump());
+        }
+    }
+}
+
+TEST_CASE("json_read_incremental")
+{
+    std::vector<std::string> documents = {
+      R"({"a":1,"b":[1,2.5,-3e10,"x\"y\u00e9"],"c":{"d":null,"e":true,"f":false},"k\ney":"v"})",
+      R"([ 1 , [ ] , { } , "" , 0 , -0.5 ])", "123", "\"str\"", " null ",
+      R"({"a":1,})", "[1 2]", "tru", "\"abc", "[1]x", "-", ""};
+    for (auto& text : documents)
+    {
+        std::ostringstream expected;
+        auto loaded = json::load(text);
+        if (loaded)
+            expected << loaded;
+        // every place the document can be cut at
+        for (size_t cut = 0; cut <= text.size(); cut++)
+        {
+            json::incremental_parser parser;
+            parser.feed(text.data(), cut);
+            parser.feed(text.data() + cut, text.size() - cut);
+            auto x = parser.finish();
+            CHECK(static_cast<bool>(loaded) == static_cast<bool>(x));
+            if (x)
+            {
+                std::ostringstream got;
+                got << x;
+                CHECK(expected.str() == got.str());
+            }
+        }
+    }
+
+    // one byte at a time, without knowing the size up front
+    std::string text = "{\"list\":[";
+    for (int i = 0; i < 500; i++)
+        text += (i ? "," : "") + std::string("{\"id\":") + std::to_string(i) + ",\"name\":\"n\\\"" + std::to_string(i) + "\"}";
+    text += "]}";
+    json::incremental_parser parser;
+    for (char c : text)
+        CHECK(parser.feed(&c, 1));
+    auto x = parser.finish();
+    CHECK(500 == x["list"].size());
+    CHECK("n\"499" == x["list"][499]["name"].s());
+
+    json::incremental_parser invalid;
+    CHECK_FALSE(invalid.feed("[1,}", 4));
+    CHECK_FALSE(invalid.finish());
+}
+
+TEST_CASE("json_read_lazy")
+{
+    json::lazy_document doc(R"({"a":1,"b":[1,2.5,-3e10,"x\"y\u00e9"],"c":{"d":null,"e":true,"f":false},"k\ney":"v","g":[[],{}]})");
+    REQUIRE(doc);
+    CHECK(json::type::Object == doc.root().t());
+    CHECK(1 == doc["a"].i());
+    CHECK(4 == doc["b"].size());
+    CHECK(2.5 == doc["b"][1].d());
+    CHECK(-3e10 == doc["b"][2].d());
+    CHECK("x\"y\xc3\xa9" == doc["b"][3].s());
+    CHECK(json::type::Null == doc["c"]["d"].t());
+    CHECK(doc["c"]["e"].b());
+    CHECK_FALSE(doc["c"]["f"].b());
+    CHECK("v" == doc["k\ney"].s());
+    CHECK(doc["c"].has("d"));
+    CHECK_FALSE(doc["c"].has("x"));
+    CHECK(std::vector<std::string>{"d", "e", "f"} == doc["c"].keys());
+    CHECK(0 == doc["g"][0].size());
+    CHECK(0 == doc["g"][1].size());
+    CHECK(R"([1,2.5,-3e10,"x\"y\u00e9"])" == doc["b"].raw());
+    CHECK(3 == doc["c"].materialize().size());
+
+    std::vector<std::string> keys;
+    for (auto member : doc.root())
+        keys.push_back(member.key());
+    CHECK((std::vector<std::string>{"a", "b", "c", "k\ney", "g"}) == keys);
+
+    CHECK_THROWS(doc["x"]);
+    CHECK_THROWS(doc["b"][4]);
+    CHECK_THROWS(doc["a"].s());
+    CHECK_THROWS(doc["b"]["a"]);
+
+    for (std::string text : {R"({"a":1,})", "[1 2]", "tru", "\"abc", "[1]x", "[1]]", "{\"a\"}", "\"\\q\"", "-", ""})
+    {
+        json::lazy_document invalid(text);
+        CHECK_FALSE(invalid);
+        CHECK_THROWS(invalid.root());
+    }
+}
+
+TEST_CASE("json_encodings")
+{
+    // from the examples of RFC 8949 and the MessagePack specification
+    auto cbor = [](const std::string& bytes) {
+        std::ostringstream os;
+        os << json::load(bytes, json::encoding::Cbor);
+        return os.str();
+    };
+    auto msgpack = [](const std::string& bytes) {
+        std::ostringstream os;
+        os << json::load(bytes, json::encoding::MessagePack);
+        return os.str();
+    };
+    CHECK("1000000000000" == cbor(std::string("\x1b\x00\x00\x00\xe8\xd4\xa5\x10\x00", 9)));
+    CHECK("-1000" == cbor("\x39\x03\xe7"));
+    CHECK("1.1" == cbor("\xfb\x3f\xf1\x99\x99\x99\x99\x99\x9a"));
+    CHECK(-4.0 == json::load(std::string("\xf9\xc4\x00", 3), json::encoding::Cbor).d());
+    CHECK("null" == cbor(std::string("\xf9\x7c\x00", 3)));
+    CHECK("\"2013-03-21T20:04:00Z\"" == cbor("\xc0\x74" "2013-03-21T20:04:00Z"));
+    CHECK("[1,[2,3],[4,5]]" == cbor("\x9f\x01\x82\x02\x03\x9f\x04\x05\xff\xff"));
+    CHECK(R"({"a":1,"b":[2,3]})" == cbor("\xbf\x61\x61\x01\x61\x62\x9f\x02\x03\xff\xff"));
+    CHECK("\"streaming\"" == cbor("\x7f\x65strea\x64ming\xff"));
+    CHECK("-129" == msgpack("\xd1\xff\x7f"));
+    CHECK("-32" == msgpack("\xe0"));
+    CHECK("18446744073709551615" == msgpack("\xcf\xff\xff\xff\xff\xff\xff\xff\xff"));
+    CHECK("1.5" == msgpack(std::string("\xca\x3f\xc0\x00\x00", 5)));
+    CHECK(R"([null,"a",true])" == msgpack("\x93\xc0\xd9\x01" "a\xc3"));
+
+    for (std::string invalid : std::vector<std::string>{"", "\x18", "\x7f\x61\x61", "\xa1\x01\x61\x61", "\x9f", std::string("\x00\x00", 2)})
+        CHECK_FALSE(json::load(invalid, json::encoding::Cbor));
+    for (std::string invalid : {"", "\xc1", "\xa2\x61", "\x81\x01\x01", "\xd4\x01\x02", "\x92\x01"})
+        CHECK_FALSE(json::load(invalid, json::encoding::MessagePack));
+
+    json::wvalue x;
+    x["small"] = 5;
+    x["negative"] = -100000;
+    x["min"] = INT64_MIN;
+    x["big"] = uint64_t(1) << 40;
+    x["fraction"] = 0.1;
+    x["whole"] = 2.0;
+    x["text"] = std::string(300, 'x');
+    x["flag"] = true;
+    x["nothing"] = nullptr;
+    x["list"][2]["key"] = "\xc3\xa9\"";
+    std::ostringstream expected;
+    expected << json::load(x.dump());
+    for (auto e : {json::encoding::MessagePack, json::encoding::Cbor})
+    {
+        std::string bytes = x.dump(e);
+        CHECK(bytes.size() < x.dump().size());
+        auto y = json::load(bytes, e);
+        REQUIRE(y);
+        std::ostringstream got;
+        got << y;
+        CHECK(expected.str() == got.str());
+        CHECK(INT64_MIN == y["min"].i());
+        CHECK(json::num_type::Floating_point == y["whole"].nt());
+        for (size_t cut = 0; cut < bytes.size(); cut++)
+            CHECK_FALSE(json::load(bytes.data(), cut, e));
+    }
+
+    CHECK(json::encoding::MessagePack == json::negotiate("application/msgpack"));
+    CHECK(json::encoding::Json == json::negotiate("application/json, application/cbor"));
+    CHECK(json::encoding::Cbor == json::negotiate("application/json;q=0.5, application/cbor"));
+    CHECK(json::encoding::Json == json::negotiate("text/html, */*;q=0.1"));
+    CHECK(json::encoding::Json == json::negotiate("application/cbor;q=0"));
+    json::encoding e;
+    CHECK(json::encoding_of("application/x-msgpack", e));
+    CHECK(json::encoding::MessagePack == e);
+    CHECK_FALSE(json::encoding_of("text/plain", e));
+}
+
 TEST_CASE("json_read_string")
 {
     auto x = json::load(R"({"message": 53})");
@@ -684,6 +1491,33 @@ TEST_CASE("json_read_container")
     CHECK (8 == int(x.lo()[2].lo()[3]));
 }
 
+TEST_CASE("json_read_large_object")
+{
+    std::string text = "{";
+    for (int i = 0; i < 1000; i++)
+        text += "\"key" + std::to_string(i) + "\":" + std::to_string(i) + ",";
+    text += "\"key7\":-1}";
+
+    auto x = json::load(text);
+    for (int i = 0; i < 1000; i += 37)
+        CHECK(i == x["key" + std::to_string(i)].i());
+    CHECK(x.has("key999"));
+    CHECK_FALSE(x.has("key1000"));
+    CHECK_THROWS(x["missing"]);
+    // the first of duplicated keys wins, and lookups don't reorder the members
+    CHECK(7 == x["key7"].i());
+    CHECK("key0" == x.keys()[0]);
+    CHECK("key7" == x.keys()[1000]);
+
+    auto y = x;
+    CHECK(500 == y["key500"].i());
+
+    auto small = json::load(R"({"b":1,"a":2,"b":3})");
+    CHECK(1 == small["b"].i());
+    CHECK_FALSE(small.has("c"));
+    CHECK(std::vector<std::string>({"b", "a", "b"}) == small.keys());
+}
+
 TEST_CASE("json_write")
 {
   json::wvalue x;
@@ -719,25 +1553,201 @@ TEST_CASE("json_write")
   CHECK(R"({"scores":[1,2,3]})" == y.dump());
 }
 
-TEST_CASE("json_copy_r_to_w_to_w_to_r")
+TEST_CASE("json_write_arena")
 {
-  json::rvalue r = json::load(
-      R"({"smallint":2,"bigint":2147483647,"fp":23.43,"fpsc":2.343e1,"str":"a string","trueval":true,"falseval":false,"nullval":null,"listval":[1,2,"foo","bar"],"obj":{"member":23,"other":"baz"}})");
-  json::wvalue v{r};
-  json::wvalue w(v);
-  json::rvalue x =
-      json::load(w.dump());  // why no copy-ctor wvalue -> rvalue?
-  CHECK(2 == x["smallint"]);
-  CHECK(2147483647 == x["bigint"]);
-  CHECK(23.43 == x["fp"]);
-  CHECK(23.43 == x["fpsc"]);
-  CHECK("a string" == x["str"]);
-  CHECK(x["trueval"].b());
-  REQUIRE_FALSE(x["falseval"].b());
-  CHECK(json::type::Null == x["nullval"].t());
-  CHECK(4u == x["listval"].size());
-  CHECK(1 == x["listval"][0]);
-  CHECK(2 == x["listval"][1]);
+    auto x = json::wvalue::arena_object(4);
+    x["zeta"] = 1;
+    x["alpha"] = "a";
+    x["list"][2] = true;
+    x["obj"]["b"] = 2;
+    x["obj"]["a"] = nullptr;
+    x["zeta"] = 7;
+    // members are written in insertion order
+    CHECK(R"({"zeta":7,"alpha":"a","list":[null,null,true],"obj":{"b":2,"a":null}})" == x.dump());
+    CHECK(1 == x.count("alpha"));
+    CHECK(0 == x.count("beta"));
+    CHECK(std::vector<std::string>({"zeta", "alpha", "list", "obj"}) == x.keys());
+
+    json::wvalue copy = x;
+    copy["alpha"] = "b";
+    CHECK(R"("a")" == x["alpha"].dump());
+    CHECK(R"({"b":2,"a":null})" == copy["obj"].dump());
+
+    json::wvalue obj = std::move(x["obj"]);
+    CHECK(R"({"b":2,"a":null})" == obj.dump());
+
+    auto list = json::wvalue::arena_list(2);
+    list.append() = 1;
+    list.append()["x"] = "two";
+    list.append() = std::vector<int>{3, 4};
+    CHECK(3 == list.size());
+    CHECK(R"([1,{"x":"two"},[3,4]])" == list.dump());
+
+    auto large = json::wvalue::arena_object();
+    for (int i = 0; i < 100; i++)
+        large.append("key" + std::to_string(i)) = i;
+    large["key50"] = -1;
+    CHECK(100 == large.keys().size());
+    CHECK("-1" == large["key50"].dump());
+    CHECK(1 == large.count("key99"));
+
+    json::wvalue outlived;
+    {
+        auto inner = json::wvalue::arena_object();
+        inner["list"][1] = "b";
+        outlived = std::move(inner["list"]);
+        auto other = json::wvalue::arena_list();
+        other.append() = 1;
+        large["other"] = std::move(other);
+    }
+    CHECK(R"([null,"b"])" == outlived.dump());
+    CHECK("[1]" == large["other"].dump());
+
+    json::arena shared;
+    json::wvalue first(shared), second(shared);
+    first["a"] = 1;
+    second["b"] = std::move(first);
+    second["c"] = 2;
+    second["c"]["d"] = 3;
+    CHECK(R"({"b":{"a":1},"c":{"d":3}})" == second.dump());
+}
+
+TEST_CASE("json_writer")
+{
+    std::vector<std::string> chunks;
+    {
+        json::writer w([&](const char* data, size_t size) {
+            chunks.emplace_back(data, size);
+        }, 64);
+        json::wvalue nested;
+        nested["x"] = 1;
+        w.begin_object();
+        w.key("name").value("quote\"d");
+        w.key("list").begin_array();
+        for (int i = 0; i < 30; i++)
+            w.value(i);
+        w.value(0.5).value(nullptr).value(false).value(nested);
+        w.end_array();
+        w.key("empty").begin_object().end_object();
+        w.end_object();
+        CHECK(w.done());
+        CHECK_THROWS(w.value(1));
+    }
+    CHECK(chunks.size() > 1);
+    std::string text;
+    for (auto& chunk : chunks)
+        text += chunk;
+    auto x = json::load(text);
+    CHECK(x);
+    CHECK("quote\"d" == x["name"].s());
+    CHECK(34 == x["list"].size());
+    CHECK(29 == x["list"][29].i());
+    CHECK(1 == x["list"][33]["x"].i());
+    CHECK(R"({"name":"quote\"d","list":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,0.5,null,false,{"x":1}],"empty":{}})" == text);
+
+    json::writer w([](const char*, size_t) {});
+    w.begin_object();
+    CHECK_THROWS(w.value(1));
+    CHECK_THROWS(w.end_array());
+    w.key("a");
+    CHECK_THROWS(w.key("b"));
+    CHECK_THROWS(w.end_object());
+}
+
+namespace json_struct_test
+{
+    struct user
+    {
+        std::string name;
+        int age;
+        bool admin;
+        std::vector<std::string> tags;
+    };
+    CROW_JSON_STRUCT(user, name, age, admin, tags)
+
+    struct page
+    {
+        std::vector<user> users;
+        std::map<std::string, double> stats;
+        unsigned total;
+    };
+    CROW_JSON_STRUCT(page, users, stats, total)
+}
+
+TEST_CASE("json_struct")
+{
+    using namespace json_struct_test;
+    page p{{{"a\"b", 3, true, {"x", "y"}}, {"c", -4, false, {}}}, {{"mean", 1.5}}, 2};
+    std::string text = json::serialize(p);
+    CHECK(R"({"users":[{"name":"a\"b","age":3,"admin":true,"tags":["x","y"]},{"name":"c","age":-4,"admin":false,"tags":[]}],"stats":{"mean":1.5},"total":2})" == text);
+
+    page read{};
+    CHECK(json::deserialize(text, read));
+    CHECK(text == json::serialize(read));
+
+    user u{};
+    CHECK(json::deserialize(R"({"age":7,"other":[1,{}]})", u));
+    CHECK(7 == u.age);
+    CHECK(u.name.empty());
+    CHECK_FALSE(json::deserialize(R"({"age":"7"})", u));
+    CHECK_FALSE(json::deserialize(R"({"age":1e20})", u));
+    CHECK_FALSE(json::deserialize(R"({"age":1)", u));
+    CHECK_FALSE(json::deserialize(R"([])", u));
+    CHECK_FALSE(json::deserialize(R"({"total":-1})", read));
+
+    SimpleApp app;
+    CROW_ROUTE(app, "/user")
+    ([] {
+        return user{"n", 1, false, {}};
+    });
+    CROW_ROUTE(app, "/user").methods("POST"_method)([](const request& req) {
+        user u{};
+        if (!json::deserialize(req.body, u))
+            return response(400);
+        u.age++;
+        return response(201, u);
+    });
+    app.validate();
+
+    {
+        request req;
+        response res;
+        req.url = "/user";
+        app.handle(req, res);
+        CHECK(R"({"name":"n","age":1,"admin":false,"tags":[]})" == res.body);
+        CHECK("application/json" == res.get_header_value("Content-Type"));
+    }
+    {
+        request req;
+        response res;
+        req.url = "/user";
+        req.method = "POST"_method;
+        req.body = R"({"name":"m","age":41})";
+        app.handle(req, res);
+        CHECK(201 == res.code);
+        CHECK(R"({"name":"m","age":42,"admin":false,"tags":[]})" == res.body);
+    }
+}
+
+TEST_CASE("json_copy_r_to_w_to_w_to_r")
+{
+  json::rvalue r = json::load(
+      R"({"smallint":2,"bigint":2147483647,"fp":23.43,"fpsc":2.343e1,"str":"a string","trueval":true,"falseval":false,"nullval":null,"listval":[1,2,"foo","bar"],"obj":{"member":23,"other":"baz"}})");
+  json::wvalue v{r};
+  json::wvalue w(v);
+  json::rvalue x =
+      json::load(w.dump());  // why no copy-ctor wvalue -> rvalue?
+  CHECK(2 == x["smallint"]);
+  CHECK(2147483647 == x["bigint"]);
+  CHECK(23.43 == x["fp"]);
+  CHECK(23.43 == x["fpsc"]);
+  CHECK("a string" == x["str"]);
+  CHECK(x["trueval"].b());
+  REQUIRE_FALSE(x["falseval"].b());
+  CHECK(json::type::Null == x["nullval"].t());
+  CHECK(4u == x["listval"].size());
+  CHECK(1 == x["listval"][0]);
+  CHECK(2 == x["listval"][1]);
   CHECK("foo" == x["listval"][2]);
   CHECK("bar" == x["listval"][3]);
   CHECK(23 == x["obj"]["member"]);
@@ -1499,6 +2509,105 @@ TEST_CASE("stream_response")
     runTest.join();
 }
 
+TEST_CASE("produced_body")
+{
+  SimpleApp app;
+  CROW_ROUTE(app, "/export")
+  ([](const crow::request&, crow::response& res) {
+    res.set_header("Content-Type", "application/json");
+    res.set_body_producer([](const crow::response::body_sink& sink) {
+      json::writer w(sink, 1024);
+      w.begin_array();
+      for (int i = 0; i < 5000; i++)
+        w.begin_object().key("id").value(i).end_object();
+      w.end_array();
+    });
+    res.end();
+  });
+  CROW_ROUTE(app, "/broken")
+  ([](const crow::request&, crow::response& res) {
+    res.set_body_producer([](const crow::response::body_sink& sink) {
+      sink("partial", 7);
+      throw 42;
+    });
+    res.end();
+  });
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto get = [&](const std::string& sendmsg) {
+    asio::ip::tcp::socket c(is);
+    c.connect(asio::ip::tcp::endpoint(
+        asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+    c.send(asio::buffer(sendmsg));
+    std::string response;
+    char buf[4096];
+    boost::system::error_code ec;
+    while (!ec)
+      response.append(buf, c.receive(asio::buffer(buf), 0, ec));
+    return response;
+  };
+
+  std::string response = get("GET /export HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+  auto body_start = response.find("\r\n\r\n") + 4;
+  CHECK(response.find("Transfer-Encoding: chunked") < body_start);
+  CHECK(response.find("Content-Length") == std::string::npos);
+  std::string body;
+  for (size_t pos = body_start;;)
+  {
+    size_t size = std::stoul(response.substr(pos), nullptr, 16);
+    pos = response.find("\r\n", pos) + 2;
+    if (size == 0)
+      break;
+    body += response.substr(pos, size);
+    pos += size + 2;
+  }
+  auto x = json::load(body);
+  CHECK(5000 == x.size());
+  CHECK(4999 == x[4999]["id"].i());
+
+  // HTTP/1.0 has no chunks, the body ends with the connection
+  response = get("GET /export HTTP/1.0\r\n\r\n");
+  body = response.substr(response.find("\r\n\r\n") + 4);
+  CHECK(response.find("Transfer-Encoding") == std::string::npos);
+  CHECK(5000 == json::load(body).size());
+
+  // a producer throwing anything ends the chunks and the connection, without taking the server down
+  response = get("GET /broken HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  CHECK(response.find("7\r\npartial\r\n0\r\n\r\n") != std::string::npos);
+  response = get("GET /export HTTP/1.0\r\n\r\n");
+  CHECK(5000 == json::load(response.substr(response.find("\r\n\r\n") + 4)).size());
+
+  app.stop();
+}
+
+TEST_CASE("websocket_unmask")
+{
+  const char mask[4] = {'\x67', '\xc6', '\x69', '\x73'};
+  std::string payload;
+  for (int i = 0; i < 200; i++)
+    payload += static_cast<char>(i * 7);
+  std::string expected = payload;
+  for (size_t i = 0; i < expected.size(); i++)
+    expected[i] ^= mask[i % 4];
+
+  // every start alignment, in one piece and in parts of odd sizes
+  for (size_t start = 0; start < 8; start++)
+  {
+    std::string buffer(start, ' ');
+    buffer += payload;
+    websocket::detail::unmask(&buffer[start], payload.size(), mask, 0);
+    CHECK(expected == buffer.substr(start));
+
+    buffer = std::string(start, ' ') + payload;
+    for (size_t at = 0, part = 1; at < payload.size(); at += part, part += 3)
+      websocket::detail::unmask(&buffer[start + at], std::min(part, payload.size() - at), mask, at);
+    CHECK(expected == buffer.substr(start));
+  }
+}
+
 TEST_CASE("websocket")
 {
   static std::string http_message = "GET /ws HTTP/1.1\r\nConnection: keep-alive, Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
@@ -1520,6 +2629,8 @@ TEST_CASE("websocket")
           conn.send_text("Hello back");
       else if (isbin && message == "Hello bin")
           conn.send_binary("Hello back bin");
+      else if (isbin && message == std::string(5000, 'x'))
+          conn.send_binary("Hello back big");
   })
   .onclose([&](websocket::connection&, const std::string&){
       CROW_LOG_INFO << "Closing websocket";
@@ -1619,6 +2730,42 @@ TEST_CASE("websocket")
     std::string checkstring4(std::string(buf).substr(0, 16));
     CHECK(checkstring4 == "\x82\x0EHello back bin");
   }
+  //----------Masked Binary in several reads----------
+  {
+    std::fill_n (buf, 2048, 0);
+    std::string big_masked_message("\x82\xfe\x13\x88"
+                                   "\x67\xc6\x69\x73", 8);
+    const char mask[4] = {'\x67', '\xc6', '\x69', '\x73'};
+    for (int i = 0; i < 5000; i++)
+      big_masked_message += static_cast<char>('x' ^ mask[i % 4]);
+
+    c.send(asio::buffer(big_masked_message));
+    c.receive(asio::buffer(buf, 2048));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::string checkstring5(std::string(buf).substr(0, 16));
+    CHECK(checkstring5 == "\x82\x0EHello back big");
+  }
+  //----------Several frames in one read, a header split between reads----------
+  {
+    std::fill_n (buf, 2048, 0);
+    std::string frames("\x81\x05"
+                       "Hello"
+                       "\x81\x85"
+                       "\x67\xc6\x69\x73"
+                       "\x2f\xa3\x05\x1f\x08"
+                       "\x82\x89\x67", 21);
+    c.send(asio::buffer(frames));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    c.send(asio::buffer(std::string("\xc6\x69\x73"
+                                    "\x2f\xa3\x05\x1f\x08\xe6\x0b\x1a\x09", 12)));
+
+    std::string replies;
+    while (replies.size() < 12 + 12 + 16)
+        replies.append(buf, c.receive(asio::buffer(buf, 2048)));
+    CHECK(replies == "\x81\x0AHello back"
+                     "\x81\x0AHello back"
+                     "\x82\x0EHello back bin");
+  }
   //----------Close----------
   {
     std::fill_n (buf, 2048, 0);
@@ -1633,6 +2780,1129 @@ TEST_CASE("websocket")
   app.stop();
 }
 
+TEST_CASE("websocket_channels")
+{
+  SimpleApp app;
+
+  CROW_ROUTE(app, "/ws").websocket()
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "join")
+      {
+          app.channel("room").subscribe(conn);
+          conn.send_text("joined");
+      }
+      else if (message == "leave")
+      {
+          app.channel("room").unsubscribe(conn);
+          conn.send_text("left");
+      }
+      else
+          app.channel("room").publish_text(message);
+  });
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).concurrency(2).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer(std::string("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  auto receive = [](asio::ip::tcp::socket& c) {
+      char header[2];
+      asio::read(c, asio::buffer(header, 2));
+      std::string payload(header[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      return payload;
+  };
+
+  // the two connections are on different workers
+  asio::ip::tcp::socket a(is), b(is);
+  connect(a);
+  connect(b);
+  send(a, "join");
+  CHECK("joined" == receive(a));
+  send(b, "join");
+  CHECK("joined" == receive(b));
+  CHECK(2 == app.channel("room").size());
+
+  send(a, "hello");
+  CHECK("hello" == receive(a));
+  CHECK("hello" == receive(b));
+
+  send(b, "leave");
+  CHECK("left" == receive(b));
+  send(a, "only a");
+  CHECK("only a" == receive(a));
+
+  // a closed connection leaves by itself
+  send(b, "join");
+  CHECK("joined" == receive(b));
+  b.close();
+  for (int i = 0; i < 100 && app.channel("room").size() != 1; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(1 == app.channel("room").size());
+  send(a, "bye");
+  CHECK("bye" == receive(a));
+
+  app.stop();
+}
+
+TEST_CASE("websocket_channel_backpressure")
+{
+  SimpleApp app;
+
+  // a subscriber whose queue fills up leaves the channel and tells the others, while the channel is sending to it
+  auto onmessage = [&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "join")
+      {
+          app.channel("busy").subscribe(conn);
+          conn.send_text("joined");
+      }
+      else if (message == "flood")
+      {
+          for (int i = 0; i < 4; i++)
+              app.channel("busy").publish_text(std::string(2000, '0' + i));
+      }
+      else
+          app.channel("busy").publish_text(message);
+  };
+  CROW_ROUTE(app, "/small").websocket().send_queue(3000, 1000, websocket::overflow::drop_newest)
+  .onbackpressure([&](websocket::connection& conn, bool is_full){
+      if (is_full)
+      {
+          app.channel("busy").unsubscribe(conn);
+          app.channel("busy").publish_text("left");
+      }
+  })
+  .onmessage(onmessage);
+  CROW_ROUTE(app, "/large").websocket().onmessage(onmessage);
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c, const std::string& url) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer("GET " + url + " HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  auto receive = [](asio::ip::tcp::socket& c) {
+      unsigned char header[4];
+      asio::read(c, asio::buffer(header, 2));
+      size_t size = header[1] & 0x7f;
+      if (size == 126)
+      {
+          asio::read(c, asio::buffer(header + 2, 2));
+          size = header[2] << 8 | header[3];
+      }
+      std::string payload(size, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      // the first byte of the payload stands for a long message
+      return size > 20 ? payload.substr(0, 1) : payload;
+  };
+
+  asio::ip::tcp::socket a(is), b(is);
+  connect(a, "/small");
+  connect(b, "/large");
+  send(a, "join");
+  CHECK("joined" == receive(a));
+  send(b, "join");
+  CHECK("joined" == receive(b));
+
+  send(a, "flood");
+  CHECK("0" == receive(a));
+  std::vector<std::string> received;
+  for (int i = 0; i < 5; i++)
+      received.push_back(receive(b));
+  std::sort(received.begin(), received.end());
+  CHECK((std::vector<std::string>{"0", "1", "2", "3", "left"}) == received);
+  CHECK(1 == app.channel("busy").size());
+
+  // the one left in the channel is still found where it is
+  send(a, "join");
+  CHECK("joined" == receive(a));
+  CHECK(2 == app.channel("busy").size());
+  send(b, "hello");
+  CHECK("hello" == receive(a));
+  CHECK("hello" == receive(b));
+
+  app.stop();
+}
+
+TEST_CASE("websocket_deflate_negotiation")
+{
+  int bits = 15;
+  bool takeover = true;
+  std::string response;
+  CHECK(websocket::detail::negotiate_deflate("permessage-deflate; client_max_window_bits", bits, takeover, response));
+  CHECK(15 == bits);
+  CHECK(takeover);
+  CHECK("permessage-deflate" == response);
+
+  CHECK(websocket::detail::negotiate_deflate("x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=\"10\"; server_no_context_takeover", bits, takeover, response));
+  CHECK(10 == bits);
+  CHECK(!takeover);
+  CHECK("permessage-deflate; server_no_context_takeover; server_max_window_bits=10" == response);
+
+  // the first offer the server can accept is picked
+  bits = 15;
+  takeover = true;
+  CHECK(websocket::detail::negotiate_deflate("permessage-deflate; server_max_window_bits=8, permessage-deflate; client_no_context_takeover", bits, takeover, response));
+  CHECK(15 == bits);
+  CHECK("permessage-deflate; client_no_context_takeover" == response);
+
+  // the server's own settings are kept when the client doesn't lower them
+  bits = 12;
+  takeover = false;
+  CHECK(websocket::detail::negotiate_deflate("permessage-deflate; server_max_window_bits=14", bits, takeover, response));
+  CHECK(12 == bits);
+  CHECK("permessage-deflate; server_no_context_takeover; server_max_window_bits=12" == response);
+
+  CHECK_FALSE(websocket::detail::negotiate_deflate("", bits, takeover, response));
+  CHECK_FALSE(websocket::detail::negotiate_deflate("permessage-deflate; unknown", bits, takeover, response));
+  CHECK_FALSE(websocket::detail::negotiate_deflate("permessage-deflate; server_max_window_bits=x", bits, takeover, response));
+  CHECK_FALSE(websocket::detail::negotiate_deflate("permessage-deflate; server_no_context_takeover; server_no_context_takeover", bits, takeover, response));
+}
+
+TEST_CASE("websocket_permessage_deflate")
+{
+  SimpleApp app;
+
+  CROW_ROUTE(app, "/ws").websocket()
+  .permessage_deflate(15, false)
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "join")
+      {
+          app.channel("deflate").subscribe(conn);
+          conn.send_text("joined");
+      }
+      else
+          app.channel("deflate").publish_text(message);
+  });
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).concurrency(2).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c, const std::string& extensions) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n" + extensions + "\r\n"));
+      asio::streambuf handshake;
+      size_t size = asio::read_until(c, handshake, "\r\n\r\n");
+      return std::string(asio::buffers_begin(handshake.data()), asio::buffers_begin(handshake.data()) + size);
+  };
+  compression::message_deflater deflater(15, true);
+  auto send = [&](asio::ip::tcp::socket& c, const std::string& message, bool compressed) {
+      std::string payload;
+      if (compressed)
+          deflater.compress(message.data(), message.size(), payload);
+      else
+          payload = message;
+      c.send(asio::buffer(std::string(1, compressed ? '\xc1' : '\x81') + std::string(1, static_cast<char>(payload.size())) + payload));
+  };
+  compression::message_inflater inflater;
+  auto receive = [&](asio::ip::tcp::socket& c, bool& compressed) {
+      unsigned char header[4];
+      asio::read(c, asio::buffer(header, 2));
+      compressed = (header[0] & 0x40) != 0;
+      size_t size = header[1] & 0x7f;
+      if (size == 126)
+      {
+          asio::read(c, asio::buffer(header + 2, 2));
+          size = (header[2] << 8) | header[3];
+      }
+      std::string payload(size, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      std::string message;
+      if (!compressed)
+          return payload;
+      CHECK(inflater.decompress(payload, message));
+      return message;
+  };
+
+  asio::ip::tcp::socket a(is), b(is);
+  std::string handshake = connect(a, "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n");
+  CHECK(handshake.find("Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover\r\n") != std::string::npos);
+  handshake = connect(b, "");
+  CHECK(handshake.find("Sec-WebSocket-Extensions") == std::string::npos);
+
+  bool compressed;
+  send(a, "join", true);
+  CHECK("joined" == receive(a, compressed));
+  CHECK(compressed);
+  send(b, "join", false);
+  CHECK("joined" == receive(b, compressed));
+  CHECK(!compressed);
+
+  // published once, compressed for the client that asked for it only
+  std::string text;
+  for (int i = 0; i < 20; i++)
+      text += "hello ";
+  send(a, text, true);
+  CHECK(text == receive(a, compressed));
+  CHECK(compressed);
+  CHECK(text == receive(b, compressed));
+  CHECK(!compressed);
+  send(b, "bye", false);
+  CHECK("bye" == receive(a, compressed));
+  CHECK("bye" == receive(b, compressed));
+
+  // a compressed frame on a connection without permessage-deflate is a protocol error
+  send(b, "bye", true);
+  unsigned char close[4];
+  asio::read(b, asio::buffer(close, 4));
+  CHECK(0x88 == close[0]);
+  CHECK(0x03 == close[2]);
+  CHECK(0xea == close[3]);
+
+  app.stop();
+}
+
+TEST_CASE("websocket_send_queue")
+{
+  SimpleApp app;
+  std::atomic<int> full{0}, drained{0};
+  std::atomic<websocket::connection*> blocking{nullptr};
+
+  auto flood = [&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "flood")
+      {
+          // the first message is being written while the others are queued
+          for (int i = 0; i < 10; i++)
+              conn.send_text(std::string(10000, '0' + i));
+      }
+      else
+          conn.send_text("dropped " + std::to_string(conn.send_queue().dropped_messages));
+  };
+  auto backpressure = [&](websocket::connection&, bool is_full){
+      (is_full ? full : drained)++;
+  };
+  CROW_ROUTE(app, "/newest").websocket().send_queue(50000, 10000, websocket::overflow::drop_newest).onbackpressure(backpressure).onmessage(flood);
+  CROW_ROUTE(app, "/oldest").websocket().send_queue(50000, 10000, websocket::overflow::drop_oldest).onmessage(flood);
+  CROW_ROUTE(app, "/close").websocket().send_queue(50000, 10000, websocket::overflow::close).onmessage(flood);
+  CROW_ROUTE(app, "/block").websocket().send_queue(2000000, 1000000, websocket::overflow::block).onbackpressure(backpressure)
+  .onopen([&](websocket::connection& conn){
+      blocking = &conn;
+  })
+  .onmessage(flood);
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c, const std::string& url) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer("GET " + url + " HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  auto receive = [](asio::ip::tcp::socket& c) {
+      unsigned char header[10];
+      asio::read(c, asio::buffer(header, 2));
+      size_t size = header[1] & 0x7f;
+      if (size >= 126)
+      {
+          size_t extra = size == 126 ? 2 : 8;
+          asio::read(c, asio::buffer(header + 2, extra));
+          size = 0;
+          for (size_t i = 0; i < extra; i++)
+              size = (size << 8) | header[2 + i];
+      }
+      std::string payload(size, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      // the first byte of the payload stands for the message
+      return (header[0] & 0x0f) == 0x8 ? std::string("close ") + std::to_string((payload[0] & 0xff) << 8 | (payload[1] & 0xff)) : size > 20 ? payload.substr(0, 1) : payload;
+  };
+
+  SECTION("drop newest")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/newest");
+      send(c, "flood");
+      for (auto expected : {"0", "1", "2", "3"})
+          CHECK(expected == receive(c));
+      send(c, "stats");
+      CHECK("dropped 6" == receive(c));
+      CHECK(1 == full);
+      CHECK(1 == drained);
+  }
+
+  SECTION("drop oldest")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/oldest");
+      send(c, "flood");
+      for (auto expected : {"0", "7", "8", "9"})
+          CHECK(expected == receive(c));
+      send(c, "stats");
+      CHECK("dropped 6" == receive(c));
+  }
+
+  SECTION("close")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/close");
+      send(c, "flood");
+      for (auto expected : {"0", "1", "2", "3", "close 1008"})
+          CHECK(expected == receive(c));
+  }
+
+  SECTION("block")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/block");
+      for (int i = 0; i < 100 && !blocking; i++)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      // far more than the socket buffers hold, so the sender has to wait for the client
+      std::atomic<int> sent{0};
+      std::thread producer([&] {
+          for (int i = 0; i < 20; i++, sent++)
+              blocking.load()->send_binary(std::string(1000000, 'a' + i));
+      });
+      for (int i = 0; i < 500 && !full; i++)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      CHECK(full > 0);
+      CHECK(sent < 20);
+      for (int i = 0; i < 20; i++)
+          CHECK(std::string(1, 'a' + i) == receive(c));
+      producer.join();
+      send(c, "stats");
+      CHECK("dropped 0" == receive(c));
+  }
+
+  app.stop();
+}
+
+TEST_CASE("websocket_deflate_send_queue")
+{
+  SimpleApp app;
+
+  // messages that don't compress, the first byte standing for the message
+  auto noise = [](int i) {
+      std::string block(10000, '\0');
+      uint32_t x = 12345 + i;
+      for (auto& c : block)
+      {
+          x = x * 1103515245 + 12345;
+          c = static_cast<char>(x >> 24);
+      }
+      block[0] = static_cast<char>('0' + i);
+      return block;
+  };
+  auto flood = [&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "flood")
+      {
+          for (int i = 0; i < 10; i++)
+              conn.send_binary(noise(i));
+      }
+      else
+          // repeats the end of the last message, which the client never got
+          conn.send_text("dropped " + std::to_string(conn.send_queue().dropped_messages) + " " + noise(9).substr(9000));
+  };
+  CROW_ROUTE(app, "/newest").websocket().permessage_deflate().send_queue(50000, 10000, websocket::overflow::drop_newest).onmessage(flood);
+  CROW_ROUTE(app, "/oldest").websocket().permessage_deflate().send_queue(50000, 10000, websocket::overflow::drop_oldest).onmessage(flood);
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c, const std::string& url) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer("GET " + url + " HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Extensions: permessage-deflate\r\n\r\n"));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  auto receive = [](asio::ip::tcp::socket& c, compression::message_inflater& inflater) {
+      unsigned char header[10];
+      asio::read(c, asio::buffer(header, 2));
+      size_t size = header[1] & 0x7f;
+      if (size >= 126)
+      {
+          size_t extra = size == 126 ? 2 : 8;
+          asio::read(c, asio::buffer(header + 2, extra));
+          size = 0;
+          for (size_t i = 0; i < extra; i++)
+              size = (size << 8) | header[2 + i];
+      }
+      std::string payload(size, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      std::string message;
+      if (!(header[0] & 0x40))
+          message = payload;
+      else if (!inflater.decompress(payload, message))
+          return std::string("corrupt");
+      return message;
+  };
+
+  // with context takeover, only messages that were never compressed can be dropped
+  for (auto url : {"/newest", "/oldest"})
+  {
+      asio::ip::tcp::socket c(is);
+      compression::message_inflater inflater;
+      connect(c, url);
+      send(c, "flood");
+      for (int i = 0; i < 4; i++)
+          CHECK(noise(i) == receive(c, inflater));
+      send(c, "stats");
+      CHECK("dropped 6 " + noise(9).substr(9000) == receive(c, inflater));
+  }
+
+  app.stop();
+}
+
+TEST_CASE("websocket_timeouts")
+{
+  SimpleApp app;
+  std::atomic<int> closed{0};
+
+  auto echo = [](websocket::connection& conn, const std::string& message, bool){
+      if (message == "bye")
+          conn.close("bye");
+      else
+          conn.send_text(message);
+  };
+  auto count = [&](websocket::connection&, const std::string&){
+      closed++;
+  };
+  CROW_ROUTE(app, "/ping").websocket().keepalive(std::chrono::milliseconds(100), 2).onmessage(echo).onclose(count);
+  CROW_ROUTE(app, "/idle").websocket().idle_timeout(std::chrono::milliseconds(300)).onmessage(echo).onclose(count);
+  CROW_ROUTE(app, "/close").websocket().close_timeout(std::chrono::milliseconds(200)).onmessage(echo).onclose(count);
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c, const std::string& url) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer("GET " + url + " HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  // the opcode of the next frame, or -1 once the server closed the socket
+  auto receive = [](asio::ip::tcp::socket& c) {
+      unsigned char header[2];
+      boost::system::error_code ec;
+      asio::read(c, asio::buffer(header, 2), ec);
+      if (ec)
+          return -1;
+      std::string payload(header[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      return header[0] & 0x0f;
+  };
+  auto elapsed = [](std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  SECTION("pings answered")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/ping");
+      for (int i = 0; i < 5; i++)
+      {
+          CHECK(0x9 == receive(c));
+          c.send(asio::buffer(std::string("\x8a\x00", 2)));
+      }
+      send(c, "still here");
+      int opcode;
+      while ((opcode = receive(c)) == 0x9)
+          ;
+      CHECK(0x1 == opcode);
+      CHECK(0 == closed);
+  }
+
+  SECTION("pings unanswered")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/ping");
+      auto start = std::chrono::steady_clock::now();
+      CHECK(0x9 == receive(c));
+      CHECK(0x9 == receive(c));
+      // dropped when the third ping is due
+      CHECK(-1 == receive(c));
+      CHECK(elapsed(start) >= 300);
+      for (int i = 0; i < 100 && !closed; i++)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      CHECK(1 == closed);
+  }
+
+  SECTION("idle")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/idle");
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < 3; i++)
+      {
+          std::this_thread::sleep_for(std::chrono::milliseconds(150));
+          send(c, "hi");
+          CHECK(0x1 == receive(c));
+      }
+      CHECK(-1 == receive(c));
+      CHECK(elapsed(start) >= 750);
+  }
+
+  SECTION("close handshake")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/close");
+      send(c, "bye");
+      auto start = std::chrono::steady_clock::now();
+      CHECK(0x8 == receive(c));
+      // the close frame isn't answered
+      CHECK(-1 == receive(c));
+      CHECK(elapsed(start) >= 200);
+  }
+
+  app.stop();
+}
+
+TEST_CASE("websocket_message_size")
+{
+  SimpleApp app;
+  std::string streamed;
+  int chunks = 0;
+
+  CROW_ROUTE(app, "/limited").websocket().max_message_size(1000)
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool){
+      conn.send_text(std::to_string(message.size()));
+  });
+  CROW_ROUTE(app, "/stream").websocket()
+  .onchunk([&](websocket::connection& conn, const char* data, size_t size, bool is_binary, bool is_last){
+      streamed.append(data, size);
+      chunks++;
+      if (is_last)
+      {
+          conn.send_text(std::string(is_binary ? "binary " : "text ") + std::to_string(streamed.size()));
+          streamed.clear();
+      }
+  });
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c, const std::string& url) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer("GET " + url + " HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  // a frame header for an unmasked payload of `size` bytes
+  auto header = [](char first, size_t size) {
+      if (size < 126)
+          return std::string{first, static_cast<char>(size)};
+      return std::string{first, 126, static_cast<char>(size >> 8), static_cast<char>(size)};
+  };
+  // the payload of the next frame, and the status code for a close
+  auto receive = [](asio::ip::tcp::socket& c) {
+      unsigned char h[2];
+      asio::read(c, asio::buffer(h, 2));
+      std::string payload(h[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      if ((h[0] & 0x0f) == 0x8)
+          return "close " + std::to_string((payload[0] & 0xff) << 8 | (payload[1] & 0xff));
+      return payload;
+  };
+
+  SECTION("limit")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/limited");
+      c.send(asio::buffer(header('\x82', 1000) + std::string(1000, 'a')));
+      CHECK("1000" == receive(c));
+      // refused from the header alone, the payload isn't sent
+      c.send(asio::buffer(header('\x82', 1001)));
+      CHECK("close 1009" == receive(c));
+  }
+
+  SECTION("limit over fragments")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/limited");
+      c.send(asio::buffer(header('\x02', 600) + std::string(600, 'a')));
+      c.send(asio::buffer(header('\x80', 600)));
+      CHECK("close 1009" == receive(c));
+  }
+
+  SECTION("protocol errors")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/limited");
+      // a continuation with no message to continue
+      c.send(asio::buffer(header('\x80', 1) + "a"));
+      CHECK("close 1002" == receive(c));
+
+      asio::ip::tcp::socket d(is);
+      connect(d, "/limited");
+      d.send(asio::buffer(header('\x89', 126) + std::string(126, 'a')));
+      CHECK("close 1002" == receive(d));
+  }
+
+  SECTION("streaming")
+  {
+      asio::ip::tcp::socket c(is);
+      connect(c, "/stream");
+      c.send(asio::buffer(header('\x01', 2) + "ab" + header('\x00', 2) + "cd" + header('\x89', 0) + header('\x80', 2) + "ef"));
+      CHECK("" == receive(c)); // the pong
+      CHECK("text 6" == receive(c));
+
+      chunks = 0;
+      c.send(asio::buffer(header('\x82', 50000) + std::string(50000, 'a')));
+      CHECK("binary 50000" == receive(c));
+      // read as it came, a buffer at a time
+      CHECK(chunks > 2);
+  }
+
+  app.stop();
+}
+
+TEST_CASE("websocket_utf8")
+{
+  auto valid = [](const std::string& text) {
+      // whole, and split at every position
+      bool whole;
+      {
+          websocket::detail::utf8_validator v;
+          whole = v.feed(text.data(), text.size()) && v.complete();
+      }
+      for (size_t at = 0; at <= text.size(); at++)
+      {
+          websocket::detail::utf8_validator v;
+          bool split = v.feed(text.data(), at) && v.feed(text.data() + at, text.size() - at) && v.complete();
+          CHECK(whole == split);
+      }
+      return whole;
+  };
+  std::string ascii(100, 'a');
+  CHECK(valid(""));
+  CHECK(valid(ascii));
+  CHECK(valid(ascii + "\xc3\xa9" + ascii + "\xe2\x82\xac" + ascii + "\xf0\x9f\x98\x80" + ascii));
+  CHECK(valid("\x7f\xc2\x80\xdf\xbf\xe0\xa0\x80\xed\x9f\xbf\xee\x80\x80\xef\xbf\xbf\xf0\x90\x80\x80\xf4\x8f\xbf\xbf"));
+
+  CHECK_FALSE(valid(ascii + "\x80" + ascii));    // continuation byte first
+  CHECK_FALSE(valid(ascii + "\xc3" + ascii));    // missing continuation
+  CHECK_FALSE(valid(ascii + "\xe2\x82"));        // cut off at the end
+  CHECK_FALSE(valid("\xc0\xaf"));                // overlong
+  CHECK_FALSE(valid("\xe0\x80\xaf"));
+  CHECK_FALSE(valid("\xf0\x80\x80\xaf"));
+  CHECK_FALSE(valid("\xed\xa0\x80"));            // surrogate
+  CHECK_FALSE(valid("\xf4\x90\x80\x80"));        // above U+10FFFF
+  CHECK_FALSE(valid("\xf5\x80\x80\x80"));
+  CHECK_FALSE(valid(ascii + "\xff"));
+
+  // every code point, encoded
+  websocket::detail::utf8_validator v;
+  for (uint32_t c = 0; c < 0x110000; c++)
+  {
+      std::string s;
+      if (c < 0x80)
+          s = {static_cast<char>(c)};
+      else if (c < 0x800)
+          s = {static_cast<char>(0xc0 | c >> 6), static_cast<char>(0x80 | (c & 0x3f))};
+      else if (c < 0x10000)
+          s = {static_cast<char>(0xe0 | c >> 12), static_cast<char>(0x80 | (c >> 6 & 0x3f)), static_cast<char>(0x80 | (c & 0x3f))};
+      else
+          s = {static_cast<char>(0xf0 | c >> 18), static_cast<char>(0x80 | (c >> 12 & 0x3f)), static_cast<char>(0x80 | (c >> 6 & 0x3f)), static_cast<char>(0x80 | (c & 0x3f))};
+      v.reset();
+      bool surrogate = c >= 0xd800 && c <= 0xdfff;
+      if (surrogate == (v.feed(s.data(), s.size()) && v.complete()))
+          FAIL_CHECK("code point " << c);
+  }
+
+  SimpleApp app;
+  CROW_ROUTE(app, "/ws").websocket()
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool is_binary){
+      conn.send_text(std::string(is_binary ? "binary " : "text ") + std::to_string(message.size()));
+  });
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer(std::string("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto frame = [](char first, const std::string& payload) {
+      return std::string{first, static_cast<char>(payload.size())} + payload;
+  };
+  auto receive = [](asio::ip::tcp::socket& c) {
+      unsigned char h[2];
+      asio::read(c, asio::buffer(h, 2));
+      std::string payload(h[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      if ((h[0] & 0x0f) == 0x8)
+          return "close " + std::to_string((payload[0] & 0xff) << 8 | (payload[1] & 0xff));
+      return payload;
+  };
+
+  asio::ip::tcp::socket c(is);
+  connect(c);
+  // a character split between two fragments
+  c.send(asio::buffer(frame('\x01', "caf\xc3") + frame('\x80', "\xa9")));
+  CHECK("text 5" == receive(c));
+  // binary messages aren't checked
+  c.send(asio::buffer(frame('\x82', "\xff")));
+  CHECK("binary 1" == receive(c));
+  c.send(asio::buffer(frame('\x81', "caf\xc3")));
+  CHECK("close 1007" == receive(c));
+  // found before the end of the message
+  asio::ip::tcp::socket d(is);
+  connect(d);
+  d.send(asio::buffer(frame('\x01', "\xc3(")));
+  CHECK("close 1007" == receive(d));
+
+  app.stop();
+}
+
+TEST_CASE("websocket_migration")
+{
+  SimpleApp app;
+  std::mutex mutex;
+  boost::asio::io_service* other = nullptr;
+
+  CROW_ROUTE(app, "/ws").websocket()
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "join")
+      {
+          app.channel("feed").subscribe(conn);
+          conn.send_text("joined");
+      }
+      else if (message == "here")
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          other = &conn.get_io_service();
+          conn.send_text("ok");
+      }
+      else if (message == "move")
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          conn.send_text(conn.move_to(*other) ? "moving" : "staying");
+      }
+      else if (message == "thread")
+      {
+          std::ostringstream os;
+          os << std::this_thread::get_id();
+          conn.send_text(os.str());
+      }
+      else
+          conn.send_text(message);
+  });
+
+  std::atomic<int> moved{0};
+  CROW_ROUTE(app, "/full").websocket().send_queue(50000, 10000, websocket::overflow::block)
+  .onmessage([&](websocket::connection& conn, const std::string&, bool){
+      for (int i = 0; i < 10; i++)
+          conn.send_text(std::string(10000, '0' + i));
+      std::lock_guard<std::mutex> lock(mutex);
+      moved = conn.move_to(*other) ? 1 : 2;
+  });
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).concurrency(2).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer(std::string("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  auto receive = [](asio::ip::tcp::socket& c) {
+      char header[2];
+      asio::read(c, asio::buffer(header, 2));
+      std::string payload(header[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      return payload;
+  };
+  auto thread_of = [&](asio::ip::tcp::socket& c) {
+      send(c, "thread");
+      return receive(c);
+  };
+
+  // a and b are on different workers, a moves to b's while the channel is published to
+  asio::ip::tcp::socket a(is), b(is);
+  connect(a);
+  connect(b);
+  CHECK(thread_of(a) != thread_of(b));
+  send(b, "here");
+  CHECK("ok" == receive(b));
+  send(a, "join");
+  CHECK("joined" == receive(a));
+  send(b, "join");
+  CHECK("joined" == receive(b));
+
+  for (int i = 0; i < 500; i++)
+  {
+      if (i == 200)
+          send(a, "move");
+      app.channel("feed").publish_text(std::to_string(i));
+  }
+  // every message arrives once and in order, the reply to the move being somewhere among them
+  int next = 0;
+  std::string status;
+  while (next < 500)
+  {
+      std::string message = receive(a);
+      if (message == "moving" || message == "staying")
+          status = message;
+      else
+      {
+          CHECK(std::to_string(next) == message);
+          next++;
+      }
+  }
+  if (status.empty())
+      status = receive(a);
+  CHECK("moving" == status);
+  for (int i = 0; i < 500; i++)
+      CHECK(std::to_string(i) == receive(b));
+
+  CHECK(thread_of(a) == thread_of(b));
+  send(a, "still here");
+  CHECK("still here" == receive(a));
+  CHECK(2 == app.channel("feed").size());
+  app.channel("feed").publish_text("after");
+  CHECK("after" == receive(a));
+  CHECK("after" == receive(b));
+
+  // it leaves the channel from its new worker
+  a.close();
+  for (int i = 0; i < 100 && app.channel("feed").size() != 1; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(1 == app.channel("feed").size());
+
+  // a connection with a full send queue stays where it is
+  asio::ip::tcp::socket c(is);
+  c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+  c.send(asio::buffer(std::string("GET /full HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+  asio::streambuf handshake;
+  asio::read_until(c, handshake, "\r\n\r\n");
+  send(c, "flood");
+  for (int i = 0; i < 100 && !moved; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(2 == moved);
+
+  app.stop();
+}
+
+TEST_CASE("websocket_migration_publishers")
+{
+  SimpleApp app;
+  std::mutex mutex;
+  boost::asio::io_service* other = nullptr;
+
+  // the channel is published to from both workers' handlers while a connection moves between them
+  CROW_ROUTE(app, "/ws").websocket()
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "join")
+      {
+          app.channel("feed").subscribe(conn);
+          conn.send_text("joined");
+      }
+      else if (message == "here")
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          other = &conn.get_io_service();
+          conn.send_text("ok");
+      }
+      else if (message == "move")
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          conn.send_text(conn.move_to(*other) ? "moving" : "staying");
+      }
+      else if (message == "thread")
+      {
+          std::ostringstream os;
+          os << std::this_thread::get_id();
+          conn.send_text(os.str());
+      }
+      else
+      {
+          for (int i = 0; i < 1000; i++)
+              app.channel("feed").publish_text(message + std::to_string(i));
+      }
+  });
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).concurrency(2).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer(std::string("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto send = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+  };
+  auto receive = [](asio::ip::tcp::socket& c) {
+      char header[2];
+      asio::read(c, asio::buffer(header, 2));
+      std::string payload(header[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      return payload;
+  };
+  auto thread_of = [&](asio::ip::tcp::socket& c) {
+      send(c, "thread");
+      return receive(c);
+  };
+
+  // a and c are on one worker, b on the other one, which a moves to
+  asio::ip::tcp::socket a(is), b(is), c(is);
+  connect(a);
+  connect(b);
+  connect(c);
+  CHECK(thread_of(a) != thread_of(b));
+  CHECK(thread_of(a) == thread_of(c));
+  send(b, "here");
+  CHECK("ok" == receive(b));
+  send(a, "join");
+  CHECK("joined" == receive(a));
+
+  send(a, "move");
+  send(c, "old ");
+  send(b, "new ");
+  // what each worker published arrives once and in order
+  int old_next = 0, new_next = 0;
+  std::string status;
+  while (old_next < 1000 || new_next < 1000)
+  {
+      std::string message = receive(a);
+      if (message == "moving" || message == "staying")
+          status = message;
+      else if (message.compare(0, 4, "old ") == 0)
+          CHECK("old " + std::to_string(old_next++) == message);
+      else
+          CHECK("new " + std::to_string(new_next++) == message);
+  }
+  if (status.empty())
+      status = receive(a);
+  CHECK("moving" == status);
+  CHECK(thread_of(a) == thread_of(b));
+
+  // nothing was left over
+  send(b, "last ");
+  for (int i = 0; i < 1000; i++)
+      CHECK("last " + std::to_string(i) == receive(a));
+  CHECK(1 == app.channel("feed").size());
+
+  app.stop();
+}
+
+TEST_CASE("websocket_rebalance")
+{
+  SimpleApp app;
+
+  CROW_ROUTE(app, "/ws").websocket()
+  .onmessage([&](websocket::connection& conn, const std::string& message, bool){
+      if (message == "thread")
+      {
+          std::ostringstream os;
+          os << std::this_thread::get_id();
+          conn.send_text(os.str());
+      }
+      else
+          conn.send_text(message);
+  });
+
+  app.validate();
+
+  auto _ = async(launch::async,
+                 [&] { app.bindaddr(LOCALHOST_ADDRESS).port(45451).concurrency(2).websocket_rebalance(std::chrono::milliseconds(50)).run(); });
+  app.wait_for_server_start();
+  asio::io_service is;
+
+  auto connect = [&](asio::ip::tcp::socket& c) {
+      c.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string(LOCALHOST_ADDRESS), 45451));
+      c.send(asio::buffer(std::string("GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nupgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")));
+      asio::streambuf handshake;
+      asio::read_until(c, handshake, "\r\n\r\n");
+  };
+  auto echo = [](asio::ip::tcp::socket& c, const std::string& message) {
+      c.send(asio::buffer("\x81" + std::string(1, static_cast<char>(message.size())) + message));
+      char header[2];
+      asio::read(c, asio::buffer(header, 2));
+      std::string payload(header[1] & 0x7f, '\0');
+      asio::read(c, asio::buffer(&payload[0], payload.size()));
+      return payload;
+  };
+
+  // round robin puts the two busy connections on the same worker, and the quiet one on the other
+  asio::ip::tcp::socket busy1(is), quiet(is), busy2(is);
+  connect(busy1);
+  connect(quiet);
+  connect(busy2);
+  CHECK(echo(busy1, "thread") == echo(busy2, "thread"));
+  CHECK(echo(busy1, "thread") != echo(quiet, "thread"));
+
+  // one of them moves while it's used, without the client noticing
+  bool moved = false;
+  for (int i = 0; i < 5000 && !moved; i++)
+  {
+      CHECK("a" + std::to_string(i) == echo(busy1, "a" + std::to_string(i)));
+      CHECK("b" + std::to_string(i) == echo(busy2, "b" + std::to_string(i)));
+      if (i % 100 == 99)
+          moved = echo(busy1, "thread") != echo(busy2, "thread");
+  }
+  CHECK(moved);
+
+  app.stop();
+}
+
 TEST_CASE("zlib_compression")
 {
     static char buf_deflate[2048];